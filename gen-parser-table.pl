@@ -0,0 +1,135 @@
+#!/usr/bin/perl
+
+# Generates src/parsertable.inc, the transition table driving
+# vterm_input_write(). Each entry gives the action to perform on a byte and
+# the parser state to move to afterwards. There are two tables; the second is
+# used in UTF-8 mode, where bytes 0x80 to 0x9f are not C1 controls.
+
+use strict;
+use warnings;
+
+my @STATES = qw(
+   NORMAL ESCAPE ESCAPE_INTERMED
+   CSI_LEADER CSI_ARGS CSI_INTERMED
+   OSC_COMMAND DCS_COMMAND
+   OSC DCS OSC_ESC DCS_ESC
+);
+
+my %IS_STRING = map { $_ => 1 } qw( OSC DCS OSC_ESC DCS_ESC );
+
+# Returns [ action, nextstate ] for byte $c in state $st
+sub transition
+{
+   my ( $st, $c, $utf8 ) = @_;
+   my $c1_allowed = !$utf8;
+
+   # Bytes with the same meaning in every state
+   if( $c == 0x00 or $c == 0x7f ) { # NUL, DEL
+      return [ $IS_STRING{$st} ? "STRING_FLUSH" : "IGNORE", $st ];
+   }
+   if( $c == 0x18 or $c == 0x1a ) { # CAN, SUB
+      return [ "IGNORE", "NORMAL" ];
+   }
+   if( $c == 0x1b ) { # ESC
+      return [ "ESC_START", "OSC_ESC" ] if $st eq "OSC" or $st eq "OSC_ESC";
+      return [ "ESC_START", "DCS_ESC" ] if $st eq "DCS" or $st eq "DCS_ESC";
+      return [ "ESC_START", "ESCAPE" ];
+   }
+   if( $c == 0x07 and $IS_STRING{$st} ) { # BEL, can stand for ST
+      # ... but after an ESC it just aborts the string
+      return [ "IGNORE", "ESCAPE" ] if $st =~ m/_ESC$/;
+      return [ "STRING_END", "NORMAL" ];
+   }
+   if( $c < 0x20 ) { # other C0
+      return [ $IS_STRING{$st} ? "STRING_CONTROL" : "CONTROL", $st ];
+   }
+
+   if( $st eq "NORMAL" ) {
+      if( $c1_allowed and $c >= 0x80 and $c < 0xa0 ) {
+         return [ "DCS_START", "DCS_COMMAND" ] if $c == 0x90;
+         return [ "CSI_START", "CSI_LEADER" ]  if $c == 0x9b;
+         return [ "OSC_START", "OSC_COMMAND" ] if $c == 0x9d;
+         return [ "CONTROL", "NORMAL" ];
+      }
+      return [ "TEXT", "NORMAL" ];
+   }
+
+   if( $st eq "ESCAPE" or $st eq "ESCAPE_INTERMED" or $st =~ m/_ESC$/ ) {
+      my $string = $st =~ m/_ESC$/;
+
+      # Hoist an ESC letter into a C1 if we're not in a string mode
+      # Always accept ESC \ == ST even in string mode
+      if( $st ne "ESCAPE_INTERMED" and $c >= 0x40 and $c < 0x60 ) {
+         return [ "STRING_END", "NORMAL" ] if $string and $c == 0x5c;
+
+         if( !$string ) {
+            return [ "DCS_START", "DCS_COMMAND" ] if $c == 0x50;
+            return [ "CSI_START", "CSI_LEADER" ]  if $c == 0x5b;
+            return [ "OSC_START", "OSC_COMMAND" ] if $c == 0x5d;
+            return [ "ESC_C1", "NORMAL" ];
+         }
+      }
+
+      return [ "COLLECT", "ESCAPE_INTERMED" ] if $c >= 0x20 and $c < 0x30;
+      return [ "ESC_DISPATCH", "NORMAL" ]     if $c >= 0x30 and $c < 0x7f;
+      return [ "IGNORE", $st eq "ESCAPE_INTERMED" ? $st : "ESCAPE" ];
+   }
+
+   if( $st =~ m/^CSI_/ ) {
+      return [ "CSI_LEADER", "CSI_LEADER" ] if $st eq "CSI_LEADER" and $c >= 0x3c and $c <= 0x3f;
+
+      if( $st ne "CSI_INTERMED" ) {
+         return [ "CSI_DIGIT", "CSI_ARGS" ]    if $c >= 0x30 and $c <= 0x39;
+         return [ "CSI_SUBPARAM", "CSI_ARGS" ] if $c == 0x3a;
+         return [ "CSI_SEP", "CSI_ARGS" ]      if $c == 0x3b;
+      }
+
+      return [ "COLLECT", "CSI_INTERMED" ]  if $c >= 0x20 and $c < 0x30;
+      return [ "CSI_DISPATCH", "NORMAL" ]   if $c >= 0x40 and $c < 0x7f;
+      # else was invalid CSI
+      return [ "IGNORE", "NORMAL" ];
+   }
+
+   if( $st eq "OSC_COMMAND" ) {
+      return [ "OSC_DIGIT", "OSC_COMMAND" ]  if $c >= 0x30 and $c <= 0x39;
+      return [ "OSC_SEP", "OSC" ]            if $c == 0x3b;
+      return [ "OSC_END_EMPTY", "NORMAL" ]   if $c1_allowed and $c == 0x9c;
+      return [ "OSC_STRING", "OSC" ];
+   }
+
+   if( $st eq "DCS_COMMAND" ) {
+      return [ "DCS_COLLECT_END", "DCS" ] if $c >= 0x40 and $c < 0x7f;
+      return [ "DCS_COLLECT", "DCS_COMMAND" ];
+   }
+
+   if( $st eq "OSC" or $st eq "DCS" ) {
+      return [ "STRING_END", "NORMAL" ] if $c1_allowed and $c == 0x9c;
+      return [ "IGNORE", $st ];
+   }
+
+   die "Unhandled state $st\n";
+}
+
+print <<"EOF";
+/* Generated by gen-parser-table.pl; do not edit */
+
+static const uint16_t parser_table[2][PARSER_STATES][256] = {
+EOF
+
+foreach my $utf8 ( 0, 1 ) {
+   print "  { /* " . ( $utf8 ? "UTF-8" : "8-bit C1" ) . " */\n";
+   foreach my $st ( @STATES ) {
+      print "    [$st] = {\n";
+      foreach my $row ( 0 .. 63 ) {
+         my @cells = map {
+            my ( $action, $next ) = @{ transition( $st, $_, $utf8 ) };
+            "T($action,$next)"
+         } $row*4 .. $row*4 + 3;
+         printf "      /* %02x */ %s,\n", $row*4, join ", ", @cells;
+      }
+      print "    },\n";
+   }
+   print "  },\n";
+}
+
+print "};\n";
@@ -236,10 +236,26 @@ typedef enum {
   VTERM_ATTR_FONT,       // number: 10-19
   VTERM_ATTR_FOREGROUND, // color:  30-39 90-97
   VTERM_ATTR_BACKGROUND, // color:  40-49 100-107
+  VTERM_ATTR_HYPERLINK,  // string: OSC 8 "params;URI"; an empty URI ends the link
 
   VTERM_N_ATTRS
 } VTermAttr;
 
+typedef enum {
+  VTERM_ATTR_BOLD_MASK       = 1 << 0,
+  VTERM_ATTR_UNDERLINE_MASK  = 1 << 1,
+  VTERM_ATTR_ITALIC_MASK     = 1 << 2,
+  VTERM_ATTR_BLINK_MASK      = 1 << 3,
+  VTERM_ATTR_REVERSE_MASK    = 1 << 4,
+  VTERM_ATTR_STRIKE_MASK     = 1 << 5,
+  VTERM_ATTR_FONT_MASK       = 1 << 6,
+  VTERM_ATTR_FOREGROUND_MASK = 1 << 7,
+  VTERM_ATTR_BACKGROUND_MASK = 1 << 8,
+  VTERM_ATTR_HYPERLINK_MASK  = 1 << 9,
+
+  VTERM_ALL_ATTRS_MASK = (1 << 10) - 1
+} VTermAttrMask;
+
 typedef enum {
   /* VTERM_PROP_NONE = 0 */
   VTERM_PROP_CURSORVISIBLE = 1, // bool
@@ -250,6 +266,7 @@ typedef enum {
   VTERM_PROP_REVERSE,           // bool
   VTERM_PROP_CURSORSHAPE,       // number
   VTERM_PROP_MOUSE,             // number
+  VTERM_PROP_SYNCOUTPUT,        // bool
 
   VTERM_N_PROPS
 } VTermProp;
@@ -286,12 +303,14 @@ typedef struct {
 } VTermLineInfo;
 
 /* Copies of VTermState fields that the 'resize' callback might have reason to
- * edit. 'resize' callback gets total control of these fields and may
- * free-and-reallocate them if required. They will be copied back from the
+ * edit. 'resize' callback gets total control of these fields, and may move
+ * the line info about to match how it moved the rows; the arrays already
+ * have room for the new number of rows. They will be copied back from the
  * struct after the callback has returned.
  */
 typedef struct {
   VTermPos pos;                /* current cursor position */
+  VTermLineInfo *lineinfos[2]; /* [1] may be NULL */
 } VTermStateFields;
 
 typedef struct {
@@ -310,11 +329,69 @@ void   vterm_free(VTerm* vt);
 void vterm_get_size(const VTerm *vt, int *rowsp, int *colsp);
 void vterm_set_size(VTerm *vt, int rows, int cols);
 
+/* While deferred, vterm_set_size() only notes the size, and the last one noted
+ * is applied before the next input is written or screen damage is flushed.
+ * This makes a burst of resizes, such as while a window edge is dragged, cost
+ * one. Until then vterm_get_size() and everything else see the old size.
+ * Turning deferral off applies any size still pending. */
+void vterm_set_defer_resize(VTerm *vt, int defer);
+
 int  vterm_get_utf8(const VTerm *vt);
 void vterm_set_utf8(VTerm *vt, int is_utf8);
 
+/* Bytes currently allocated through the allocator, by what holds them */
+typedef struct {
+  size_t core;       /* the VTerm, VTermState and VTermScreen themselves */
+  size_t input;      /* buffers for gathered input and accumulated strings */
+  size_t output;     /* output and temporary buffers */
+  size_t screen;     /* the primary screen buffer and its per-row data */
+  size_t altscreen;  /* the altscreen buffer, while it is allocated */
+  size_t lineinfo;   /* VTermLineInfo of both buffers */
+  size_t tabstops;
+  size_t combine;    /* characters of the last glyph, for combining */
+  size_t scrollback; /* the built-in scrollback store and its search index */
+  size_t interned;   /* the hyperlink table and any CSI handler tables */
+  size_t extras;     /* the matcher, snapshots and shared memory export */
+  size_t total;
+} VTermMemoryUsage;
+
+/* Walks the terminal's structures when called, rather than counting as it
+ * goes, so costs nothing otherwise. Memory the allocator itself uses, and
+ * shared memory and spill file mappings, aren't included. */
+void vterm_get_memory_usage(const VTerm *vt, VTermMemoryUsage *usage);
+
+/* Packs the screen's buffers into a compact form and frees them, along with
+ * scratch space, to save memory while the terminal is idle. Nothing is lost:
+ * input that changes the screen, reading cells, resizing and so on unpack
+ * them again first. */
+void vterm_hibernate(VTerm *vt);
+int  vterm_is_hibernating(const VTerm *vt);
+
+/* The altscreen's buffers are allocated when it is first entered and kept
+ * afterwards, so that full-screen programs started one after another don't
+ * reallocate them each time. Call this, for example from a timer some while
+ * after the altscreen was left, to free them; returns true if there was
+ * anything to free. Does nothing while the altscreen is in use. */
+int  vterm_release_altscreen(VTerm *vt);
+
 size_t vterm_input_write(VTerm *vt, const char *bytes, size_t len);
 
+/* As vterm_input_write(), but stops at the first point after 'max_bytes' where
+ * no escape sequence or UTF-8 character is left part-way through, and returns
+ * how many bytes it consumed. The rest may be passed in again later. An OSC or
+ * DCS string may be stopped within, in which case it arrives in fragments */
+size_t vterm_input_write_budget(VTerm *vt, const char *bytes, size_t len, size_t max_bytes);
+
+typedef struct {
+  const char *bytes;
+  size_t      len;
+} VTermInputSegment;
+
+/* Parses the segments as one continuous stream. Segments adjacent in memory
+ * are passed through as one, and short discontiguous ones are gathered
+ * together, so that text and OSC/DCS strings are split as little as possible */
+size_t vterm_input_writev(VTerm *vt, const VTermInputSegment segs[], int nsegs);
+
 /* Setting output callback will override the buffer logic */
 typedef void VTermOutputCallback(const char *s, size_t len, void *user);
 void vterm_output_set_callback(VTerm *vt, VTermOutputCallback *func, void *user);
@@ -375,10 +452,36 @@ typedef struct {
 void  vterm_parser_set_callbacks(VTerm *vt, const VTermParserCallbacks *callbacks, void *user);
 void *vterm_parser_get_cbdata(VTerm *vt);
 
+typedef enum {
+  VTERM_STRING_DISCARD,  // drop a string longer than the limit entirely
+  VTERM_STRING_TRUNCATE, // deliver just its first max_len bytes
+  VTERM_STRING_EMPTY,    // deliver an empty string in its place
+} VTermStringOverflow;
+
+/* Have the strings of one OSC command, or of DCS commands ending in the given
+ * final byte, delivered as a single fragment holding the whole payload rather
+ * than in pieces. Payloads that arrive in one write are passed through without
+ * copying. max_len of 0 turns this off again. */
+void vterm_parser_accumulate_osc(VTerm *vt, int command, size_t max_len, VTermStringOverflow overflow);
+void vterm_parser_accumulate_dcs(VTerm *vt, char final, size_t max_len, VTermStringOverflow overflow);
+
 // -----------
 // State layer
 // -----------
 
+/* The complete set of pen attributes, as delivered by the 'setpen' callback */
+typedef struct VTermPen {
+  VTermColor fg;
+  VTermColor bg;
+  unsigned int bold:1;
+  unsigned int underline:2;
+  unsigned int italic:1;
+  unsigned int blink:1;
+  unsigned int reverse:1;
+  unsigned int strike:1;
+  unsigned int font:4; /* To store 0-9 */
+} VTermPen;
+
 typedef struct {
   int (*putglyph)(VTermGlyphInfo *info, VTermPos pos, void *user);
   int (*movecursor)(VTermPos pos, VTermPos oldpos, int visible, void *user);
@@ -391,6 +494,10 @@ typedef struct {
   int (*bell)(void *user);
   int (*resize)(int rows, int cols, VTermStateFields *fields, void *user);
   int (*setlineinfo)(int row, const VTermLineInfo *newinfo, const VTermLineInfo *oldinfo, void *user);
+  /* If set, called once per SGR (or pen reset/restore) with the whole new pen
+   * and a mask of the attributes it set, instead of once per attribute via
+   * setpenattr */
+  int (*setpen)(const VTermPen *pen, VTermAttrMask changed, void *user);
 } VTermStateCallbacks;
 
 typedef struct {
@@ -408,6 +515,14 @@ void *vterm_state_get_cbdata(VTermState *state);
 void  vterm_state_set_unrecognised_fallbacks(VTermState *state, const VTermStateFallbacks *fallbacks, void *user);
 void *vterm_state_get_unrecognised_fbdata(VTermState *state);
 
+/* Sets the handler for CSI sequences with the given leader, intermediate
+ * and final byte (leader and intermed 0 for none), ahead of any built-in
+ * handling. Returning 0 from it passes the sequence on to the fallbacks.
+ * A NULL handler restores the built-in behaviour. Returns 0 if the bytes
+ * are not valid for their position, or too many handlers are set. */
+typedef int VTermCSIHandler(const char *leader, const long args[], int argcount, const char *intermed, char command, void *user);
+int vterm_state_set_csi_handler(VTermState *state, char leader, char intermed, char command, VTermCSIHandler *handler, void *user);
+
 void vterm_state_reset(VTermState *state, int hard);
 void vterm_state_get_cursorpos(const VTermState *state, VTermPos *cursorpos);
 void vterm_state_get_default_colors(const VTermState *state, VTermColor *default_fg, VTermColor *default_bg);
@@ -485,6 +600,165 @@ void *vterm_screen_get_unrecognised_fbdata(VTermScreen *screen);
 
 void vterm_screen_enable_altscreen(VTermScreen *screen, int altscreen);
 
+/* Keeps up to max_lines lines scrolled off the primary screen in a built-in
+ * store, in place of the sb_pushline and sb_popline callbacks. Identical
+ * lines share storage. 0 discards the store and goes back to the callbacks. */
+void   vterm_screen_set_scrollback(VTermScreen *screen, size_t max_lines);
+
+/* Past the newest hot_lines lines, the built-in store compresses lines
+ * block_lines at a time (by default 1024 and 64). Reading an old line
+ * decompresses its block; the last few used stay decompressed. block_lines
+ * 0 keeps every line uncompressed. Has no effect before the store is on. */
+void   vterm_screen_set_scrollback_compression(VTermScreen *screen, size_t hot_lines, size_t block_lines);
+
+/* Instead of compressing them, the built-in store appends those lines to a
+ * file created at path and reads them back through a mapping of it. The file
+ * must not already exist, and is removed again straight away; its space is
+ * reclaimed as lines are dropped. Returns 0 if the file can't be created, if
+ * the store isn't on or already has a file, or on platforms without mmap(). */
+int    vterm_screen_set_scrollback_file(VTermScreen *screen, const char *path);
+size_t vterm_screen_get_scrollback_count(const VTermScreen *screen);
+
+/* Fills cells[0] to cells[cols-1] with a line from the built-in store, index
+ * 0 being the most recent, padding or clipping it to cols. info may be NULL;
+ * only its continuation flag is kept. Returns 0 if there is no such line. */
+int vterm_screen_get_scrollback_line(const VTermScreen *screen, size_t index, int cols, VTermScreenCell *cells, VTermLineInfo *info);
+
+typedef enum {
+  VTERM_SEARCH_CASELESS = 1 << 0, /* ignore case, for Latin, Greek and Cyrillic */
+  VTERM_SEARCH_BACKWARD = 1 << 1, /* find hits before from, the latest first */
+} VTermSearchFlags;
+
+typedef struct {
+  VTermPos start; /* a row < 0 is in the built-in store, -1 its most recent line */
+  VTermPos end;   /* just after the last cell of the hit, on that cell's row */
+} VTermSearchHit;
+
+/* Keeps an index of the lines in the built-in store, so that searches only
+ * look at the parts of it that could match. Costs some memory per line and
+ * time as lines are pushed. Goes away along with the store. */
+void vterm_screen_enable_search_index(VTermScreen *screen, int enabled);
+
+/* Finds up to max_hits occurrences of the UTF-8 string query, on the screen
+ * and in the built-in store, and returns how many there were. Soft-wrapped
+ * lines are searched as one, so a hit may span rows. Without
+ * VTERM_SEARCH_BACKWARD, hits start at or after from and come oldest first. */
+int vterm_screen_search(VTermScreen *screen, const char *query, size_t len, VTermSearchFlags flags,
+    VTermPos from, VTermSearchHit hits[], int max_hits);
+
+typedef enum {
+  VTERM_MATCH_URL      = 1 << 0, /* scheme://... for the common schemes */
+  VTERM_MATCH_FILELINE = 1 << 1, /* name.ext:line or name.ext:line:col */
+  VTERM_MATCH_HASH     = 1 << 2, /* 7 to 64 lower case hex digits, as git prints */
+} VTermMatchKind;
+
+typedef struct {
+  VTermMatchKind kind;
+  VTermPos start;
+  VTermPos end;   /* just after the last cell of the match, on that cell's row */
+} VTermMatch;
+
+/* Looks for the given kinds of text on the screen, or stops looking if 0.
+ * Soft-wrapped lines are looked at as one, so a match may span rows. */
+void vterm_screen_enable_matcher(VTermScreen *screen, VTermMatchKind kinds);
+
+/* Stores up to max_matches of the matches touching row, leftmost first, and
+ * returns how many it stored. Rows that have changed since the last call
+ * are scanned again first, along with the rest of their soft-wrapped line;
+ * so a change can alter the matches on rows it didn't damage. */
+int vterm_screen_get_matches(VTermScreen *screen, int row, VTermMatch matches[], int max_matches);
+
+/* An immutable copy of the screen, which other threads may read while the
+ * terminal carries on being written to. */
+typedef struct VTermScreenSnapshot VTermScreenSnapshot;
+
+/* Must not be called while other threads hold or are acquiring snapshots */
+void vterm_screen_enable_snapshots(VTermScreen *screen, int enabled);
+
+/* Called by the thread writing to the terminal, whenever it wants readers
+ * to see what is on the screen now. Only rows that have changed since the
+ * previous snapshot are copied; it does nothing if none have and the cursor
+ * hasn't moved. Snapshots no longer in use are freed here too. */
+void vterm_screen_publish_snapshot(VTermScreen *screen);
+
+/* May be called from any thread, without locking. Returns the most recently
+ * published snapshot, or NULL if there isn't one yet; it stays valid and
+ * unchanged until released */
+const VTermScreenSnapshot *vterm_screen_acquire_snapshot(VTermScreen *screen);
+void vterm_snapshot_release(const VTermScreenSnapshot *snap);
+
+uint64_t vterm_snapshot_get_generation(const VTermScreenSnapshot *snap); /* counts publishes */
+void vterm_snapshot_get_size(const VTermScreenSnapshot *snap, int *rowsp, int *colsp);
+void vterm_snapshot_get_cursorpos(const VTermScreenSnapshot *snap, VTermPos *cursorpos);
+int  vterm_snapshot_get_cursor_visible(const VTermScreenSnapshot *snap);
+int  vterm_snapshot_get_cell(const VTermScreenSnapshot *snap, VTermPos pos, VTermScreenCell *cell);
+const VTermLineInfo *vterm_snapshot_get_lineinfo(const VTermScreenSnapshot *snap, int row);
+
+/* Layout of the shared memory copy of the screen made by
+ * vterm_screen_export_shm(). All offsets are from the start of the region,
+ * which begins with a VTermShmHeader. Everything is in the writer's native
+ * byte order. */
+#define VTERM_SHM_MAGIC   0x6d687376
+#define VTERM_SHM_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;        /* odd while the writer is part-way through an update */
+  uint32_t reserved;
+  uint64_t size;       /* of the region; it only ever grows, so remap if larger */
+  uint64_t generation; /* counts updates */
+  int32_t  rows, cols;
+  int32_t  cursor_row, cursor_col;
+  uint32_t cursor_visible;
+  uint32_t lineinfo_offset;    /* rows bytes of VTERM_SHM_LINE_* flags */
+  uint32_t row_version_offset; /* rows uint64_t: the generation each last changed in */
+  uint32_t cells_offset;       /* rows * cols VTermShmCell, row by row */
+} VTermShmHeader;
+
+#define VTERM_SHM_LINE_CONTINUATION (1 << 0)
+#define VTERM_SHM_LINE_DWL          (1 << 1)
+#define VTERM_SHM_LINE_DHL_SHIFT    2 /* 2 bits */
+
+typedef struct {
+  uint32_t chars[VTERM_MAX_CHARS_PER_CELL];
+  uint8_t  width;
+  uint8_t  reserved;
+  uint16_t attrs; /* VTERM_SHM_ATTR_* */
+  VTermColor fg, bg;
+} VTermShmCell;
+
+#define VTERM_SHM_ATTR_BOLD            (1 << 0)
+#define VTERM_SHM_ATTR_UNDERLINE_SHIFT 1 /* 2 bits, VTERM_UNDERLINE_* */
+#define VTERM_SHM_ATTR_ITALIC          (1 << 3)
+#define VTERM_SHM_ATTR_BLINK           (1 << 4)
+#define VTERM_SHM_ATTR_REVERSE         (1 << 5)
+#define VTERM_SHM_ATTR_STRIKE          (1 << 6)
+#define VTERM_SHM_ATTR_FONT_SHIFT      7 /* 4 bits */
+#define VTERM_SHM_ATTR_DWL             (1 << 11)
+#define VTERM_SHM_ATTR_DHL_SHIFT       12 /* 2 bits */
+
+/* Keeps a copy of the screen in the POSIX shared memory object called name,
+ * which is created and must not exist already. A NULL name stops, removing
+ * the object. Returns 0 if it couldn't be created. */
+int  vterm_screen_export_shm(VTermScreen *screen, const char *name);
+
+/* Called by the thread writing to the terminal, whenever it wants readers to
+ * see what is on the screen now. Only rows that have changed since the last
+ * update are rewritten, and their row version set to the new generation. */
+void vterm_screen_update_shm(VTermScreen *screen);
+
+/* For readers in any process: copy what is needed out of the region between
+ * these, and try again while vterm_shm_read_retry() returns true.
+ *
+ *   do {
+ *     seq = vterm_shm_read_begin(h);
+ *     ...
+ *   } while(vterm_shm_read_retry(h, seq));
+ */
+uint32_t vterm_shm_read_begin(const VTermShmHeader *h);
+int      vterm_shm_read_retry(const VTermShmHeader *h, uint32_t seq);
+
 typedef enum {
   VTERM_DAMAGE_CELL,    /* every cell */
   VTERM_DAMAGE_ROW,     /* entire rows */
@@ -497,32 +771,40 @@ typedef enum {
 void vterm_screen_flush_damage(VTermScreen *screen);
 void vterm_screen_set_damage_merge(VTermScreen *screen, VTermDamageSize size);
 
+/* While synchronized output (DECSET 2026) is active, all damage and moverect
+ * events are merged into one region that is emitted when the mode ends, or
+ * early once more than 'cells' cells have been damaged (0 for no limit; the
+ * default is four screenfuls, following the screen size).
+ * vterm_screen_flush_damage() emits nothing during the update. Embedders
+ * wanting a time limit can call vterm_screen_force_flush_damage() from their
+ * own timer; it emits the region so far without leaving the mode. */
+void vterm_screen_set_sync_budget(VTermScreen *screen, int cells);
+void vterm_screen_force_flush_damage(VTermScreen *screen);
+
 void   vterm_screen_reset(VTermScreen *screen, int hard);
 
 /* Neither of these functions NUL-terminate the buffer */
 size_t vterm_screen_get_chars(const VTermScreen *screen, uint32_t *chars, size_t len, const VTermRect rect);
 size_t vterm_screen_get_text(const VTermScreen *screen, char *str, size_t len, const VTermRect rect);
 
-typedef enum {
-  VTERM_ATTR_BOLD_MASK       = 1 << 0,
-  VTERM_ATTR_UNDERLINE_MASK  = 1 << 1,
-  VTERM_ATTR_ITALIC_MASK     = 1 << 2,
-  VTERM_ATTR_BLINK_MASK      = 1 << 3,
-  VTERM_ATTR_REVERSE_MASK    = 1 << 4,
-  VTERM_ATTR_STRIKE_MASK     = 1 << 5,
-  VTERM_ATTR_FONT_MASK       = 1 << 6,
-  VTERM_ATTR_FOREGROUND_MASK = 1 << 7,
-  VTERM_ATTR_BACKGROUND_MASK = 1 << 8,
-
-  VTERM_ALL_ATTRS_MASK = (1 << 9) - 1
-} VTermAttrMask;
-
 int vterm_screen_get_attrs_extent(const VTermScreen *screen, VTermRect *extent, VTermPos pos, VTermAttrMask attrs);
 
 int vterm_screen_get_cell(const VTermScreen *screen, VTermPos pos, VTermScreenCell *cell);
 
 int vterm_screen_is_eol(const VTermScreen *screen, VTermPos pos);
 
+/* Returns a 64-bit hash of the characters and attributes of the given row,
+ * equal for rows with the same content, for keying render caches.
+ * Colours are hashed as stored, so palette changes don't alter it. It is
+ * computed when first asked for and kept until the row changes. Returns 0
+ * for a row outside the screen. */
+uint64_t vterm_screen_get_row_hash(const VTermScreen *screen, int row);
+
+/* Returns 1 and sets *uri, and *id if given (NULL if the link has no id),
+ * if the cell at pos is part of an OSC 8 hyperlink. The strings remain valid
+ * until more input is written. */
+int vterm_screen_get_hyperlink(const VTermScreen *screen, VTermPos pos, const char **uri, const char **id);
+
 /**
  * Same as vterm_state_convert_color_to_rgb(), but takes a `screen` instead of a `state`
  * instance.
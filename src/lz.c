@@ -0,0 +1,152 @@
+#include "vterm_internal.h"
+
+#include <string.h>
+
+/* A small LZ77 codec for cold scrollback, in the style of LZ4's block format.
+ *
+ * The output is a series of sequences, each
+ *   token        high nibble: literal count, low nibble: match length - 4
+ *   [count...]   bytes of 255 and a final byte < 255, added on to a nibble of 15
+ *   literals
+ *   offset       2 bytes little-endian, 1 to 65535 back from here
+ *   [length...]  as for count
+ * The last sequence stops after its literals.
+ */
+
+#define MINMATCH 4
+#define MAXOFFSET 65535
+
+static inline uint32_t read32(const unsigned char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline unsigned int hash32(uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *put_length(unsigned char *op, size_t len)
+{
+  while(len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+INTERNAL size_t vterm_lz_compress(const unsigned char *src, size_t len, unsigned char *dst, uint32_t table[])
+{
+  const unsigned char *ip = src, *anchor = src, *end = src + len;
+  unsigned char *op = dst;
+
+  memset(table, 0, sizeof(uint32_t) << LZ_HASH_BITS);
+
+  /* table holds 1 + the position of the last 4 bytes with that hash */
+  while(len >= MINMATCH && ip <= end - MINMATCH) {
+    uint32_t v = read32(ip);
+    unsigned int h = hash32(v);
+    size_t cand = table[h];
+    table[h] = ip - src + 1;
+
+    if(!cand || (size_t)(ip - src) - (cand - 1) > MAXOFFSET || read32(src + cand - 1) != v) {
+      ip++;
+      continue;
+    }
+
+    const unsigned char *match = src + cand - 1;
+    size_t matchlen = MINMATCH;
+    while(ip + matchlen < end && ip[matchlen] == match[matchlen])
+      matchlen++;
+
+    size_t litlen = ip - anchor;
+    unsigned char *token = op++;
+    *token = (litlen < 15 ? litlen : 15) << 4 | (matchlen - MINMATCH < 15 ? matchlen - MINMATCH : 15);
+    if(litlen >= 15)
+      op = put_length(op, litlen - 15);
+    memcpy(op, anchor, litlen);
+    op += litlen;
+
+    size_t offset = ip - match;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    if(matchlen - MINMATCH >= 15)
+      op = put_length(op, matchlen - MINMATCH - 15);
+
+    ip += matchlen;
+    anchor = ip;
+  }
+
+  size_t litlen = end - anchor;
+  *op++ = (litlen < 15 ? litlen : 15) << 4;
+  if(litlen >= 15)
+    op = put_length(op, litlen - 15);
+  memcpy(op, anchor, litlen);
+  op += litlen;
+
+  return op - dst;
+}
+
+static int get_length(const unsigned char **ipp, const unsigned char *end, size_t *len)
+{
+  const unsigned char *ip = *ipp;
+  unsigned char b;
+  do {
+    if(ip >= end)
+      return 0;
+    b = *ip++;
+    *len += b;
+  } while(b == 255);
+
+  *ipp = ip;
+  return 1;
+}
+
+/* Returns the decompressed length, or -1 if src is malformed or the output
+ * would exceed dstlen */
+INTERNAL size_t vterm_lz_decompress(const unsigned char *src, size_t len, unsigned char *dst, size_t dstlen)
+{
+  const unsigned char *ip = src, *end = src + len;
+  unsigned char *op = dst, *opend = dst + dstlen;
+
+  while(ip < end) {
+    unsigned char token = *ip++;
+
+    size_t litlen = token >> 4;
+    if(litlen == 15 && !get_length(&ip, end, &litlen))
+      return -1;
+    if(litlen > (size_t)(end - ip) || litlen > (size_t)(opend - op))
+      return -1;
+    memcpy(op, ip, litlen);
+    ip += litlen;
+    op += litlen;
+
+    if(ip == end)
+      break;
+
+    if(end - ip < 2)
+      return -1;
+    size_t offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    if(!offset || offset > (size_t)(op - dst))
+      return -1;
+
+    size_t matchlen = token & 0x0f;
+    if(matchlen == 15 && !get_length(&ip, end, &matchlen))
+      return -1;
+    matchlen += MINMATCH;
+    if(matchlen > (size_t)(opend - op))
+      return -1;
+
+    /* may overlap, so byte by byte */
+    const unsigned char *match = op - offset;
+    for(size_t i = 0; i < matchlen; i++)
+      op[i] = match[i];
+    op += matchlen;
+  }
+
+  return op - dst;
+}
@@ -0,0 +1,540 @@
+#include "vterm_internal.h"
+
+#include <string.h>
+
+/* Finds URLs, file:line references and commit hashes on the screen, keeping
+ * a list of them for each row. A row is only scanned again once it has
+ * changed, along with the rest of its soft-wrapped line, so the work done
+ * follows the damage rather than the size of the screen.
+ *
+ * All the patterns are recognised in one pass over each line: it is cut into
+ * tokens of characters that could belong to any of them, and each token is
+ * classified from a table of character classes. */
+
+#define MIN_HASH_LEN  7
+#define MAX_HASH_LEN 64
+#define MAX_EXT_LEN   8
+
+enum {
+  CH_ALPHA = 1 << 0,
+  CH_DIGIT = 1 << 1,
+  CH_HEX   = 1 << 2, /* hashes are only recognised in lower case */
+  CH_PATH  = 1 << 3, /* may appear in a file name */
+  CH_URL   = 1 << 4, /* may appear in a URL */
+};
+
+typedef struct {
+  VTermMatch *matches;
+  int count, size;
+  bool dirty;
+  bool joined; /* to the row above, when last scanned */
+} MatchRow;
+
+typedef struct {
+  uint32_t ch;
+  int row, col, width;
+} MatchChar;
+
+struct VTermMatcher {
+  VTerm *vt;
+  VTermMatchKind kinds;
+
+  MatchRow *rows;
+  int nrows;
+
+  /* Every dirty row lies in [dirty_start, dirty_end) */
+  int dirty_start, dirty_end;
+
+  /* The line being scanned */
+  MatchChar *text;
+  int text_size;
+};
+
+static const char *const url_schemes[] = {
+  "http", "https", "ftp", "sftp", "file", "ssh", "git", NULL
+};
+
+#define A_ (CH_ALPHA|CH_PATH|CH_URL)
+#define X_ (CH_ALPHA|CH_HEX|CH_PATH|CH_URL)
+#define D_ (CH_DIGIT|CH_HEX|CH_PATH|CH_URL)
+#define P_ (CH_PATH|CH_URL)
+#define U_ CH_URL
+
+static const unsigned char char_classes[128] = {
+  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+  /*  !   "   #   $   %   &   '   (   )   *   +   ,   -   .   / */
+  0,  U_, 0,  U_, U_, U_, U_, U_, U_, U_, U_, P_, U_, P_, P_, P_,
+  /* 0-9                                   :   ;   <   =   >   ? */
+  D_, D_, D_, D_, D_, D_, D_, D_, D_, D_, U_, U_, 0,  U_, 0,  U_,
+  /* @  A-O */
+  U_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_,
+  /* P-Z                                       [   \   ]   ^   _ */
+  A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, U_, 0,  U_, 0,  P_,
+  /* `  a-f                     g-o */
+  0,  X_, X_, X_, X_, X_, X_, A_, A_, A_, A_, A_, A_, A_, A_, A_,
+  /* p-z                                       {   |   }   ~ */
+  A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, A_, 0,  0,  0,  P_, 0,
+};
+
+#undef A_
+#undef X_
+#undef D_
+#undef P_
+#undef U_
+
+static inline int charclass(uint32_t ch)
+{
+  if(ch < 0x80)
+    return char_classes[ch];
+  /* Let URLs carry non-ASCII text, as browsers do, but nothing else */
+  return ch > 0xa0 ? CH_URL : 0;
+}
+
+static inline bool is_word(uint32_t ch)
+{
+  return (charclass(ch) & (CH_ALPHA|CH_DIGIT)) || ch == '_';
+}
+
+static inline bool is_one_of(uint32_t ch, const char *set)
+{
+  return ch && ch < 0x80 && strchr(set, (int)ch);
+}
+
+static void add_match(VTermMatcher *m, VTermMatchKind kind, int start, int end)
+{
+  if(!(m->kinds & kind))
+    return;
+
+  const MatchChar *first = &m->text[start], *last = &m->text[end - 1];
+  VTermMatch match = {
+    .kind  = kind,
+    .start = { .row = first->row, .col = first->col },
+    .end   = { .row = last->row,  .col = last->col + last->width },
+  };
+
+  for(int row = match.start.row; row <= match.end.row; row++) {
+    MatchRow *r = &m->rows[row];
+    if(r->count == r->size) {
+      int size = r->size ? r->size * 2 : 4;
+      VTermMatch *matches = vterm_allocator_malloc(m->vt, sizeof(VTermMatch) * size);
+      if(r->matches) {
+        memcpy(matches, r->matches, sizeof(VTermMatch) * r->count);
+        vterm_allocator_free(m->vt, r->matches);
+      }
+      r->matches = matches;
+      r->size = size;
+    }
+    r->matches[r->count++] = match;
+  }
+}
+
+static bool is_scheme(const MatchChar *t, int len)
+{
+  for(int i = 0; url_schemes[i]; i++) {
+    const char *scheme = url_schemes[i];
+    if((int)strlen(scheme) != len)
+      continue;
+
+    int j;
+    for(j = 0; j < len; j++)
+      if((t[j].ch | 0x20) != (uint32_t)scheme[j])
+        break;
+    if(j == len)
+      return true;
+  }
+
+  return false;
+}
+
+/* Where a URL whose scheme ends just before from finishes, within a token
+ * ending at end. Closing brackets it didn't open, and trailing punctuation,
+ * are more likely the surrounding text's than its own */
+static int url_end(const MatchChar *t, int from, int end)
+{
+  int parens = 0, brackets = 0;
+  int i;
+  for(i = from; i < end; i++) {
+    uint32_t ch = t[i].ch;
+    if((ch == ')' && !parens) || (ch == ']' && !brackets))
+      break;
+    parens   += (ch == '(') - (ch == ')');
+    brackets += (ch == '[') - (ch == ']');
+  }
+
+  while(i > from && is_one_of(t[i-1].ch, ".,:;!?'*"))
+    i--;
+
+  return i;
+}
+
+/* If the file name in [start, end) is followed by :line or :line:col, where
+ * the whole reference finishes; otherwise 0 */
+static int fileline_end(const MatchChar *t, int start, int end, int token_end)
+{
+  if(end + 1 >= token_end || t[end].ch != ':' || !(charclass(t[end+1].ch) & CH_DIGIT))
+    return 0;
+
+  /* The name needs an extension with a letter in it, so that times and
+   * version numbers aren't taken for one */
+  bool letter = false;
+  int dot;
+  for(dot = end - 1; dot >= start && t[dot].ch != '.'; dot--) {
+    int cls = charclass(t[dot].ch);
+    if(!(cls & (CH_ALPHA|CH_DIGIT)))
+      return 0;
+    if(cls & CH_ALPHA)
+      letter = true;
+  }
+  if(dot < start || !letter || end - dot - 1 > MAX_EXT_LEN)
+    return 0;
+
+  int i = end + 1;
+  while(i < token_end && (charclass(t[i].ch) & CH_DIGIT))
+    i++;
+  if(i + 1 < token_end && t[i].ch == ':' && (charclass(t[i+1].ch) & CH_DIGIT)) {
+    i++;
+    while(i < token_end && (charclass(t[i].ch) & CH_DIGIT))
+      i++;
+  }
+
+  if(i < token_end && is_word(t[i].ch))
+    return 0;
+
+  return i;
+}
+
+static void scan_hashes(VTermMatcher *m, int start, int end)
+{
+  const MatchChar *t = m->text;
+
+  int i = start;
+  while(i < end) {
+    if(!is_word(t[i].ch)) {
+      i++;
+      continue;
+    }
+
+    int word = i, digits = 0, letters = 0;
+    bool hex = true;
+    for(; i < end && is_word(t[i].ch); i++) {
+      int cls = charclass(t[i].ch);
+      if(!(cls & CH_HEX))
+        hex = false;
+      else if(cls & CH_DIGIT)
+        digits++;
+      else
+        letters++;
+    }
+
+    /* Needing both keeps plain numbers and words like "deadbeef" out */
+    int len = i - word;
+    if(hex && digits && letters && len >= MIN_HASH_LEN && len <= MAX_HASH_LEN)
+      add_match(m, VTERM_MATCH_HASH, word, i);
+  }
+}
+
+static void scan_token(VTermMatcher *m, int start, int end)
+{
+  const MatchChar *t = m->text;
+
+  bool found_url = false;
+  int from = start;
+  for(int i = start; i + 2 < end; i++) {
+    if(t[i].ch != ':' || t[i+1].ch != '/' || t[i+2].ch != '/')
+      continue;
+
+    int scheme = i;
+    while(scheme > from && (charclass(t[scheme-1].ch) & CH_ALPHA))
+      scheme--;
+    if(!is_scheme(t + scheme, i - scheme))
+      continue;
+
+    int url = url_end(t, i + 3, end);
+    if(url == i + 3)
+      continue;
+
+    add_match(m, VTERM_MATCH_URL, scheme, url);
+    found_url = true;
+    from = url;
+    i = url - 1;
+  }
+
+  /* Anything else in a token with a URL is most likely part of it */
+  if(found_url)
+    return;
+
+  int i = start;
+  while(i < end) {
+    if(!(charclass(t[i].ch) & CH_PATH)) {
+      i++;
+      continue;
+    }
+
+    int name = i;
+    while(i < end && (charclass(t[i].ch) & CH_PATH))
+      i++;
+
+    int ref = fileline_end(t, name, i, end);
+    if(ref) {
+      add_match(m, VTERM_MATCH_FILELINE, name, ref);
+      i = ref;
+    }
+    else
+      scan_hashes(m, name, i);
+  }
+}
+
+/* Reads the soft-wrapped line on rows first to last into m->text */
+static int line_text(VTermMatcher *m, VTermScreen *screen, int first, int last)
+{
+  int rows, cols;
+  vterm_get_size(m->vt, &rows, &cols);
+
+  int n = 0;
+  for(int row = first; row <= last; row++) {
+    if(m->text_size < n + cols) {
+      int size = (n + cols) * 2;
+      MatchChar *text = vterm_allocator_malloc(m->vt, sizeof(MatchChar) * size);
+      if(m->text) {
+        memcpy(text, m->text, sizeof(MatchChar) * n);
+        vterm_allocator_free(m->vt, m->text);
+      }
+      m->text = text;
+      m->text_size = size;
+    }
+
+    int nonblank = n;
+    for(int col = 0; col < cols; col++) {
+      VTermScreenCell cell;
+      vterm_screen_get_cell(screen, (VTermPos){ .row = row, .col = col }, &cell);
+      if(cell.chars[0] == (uint32_t)-1)
+        continue;
+
+      m->text[n++] = (MatchChar){
+        .ch    = cell.chars[0] ? cell.chars[0] : ' ',
+        .row   = row,
+        .col   = col,
+        .width = cell.width > 1 ? cell.width : 1,
+      };
+      if(cell.chars[0])
+        nonblank = n;
+    }
+
+    /* Blanks left by a wide char that wrapped early don't split the line */
+    if(row < last)
+      n = nonblank;
+  }
+
+  return n;
+}
+
+static void scan_line(VTermMatcher *m, int len)
+{
+  int i = 0;
+  while(i < len) {
+    if(!(charclass(m->text[i].ch) & CH_URL)) {
+      i++;
+      continue;
+    }
+
+    int start = i;
+    while(i < len && (charclass(m->text[i].ch) & CH_URL))
+      i++;
+
+    scan_token(m, start, i);
+  }
+}
+
+/* Lines may have been split or cut short without a callback to say so, so
+ * the whole of any line that was scanned with a dirty row in it is dirty */
+static void spread_damage(VTermMatcher *m)
+{
+  int start_row = m->dirty_start, end_row = m->dirty_end;
+  for(int row = start_row; row < end_row; row++) {
+    if(!m->rows[row].dirty)
+      continue;
+
+    int first = row, last = row;
+    while(first > 0 && m->rows[first].joined)
+      first--;
+    while(last + 1 < m->nrows && m->rows[last + 1].joined)
+      last++;
+    vterm_matcher_damage(m, first, last + 1);
+
+    row = last;
+  }
+}
+
+static void update(VTermMatcher *m, VTermScreen *screen)
+{
+  VTermState *state = vterm_obtain_state(m->vt);
+
+  spread_damage(m);
+
+  for(int row = m->dirty_start; row < m->dirty_end; row++) {
+    if(!m->rows[row].dirty)
+      continue;
+
+    int first = row, last = row;
+    while(first > 0 && vterm_state_get_lineinfo(state, first)->continuation)
+      first--;
+    while(last + 1 < m->nrows && vterm_state_get_lineinfo(state, last + 1)->continuation)
+      last++;
+
+    for(int r = first; r <= last; r++) {
+      m->rows[r].count  = 0;
+      m->rows[r].dirty  = false;
+      m->rows[r].joined = r > first;
+    }
+
+    scan_line(m, line_text(m, screen, first, last));
+
+    row = last;
+  }
+
+  m->dirty_start = m->nrows;
+  m->dirty_end   = 0;
+}
+
+INTERNAL VTermMatcher *vterm_matcher_new(VTerm *vt, VTermMatchKind kinds, int rows)
+{
+  VTermMatcher *m = vterm_allocator_malloc(vt, sizeof(VTermMatcher));
+
+  m->vt = vt;
+  m->kinds = kinds;
+  vterm_matcher_resize(m, rows);
+
+  return m;
+}
+
+static void free_rows(VTermMatcher *m)
+{
+  for(int row = 0; row < m->nrows; row++)
+    if(m->rows[row].matches)
+      vterm_allocator_free(m->vt, m->rows[row].matches);
+  if(m->rows)
+    vterm_allocator_free(m->vt, m->rows);
+}
+
+INTERNAL void vterm_matcher_free(VTermMatcher *m)
+{
+  free_rows(m);
+  if(m->text)
+    vterm_allocator_free(m->vt, m->text);
+
+  vterm_allocator_free(m->vt, m);
+}
+
+INTERNAL size_t vterm_matcher_memory_usage(const VTermMatcher *m)
+{
+  size_t bytes = sizeof(VTermMatcher) +
+    sizeof(MatchRow) * m->nrows +
+    sizeof(MatchChar) * m->text_size;
+
+  for(int row = 0; row < m->nrows; row++)
+    bytes += sizeof(VTermMatch) * m->rows[row].size;
+
+  return bytes;
+}
+
+INTERNAL void vterm_matcher_resize(VTermMatcher *m, int rows)
+{
+  free_rows(m);
+
+  m->rows = vterm_allocator_malloc(m->vt, sizeof(MatchRow) * rows);
+  m->nrows = rows;
+
+  m->dirty_start = rows;
+  m->dirty_end   = 0;
+  vterm_matcher_damage(m, 0, rows);
+}
+
+INTERNAL void vterm_matcher_damage(VTermMatcher *m, int start_row, int end_row)
+{
+  if(start_row < 0)
+    start_row = 0;
+  if(end_row > m->nrows)
+    end_row = m->nrows;
+  if(start_row >= end_row)
+    return;
+
+  for(int row = start_row; row < end_row; row++)
+    m->rows[row].dirty = true;
+
+  if(m->dirty_start > start_row)
+    m->dirty_start = start_row;
+  if(m->dirty_end < end_row)
+    m->dirty_end = end_row;
+}
+
+INTERNAL void vterm_matcher_moverect(VTermMatcher *m, VTermRect dest, VTermRect src, bool whole_rows)
+{
+  if(!whole_rows) {
+    vterm_matcher_damage(m, dest.start_row, dest.end_row);
+    return;
+  }
+
+  /* Whole rows take their matches with them */
+  int downward = src.start_row - dest.start_row;
+
+  int init_row, test_row, inc_row;
+  if(downward < 0) {
+    init_row = dest.end_row - 1;
+    test_row = dest.start_row - 1;
+    inc_row  = -1;
+  }
+  else {
+    init_row = dest.start_row;
+    test_row = dest.end_row;
+    inc_row  = +1;
+  }
+
+  for(int row = init_row; row != test_row; row += inc_row) {
+    MatchRow tmp = m->rows[row];
+    m->rows[row] = m->rows[row + downward];
+    m->rows[row + downward] = tmp;
+
+    MatchRow *r = &m->rows[row];
+    for(int i = 0; i < r->count; i++) {
+      r->matches[i].start.row -= downward;
+      r->matches[i].end.row   -= downward;
+    }
+
+    if(r->dirty)
+      vterm_matcher_damage(m, row, row + 1);
+  }
+
+  /* Rows with new neighbours may now be joined to different lines */
+  int start_row = downward > 0 ? dest.start_row : src.start_row;
+  int end_row   = downward > 0 ? src.end_row    : dest.end_row;
+  vterm_matcher_damage(m, start_row - 1, start_row);
+  vterm_matcher_damage(m, dest.start_row, dest.start_row + 1);
+  vterm_matcher_damage(m, dest.end_row - 1, dest.end_row);
+  vterm_matcher_damage(m, end_row, end_row + 1);
+
+  /* The rows left behind are about to be erased */
+  start_row = downward > 0 ? dest.end_row : src.start_row;
+  end_row   = downward > 0 ? src.end_row  : dest.start_row;
+  for(int row = start_row; row < end_row; row++) {
+    m->rows[row].count  = 0;
+    m->rows[row].joined = false;
+  }
+  vterm_matcher_damage(m, start_row, end_row);
+}
+
+INTERNAL int vterm_matcher_get(VTermMatcher *m, VTermScreen *screen, int row, VTermMatch matches[], int max_matches)
+{
+  if(row < 0 || row >= m->nrows)
+    return 0;
+
+  if(m->dirty_start < m->dirty_end)
+    update(m, screen);
+
+  const MatchRow *r = &m->rows[row];
+  int count = r->count < max_matches ? r->count : max_matches;
+  if(count)
+    memcpy(matches, r->matches, sizeof(VTermMatch) * count);
+
+  return count;
+}
@@ -5,11 +5,6 @@
 
 #undef DEBUG_PARSER
 
-static bool is_intermed(unsigned char c)
-{
-  return c >= 0x20 && c <= 0x2f;
-}
-
 static void do_control(VTerm *vt, unsigned char control)
 {
   if(vt->parser.callbacks && vt->parser.callbacks->control)
@@ -61,8 +56,101 @@ static void do_escape(VTerm *vt, char command)
   DEBUG_LOG("libvterm: Unhandled escape ESC 0x%02x\n", command);
 }
 
+static void start_accumulating(VTerm *vt)
+{
+  bool dcs = vt->parser.state == DCS || vt->parser.state == DCS_ESC;
+  int command = dcs ? vt->parser.v.dcs.command[vt->parser.v.dcs.commandlen-1]
+                    : vt->parser.v.osc.command;
+
+  vt->parser.accum.max_len = 0;
+  vt->parser.string_overflowed = false;
+  vt->strbuffer_cur = 0;
+
+  for(int i = 0; i < vt->string_accums_len; i++)
+    if(vt->string_accums[i].dcs == dcs && vt->string_accums[i].command == command) {
+      vt->parser.accum = vt->string_accums[i];
+      break;
+    }
+}
+
+/* Drops a string that overflowed, or ends it empty once it is complete */
+static bool overflowed(VTerm *vt, size_t *len, bool final)
+{
+  if(vt->parser.accum.overflow != VTERM_STRING_EMPTY || !final)
+    return false;
+
+  *len = 0;
+  return true;
+}
+
+/* Gathers one fragment of an accumulated string. Returns true once the string
+ * is complete, with the whole payload in *str and *len */
+static bool accumulate(VTerm *vt, const char **str, size_t *len, bool final)
+{
+  size_t max_len = vt->parser.accum.max_len;
+  bool discard = vt->parser.accum.overflow != VTERM_STRING_TRUNCATE;
+
+  if(vt->parser.string_overflowed && discard)
+    return overflowed(vt, len, final);
+
+  if(final && !vt->strbuffer_cur) {
+    /* Arrived whole; hand it over in place */
+    if(*len > max_len) {
+      if(discard)
+        return overflowed(vt, len, final);
+      *len = max_len;
+    }
+    return true;
+  }
+
+  size_t want = vt->strbuffer_cur + *len;
+  if(want > max_len) {
+    vt->parser.string_overflowed = true;
+    if(discard)
+      return overflowed(vt, len, final);
+    want = max_len;
+  }
+
+  if(want > vt->strbuffer_len) {
+    size_t newlen = vt->strbuffer_len ? vt->strbuffer_len : 256;
+    while(newlen < want)
+      newlen *= 2;
+    if(newlen > max_len)
+      newlen = max_len;
+
+    char *newbuffer = vterm_allocator_malloc(vt, newlen);
+    if(vt->strbuffer) {
+      memcpy(newbuffer, vt->strbuffer, vt->strbuffer_cur);
+      vterm_allocator_free(vt, vt->strbuffer);
+    }
+    vt->strbuffer = newbuffer;
+    vt->strbuffer_len = newlen;
+  }
+
+  memcpy(vt->strbuffer + vt->strbuffer_cur, *str, want - vt->strbuffer_cur);
+  vt->strbuffer_cur = want;
+
+  if(!final)
+    return false;
+
+  *str = vt->strbuffer;
+  *len = vt->strbuffer_cur;
+  return true;
+}
+
 static void string_fragment(VTerm *vt, const char *str, size_t len, bool final)
 {
+  if(vt->parser.string_initial)
+    start_accumulating(vt);
+
+  if(vt->parser.accum.max_len) {
+    if(!accumulate(vt, &str, &len, final)) {
+      vt->parser.string_initial = false;
+      return;
+    }
+    vt->parser.string_initial = true;
+  }
+
   VTermStringFragment frag = {
     .str     = str,
     .len     = len,
@@ -71,263 +159,350 @@ static void string_fragment(VTerm *vt, const char *str, size_t len, bool final)
   };
 
   switch(vt->parser.state) {
+    case OSC_COMMAND:
     case OSC:
+    case OSC_ESC:
       if(vt->parser.callbacks && vt->parser.callbacks->osc)
         (*vt->parser.callbacks->osc)(vt->parser.v.osc.command, frag, vt->parser.cbdata);
       break;
 
     case DCS:
+    case DCS_ESC:
       if(len && vt->parser.callbacks && vt->parser.callbacks->dcs)
         (*vt->parser.callbacks->dcs)(vt->parser.v.dcs.command, vt->parser.v.dcs.commandlen, frag, vt->parser.cbdata);
       break;
 
     case NORMAL:
+    case ESCAPE:
+    case ESCAPE_INTERMED:
     case CSI_LEADER:
     case CSI_ARGS:
     case CSI_INTERMED:
-    case OSC_COMMAND:
     case DCS_COMMAND:
+    case PARSER_STATES:
       break;
   }
 
   vt->parser.string_initial = false;
 }
 
-size_t vterm_input_write(VTerm *vt, const char *bytes, size_t len)
+/* The length of string seen so far, not counting a trailing ESC that may yet
+ * turn out to begin the ST */
+static size_t string_len(VTerm *vt, const char *string_start, const char *end)
 {
-  size_t pos = 0;
-  const char *string_start;
+  size_t len = end - string_start;
+  if(len && vt->parser.state >= OSC_ESC)
+    len--;
+  return len;
+}
 
-  switch(vt->parser.state) {
-  case NORMAL:
-  case CSI_LEADER:
-  case CSI_ARGS:
-  case CSI_INTERMED:
-  case OSC_COMMAND:
-  case DCS_COMMAND:
-    string_start = NULL;
-    break;
-  case OSC:
-  case DCS:
-    string_start = bytes;
-    break;
-  }
+enum {
+  ACTION_IGNORE,
+  ACTION_TEXT,
+  ACTION_CONTROL,
+  ACTION_ESC_C1,
+  ACTION_ESC_START,
+  ACTION_COLLECT,
+  ACTION_ESC_DISPATCH,
+  ACTION_CSI_START,
+  ACTION_CSI_LEADER,
+  ACTION_CSI_DIGIT,
+  ACTION_CSI_SUBPARAM,
+  ACTION_CSI_SEP,
+  ACTION_CSI_DISPATCH,
+  ACTION_OSC_START,
+  ACTION_OSC_DIGIT,
+  ACTION_OSC_SEP,
+  ACTION_OSC_STRING,
+  ACTION_OSC_END_EMPTY,
+  ACTION_DCS_START,
+  ACTION_DCS_COLLECT,
+  ACTION_DCS_COLLECT_END,
+  ACTION_STRING_FLUSH,
+  ACTION_STRING_CONTROL,
+  ACTION_STRING_END,
+};
+
+#define T(action,state) ((ACTION_##action << 4) | (state))
+#define T_ACTION(t)     ((t) >> 4)
+#define T_STATE(t)      ((t) & 0x0f)
+
+#include "parsertable.inc"
+
+/* Parses up to the first point at or after 'stop' between one character or
+ * sequence and the next, or within the body of a string, and returns how far
+ * that was */
+static size_t input_write(VTerm *vt, const char *bytes, size_t len, size_t stop)
+{
+  if(vt->pending_rows)
+    vterm_apply_pending_resize(vt);
 
-#define ENTER_STATE(st)        do { vt->parser.state = st; string_start = NULL; } while(0)
-#define ENTER_NORMAL_STATE()   ENTER_STATE(NORMAL)
+  size_t pos = 0;
+  const char *string_start = vt->parser.state >= OSC ? bytes : NULL;
 
   for( ; pos < len; pos++) {
+    /* A string stopped part-way is handed out as a fragment below */
+    if(pos >= stop && (vt->parser.state == NORMAL || vt->parser.state >= OSC))
+      break;
+
     unsigned char c = bytes[pos];
-    bool c1_allowed = !vt->mode.utf8;
+    uint16_t t = parser_table[vt->mode.utf8][vt->parser.state][c];
 
-    if(c == 0x00 || c == 0x7f) { // NUL, DEL
-      if(vt->parser.state >= OSC) {
-        string_fragment(vt, string_start, bytes + pos - string_start, false);
-        string_start = bytes + pos + 1;
+    switch(T_ACTION(t)) {
+    case ACTION_IGNORE:
+      break;
+
+    case ACTION_TEXT:
+      {
+        /* Text may stop early too, though not within a UTF-8 character */
+        size_t end = len;
+        if(stop < len) {
+          end = stop > pos ? stop : pos + 1;
+          while(vt->mode.utf8 && end < len && (bytes[end] & 0xc0) == 0x80)
+            end++;
+        }
+
+        size_t eaten = 0;
+        if(vt->parser.callbacks && vt->parser.callbacks->text)
+          eaten = (*vt->parser.callbacks->text)(bytes + pos, end - pos, vt->parser.cbdata);
+
+        if(!eaten) {
+          DEBUG_LOG("libvterm: Text callback did not consume any input\n");
+          /* force it to make progress */
+          eaten = 1;
+        }
+
+        pos += (eaten - 1); // we'll ++ it again in a moment
       }
-      continue;
-    }
-    if(c == 0x18 || c == 0x1a) { // CAN, SUB
-      vt->parser.in_esc = false;
-      ENTER_NORMAL_STATE();
-      continue;
-    }
-    else if(c == 0x1b) { // ESC
-      vt->parser.intermedlen = 0;
-      if(vt->parser.state < OSC)
-        vt->parser.state = NORMAL;
-      vt->parser.in_esc = true;
-      continue;
-    }
-    else if(c == 0x07 &&  // BEL, can stand for ST in OSC or DCS state
-            vt->parser.state >= OSC) {
-      // fallthrough
-    }
-    else if(c < 0x20) { // other C0
-      if(vt->parser.state >= OSC)
-        string_fragment(vt, string_start, bytes + pos - string_start, false);
+      break;
+
+    case ACTION_CONTROL:
       do_control(vt, c);
-      if(vt->parser.state >= OSC)
-        string_start = bytes + pos + 1;
-      continue;
-    }
-    // else fallthrough
-
-    size_t string_len = bytes + pos - string_start;
-
-    if(vt->parser.in_esc) {
-      // Hoist an ESC letter into a C1 if we're not in a string mode
-      // Always accept ESC \ == ST even in string mode
-      if(!vt->parser.intermedlen &&
-          c >= 0x40 && c < 0x60 &&
-          ((vt->parser.state < OSC || c == 0x5c))) {
-        c += 0x40;
-        c1_allowed = true;
-        string_len -= 1;
-        vt->parser.in_esc = false;
-      }
-      else {
-        string_start = NULL;
-        vt->parser.state = NORMAL;
-      }
-    }
+      break;
 
-    switch(vt->parser.state) {
-    case CSI_LEADER:
-      /* Extract leader bytes 0x3c to 0x3f */
-      if(c >= 0x3c && c <= 0x3f) {
-        if(vt->parser.v.csi.leaderlen < CSI_LEADER_MAX-1)
-          vt->parser.v.csi.leader[vt->parser.v.csi.leaderlen++] = c;
-        break;
-      }
+    case ACTION_ESC_C1:
+      do_control(vt, c + 0x40);
+      break;
 
-      /* else fallthrough */
-      vt->parser.v.csi.leader[vt->parser.v.csi.leaderlen] = 0;
+    case ACTION_ESC_START:
+      vt->parser.intermedlen = 0;
+      break;
 
+    case ACTION_COLLECT:
+      if(vt->parser.intermedlen < INTERMED_MAX-1)
+        vt->parser.intermed[vt->parser.intermedlen++] = c;
+      break;
+
+    case ACTION_ESC_DISPATCH:
+      do_escape(vt, c);
+      break;
+
+    case ACTION_CSI_START:
+      vt->parser.v.csi.leaderlen = 0;
       vt->parser.v.csi.argi = 0;
       vt->parser.v.csi.args[0] = CSI_ARG_MISSING;
-      vt->parser.state = CSI_ARGS;
+      vt->parser.intermedlen = 0;
+      break;
 
-      /* fallthrough */
-    case CSI_ARGS:
+    case ACTION_CSI_LEADER:
+      /* Extract leader bytes 0x3c to 0x3f */
+      if(vt->parser.v.csi.leaderlen < CSI_LEADER_MAX-1)
+        vt->parser.v.csi.leader[vt->parser.v.csi.leaderlen++] = c;
+      break;
+
+    case ACTION_CSI_DIGIT:
       /* Numerical value of argument */
-      if(c >= '0' && c <= '9') {
-        if(vt->parser.v.csi.args[vt->parser.v.csi.argi] == CSI_ARG_MISSING)
-          vt->parser.v.csi.args[vt->parser.v.csi.argi] = 0;
-        vt->parser.v.csi.args[vt->parser.v.csi.argi] *= 10;
-        vt->parser.v.csi.args[vt->parser.v.csi.argi] += c - '0';
-        break;
-      }
-      if(c == ':') {
-        vt->parser.v.csi.args[vt->parser.v.csi.argi] |= CSI_ARG_FLAG_MORE;
-        c = ';';
-      }
-      if(c == ';') {
+      if(vt->parser.v.csi.args[vt->parser.v.csi.argi] == CSI_ARG_MISSING)
+        vt->parser.v.csi.args[vt->parser.v.csi.argi] = 0;
+      vt->parser.v.csi.args[vt->parser.v.csi.argi] *= 10;
+      vt->parser.v.csi.args[vt->parser.v.csi.argi] += c - '0';
+      break;
+
+    case ACTION_CSI_SUBPARAM:
+      vt->parser.v.csi.args[vt->parser.v.csi.argi] |= CSI_ARG_FLAG_MORE;
+      /* fallthrough */
+    case ACTION_CSI_SEP:
+      /* Arguments beyond CSI_ARGS_MAX overwrite the last one */
+      if(vt->parser.v.csi.argi < CSI_ARGS_MAX-1)
         vt->parser.v.csi.argi++;
-        vt->parser.v.csi.args[vt->parser.v.csi.argi] = CSI_ARG_MISSING;
-        break;
-      }
+      vt->parser.v.csi.args[vt->parser.v.csi.argi] = CSI_ARG_MISSING;
+      break;
 
-      /* else fallthrough */
+    case ACTION_CSI_DISPATCH:
+      vt->parser.v.csi.leader[vt->parser.v.csi.leaderlen] = 0;
       vt->parser.v.csi.argi++;
-      vt->parser.intermedlen = 0;
-      vt->parser.state = CSI_INTERMED;
-    case CSI_INTERMED:
-      if(is_intermed(c)) {
-        if(vt->parser.intermedlen < INTERMED_MAX-1)
-          vt->parser.intermed[vt->parser.intermedlen++] = c;
-        break;
-      }
-      else if(c == 0x1b) {
-        /* ESC in CSI cancels */
-      }
-      else if(c >= 0x40 && c <= 0x7e) {
-        vt->parser.intermed[vt->parser.intermedlen] = 0;
-        do_csi(vt, c);
-      }
-      /* else was invalid CSI */
+      vt->parser.intermed[vt->parser.intermedlen] = 0;
+      do_csi(vt, c);
+      break;
 
-      ENTER_NORMAL_STATE();
+    case ACTION_OSC_START:
+      vt->parser.v.osc.command = -1;
+      vt->parser.string_initial = true;
       break;
 
-    case OSC_COMMAND:
+    case ACTION_OSC_DIGIT:
       /* Numerical value of command */
-      if(c >= '0' && c <= '9') {
-        if(vt->parser.v.osc.command == -1)
-          vt->parser.v.osc.command = 0;
-        else
-          vt->parser.v.osc.command *= 10;
-        vt->parser.v.osc.command += c - '0';
-        break;
-      }
-      if(c == ';') {
-        vt->parser.state = OSC;
-        string_start = bytes + pos + 1;
-        break;
-      }
+      if(vt->parser.v.osc.command == -1)
+        vt->parser.v.osc.command = 0;
+      else
+        vt->parser.v.osc.command *= 10;
+      vt->parser.v.osc.command += c - '0';
+      break;
+
+    case ACTION_OSC_SEP:
+      string_start = bytes + pos + 1;
+      break;
 
-      /* else fallthrough */
+    case ACTION_OSC_STRING:
       string_start = bytes + pos;
-      vt->parser.state = OSC;
-      goto string_state;
+      break;
 
-    case DCS_COMMAND:
+    case ACTION_OSC_END_EMPTY:
+      string_fragment(vt, bytes + pos, 0, true);
+      break;
+
+    case ACTION_DCS_START:
+      vt->parser.string_initial = true;
+      vt->parser.v.dcs.commandlen = 0;
+      break;
+
+    case ACTION_DCS_COLLECT_END:
+      string_start = bytes + pos + 1;
+      /* fallthrough */
+    case ACTION_DCS_COLLECT:
       if(vt->parser.v.dcs.commandlen < CSI_LEADER_MAX)
         vt->parser.v.dcs.command[vt->parser.v.dcs.commandlen++] = c;
+      break;
 
-      if(c >= 0x40 && c<= 0x7e) {
-        string_start = bytes + pos + 1;
-        vt->parser.state = DCS;
-      }
+    case ACTION_STRING_FLUSH:
+      string_fragment(vt, string_start, string_len(vt, string_start, bytes + pos), false);
+      string_start = bytes + pos + 1;
       break;
 
-string_state:
-    case OSC:
-    case DCS:
-      if(c == 0x07 || (c1_allowed && c == 0x9c)) {
-        string_fragment(vt, string_start, string_len, true);
-        ENTER_NORMAL_STATE();
-      }
+    case ACTION_STRING_CONTROL:
+      string_fragment(vt, string_start, string_len(vt, string_start, bytes + pos), false);
+      do_control(vt, c);
+      string_start = bytes + pos + 1;
       break;
 
-    case NORMAL:
-      if(vt->parser.in_esc) {
-        if(is_intermed(c)) {
-          if(vt->parser.intermedlen < INTERMED_MAX-1)
-            vt->parser.intermed[vt->parser.intermedlen++] = c;
-        }
-        else if(c >= 0x30 && c < 0x7f) {
-          do_escape(vt, c);
-          vt->parser.in_esc = 0;
-          ENTER_NORMAL_STATE();
-        }
-        else {
-          DEBUG_LOG("TODO: Unhandled byte %02x in Escape\n", c);
-        }
-        break;
-      }
-      if(c1_allowed && c >= 0x80 && c < 0xa0) {
-        switch(c) {
-        case 0x90: // DCS
-          vt->parser.string_initial = true;
-          vt->parser.v.dcs.commandlen = 0;
-          ENTER_STATE(DCS_COMMAND);
-          break;
-        case 0x9b: // CSI
-          vt->parser.v.csi.leaderlen = 0;
-          ENTER_STATE(CSI_LEADER);
-          break;
-        case 0x9d: // OSC
-          vt->parser.v.osc.command = -1;
-          vt->parser.string_initial = true;
-          ENTER_STATE(OSC_COMMAND);
-          break;
-        default:
-          do_control(vt, c);
-          break;
-        }
-      }
-      else {
-        size_t eaten = 0;
-        if(vt->parser.callbacks && vt->parser.callbacks->text)
-          eaten = (*vt->parser.callbacks->text)(bytes + pos, len - pos, vt->parser.cbdata);
+    case ACTION_STRING_END:
+      string_fragment(vt, string_start, string_len(vt, string_start, bytes + pos), true);
+      break;
+    }
 
-        if(!eaten) {
-          DEBUG_LOG("libvterm: Text callback did not consume any input\n");
-          /* force it to make progress */
-          eaten = 1;
-        }
+    vt->parser.state = T_STATE(t);
+  }
 
-        pos += (eaten - 1); // we'll ++ it again in a moment
+  if(vt->parser.state >= OSC)
+    string_fragment(vt, string_start, string_len(vt, string_start, bytes + pos), false);
+
+  return pos;
+}
+
+size_t vterm_input_write(VTerm *vt, const char *bytes, size_t len)
+{
+  return input_write(vt, bytes, len, len);
+}
+
+size_t vterm_input_write_budget(VTerm *vt, const char *bytes, size_t len, size_t max_bytes)
+{
+  return input_write(vt, bytes, len, max_bytes);
+}
+
+size_t vterm_input_writev(VTerm *vt, const VTermInputSegment segs[], int nsegs)
+{
+  size_t total = 0;
+
+  /* The run of input not yet parsed; either the caller's own memory, or
+   * gathered into inputv_buffer */
+  const char *run = NULL;
+  size_t runlen = 0;
+
+  for(int i = 0; i < nsegs; i++) {
+    const char *bytes = segs[i].bytes;
+    size_t len = segs[i].len;
+
+    if(!len)
+      continue;
+
+    total += len;
+
+    if(run && run != vt->inputv_buffer && run + runlen == bytes) {
+      runlen += len;
+      continue;
+    }
+
+    if(run && runlen + len <= INPUTV_BUFFER_SIZE) {
+      if(!vt->inputv_buffer)
+        vt->inputv_buffer = vterm_allocator_malloc(vt, INPUTV_BUFFER_SIZE);
+
+      if(run != vt->inputv_buffer) {
+        memmove(vt->inputv_buffer, run, runlen);
+        run = vt->inputv_buffer;
       }
+
+      memcpy(vt->inputv_buffer + runlen, bytes, len);
+      runlen += len;
+      continue;
+    }
+
+    /* Genuinely discontiguous; parse what we have and start again */
+    if(run)
+      vterm_input_write(vt, run, runlen);
+
+    run = bytes;
+    runlen = len;
+  }
+
+  if(run)
+    vterm_input_write(vt, run, runlen);
+
+  return total;
+}
+
+static void set_accumulator(VTerm *vt, bool dcs, int command, size_t max_len, VTermStringOverflow overflow)
+{
+  /* VTermStringFragment.len is a 30-bit field */
+  if(max_len > (1 << 30) - 1)
+    max_len = (1 << 30) - 1;
+
+  int i;
+  for(i = 0; i < vt->string_accums_len; i++)
+    if(vt->string_accums[i].dcs == dcs && vt->string_accums[i].command == command)
       break;
+
+  if(!max_len) {
+    if(i < vt->string_accums_len)
+      vt->string_accums[i] = vt->string_accums[--vt->string_accums_len];
+    return;
+  }
+
+  if(i == vt->string_accums_len) {
+    VTermStringAccumulator *newaccums = vterm_allocator_malloc(vt, (i + 1) * sizeof(VTermStringAccumulator));
+    if(vt->string_accums) {
+      memcpy(newaccums, vt->string_accums, i * sizeof(VTermStringAccumulator));
+      vterm_allocator_free(vt, vt->string_accums);
     }
+    vt->string_accums = newaccums;
+    vt->string_accums_len++;
   }
 
-  if(string_start)
-    string_fragment(vt, string_start, bytes + pos - string_start, false);
+  vt->string_accums[i] = (VTermStringAccumulator){
+    .dcs      = dcs,
+    .command  = command,
+    .max_len  = max_len,
+    .overflow = overflow,
+  };
+}
 
-  return len;
+void vterm_parser_accumulate_osc(VTerm *vt, int command, size_t max_len, VTermStringOverflow overflow)
+{
+  set_accumulator(vt, false, command, max_len, overflow);
+}
+
+void vterm_parser_accumulate_dcs(VTerm *vt, char final, size_t max_len, VTermStringOverflow overflow)
+{
+  set_accumulator(vt, true, final, max_len, overflow);
 }
 
 void vterm_parser_set_callbacks(VTerm *vt, const VTermParserCallbacks *callbacks, void *user)
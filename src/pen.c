@@ -147,13 +147,56 @@ static void setpenattr_col(VTermState *state, VTermAttr attr, VTermColor color)
   setpenattr(state, attr, VTERM_VALUETYPE_COLOR, &val);
 }
 
+/* Announce the attributes named in 'changed', as one setpen event if the
+ * callbacks want it, else one setpenattr event per attribute */
+static void setpen(VTermState *state, VTermAttrMask changed)
+{
+  if(!changed)
+    return;
+
+  if(state->callbacks && state->callbacks->setpen)
+    if((*state->callbacks->setpen)(&state->pen, changed, state->cbdata))
+      return;
+
+  if(changed & VTERM_ATTR_BOLD_MASK)
+    setpenattr_bool(state, VTERM_ATTR_BOLD,       state->pen.bold);
+  if(changed & VTERM_ATTR_UNDERLINE_MASK)
+    setpenattr_int( state, VTERM_ATTR_UNDERLINE,  state->pen.underline);
+  if(changed & VTERM_ATTR_ITALIC_MASK)
+    setpenattr_bool(state, VTERM_ATTR_ITALIC,     state->pen.italic);
+  if(changed & VTERM_ATTR_BLINK_MASK)
+    setpenattr_bool(state, VTERM_ATTR_BLINK,      state->pen.blink);
+  if(changed & VTERM_ATTR_REVERSE_MASK)
+    setpenattr_bool(state, VTERM_ATTR_REVERSE,    state->pen.reverse);
+  if(changed & VTERM_ATTR_STRIKE_MASK)
+    setpenattr_bool(state, VTERM_ATTR_STRIKE,     state->pen.strike);
+  if(changed & VTERM_ATTR_FONT_MASK)
+    setpenattr_int( state, VTERM_ATTR_FONT,       state->pen.font);
+  if(changed & VTERM_ATTR_FOREGROUND_MASK)
+    setpenattr_col( state, VTERM_ATTR_FOREGROUND, state->pen.fg);
+  if(changed & VTERM_ATTR_BACKGROUND_MASK)
+    setpenattr_col( state, VTERM_ATTR_BACKGROUND, state->pen.bg);
+}
+
 static void set_pen_col_ansi(VTermState *state, VTermAttr attr, long col)
 {
   VTermColor *colp = (attr == VTERM_ATTR_BACKGROUND) ? &state->pen.bg : &state->pen.fg;
 
   vterm_color_indexed(colp, col);
+}
 
-  setpenattr_col(state, attr, *colp);
+static void clearpen(VTermState *state)
+{
+  state->pen.bold = 0;
+  state->pen.underline = 0;
+  state->pen.italic = 0;
+  state->pen.blink = 0;
+  state->pen.reverse = 0;
+  state->pen.strike = 0;
+  state->pen.font = 0;
+
+  state->pen.fg = state->default_fg;
+  state->pen.bg = state->default_bg;
 }
 
 INTERNAL void vterm_state_newpen(VTermState *state)
@@ -167,18 +210,13 @@ INTERNAL void vterm_state_newpen(VTermState *state)
     lookup_default_colour_ansi(col, &state->colors[col]);
 }
 
+/* The attributes kept in VTermPen */
+#define PEN_ATTRS_MASK (VTERM_ALL_ATTRS_MASK & ~VTERM_ATTR_HYPERLINK_MASK)
+
 INTERNAL void vterm_state_resetpen(VTermState *state)
 {
-  state->pen.bold = 0;      setpenattr_bool(state, VTERM_ATTR_BOLD, 0);
-  state->pen.underline = 0; setpenattr_int( state, VTERM_ATTR_UNDERLINE, 0);
-  state->pen.italic = 0;    setpenattr_bool(state, VTERM_ATTR_ITALIC, 0);
-  state->pen.blink = 0;     setpenattr_bool(state, VTERM_ATTR_BLINK, 0);
-  state->pen.reverse = 0;   setpenattr_bool(state, VTERM_ATTR_REVERSE, 0);
-  state->pen.strike = 0;    setpenattr_bool(state, VTERM_ATTR_STRIKE, 0);
-  state->pen.font = 0;      setpenattr_int( state, VTERM_ATTR_FONT, 0);
-
-  state->pen.fg = state->default_fg;  setpenattr_col(state, VTERM_ATTR_FOREGROUND, state->default_fg);
-  state->pen.bg = state->default_bg;  setpenattr_col(state, VTERM_ATTR_BACKGROUND, state->default_bg);
+  clearpen(state);
+  setpen(state, PEN_ATTRS_MASK);
 }
 
 INTERNAL void vterm_state_savepen(VTermState *state, int save)
@@ -189,18 +227,18 @@ INTERNAL void vterm_state_savepen(VTermState *state, int save)
   else {
     state->pen = state->saved.pen;
 
-    setpenattr_bool(state, VTERM_ATTR_BOLD,       state->pen.bold);
-    setpenattr_int( state, VTERM_ATTR_UNDERLINE,  state->pen.underline);
-    setpenattr_bool(state, VTERM_ATTR_ITALIC,     state->pen.italic);
-    setpenattr_bool(state, VTERM_ATTR_BLINK,      state->pen.blink);
-    setpenattr_bool(state, VTERM_ATTR_REVERSE,    state->pen.reverse);
-    setpenattr_bool(state, VTERM_ATTR_STRIKE,     state->pen.strike);
-    setpenattr_int( state, VTERM_ATTR_FONT,       state->pen.font);
-    setpenattr_col( state, VTERM_ATTR_FOREGROUND, state->pen.fg);
-    setpenattr_col( state, VTERM_ATTR_BACKGROUND, state->pen.bg);
+    setpen(state, PEN_ATTRS_MASK);
   }
 }
 
+INTERNAL void vterm_state_sethyperlink(VTermState *state, VTermStringFragment payload)
+{
+  VTermValue val = { .string = payload };
+  setpenattr(state, VTERM_ATTR_HYPERLINK, VTERM_VALUETYPE_STRING, &val);
+
+  state->hyperlink = payload.len > 0;
+}
+
 int vterm_color_is_equal(const VTermColor *a, const VTermColor *b)
 {
   /* First make sure that the two colours are of the same type (RGB/Indexed) */
@@ -270,6 +308,7 @@ INTERNAL void vterm_state_setpen(VTermState *state, const long args[], int argco
 
   int argi = 0;
   int value;
+  VTermAttrMask changed = 0;
 
   while(argi < argcount) {
     // This logic is easier to do 'done' backwards; set it true, and make it
@@ -280,21 +319,24 @@ INTERNAL void vterm_state_setpen(VTermState *state, const long args[], int argco
     switch(arg = CSI_ARG(args[argi])) {
     case CSI_ARG_MISSING:
     case 0: // Reset
-      vterm_state_resetpen(state);
+      clearpen(state);
+      changed |= PEN_ATTRS_MASK;
       break;
 
     case 1: { // Bold on
       const VTermColor *fg = &state->pen.fg;
       state->pen.bold = 1;
-      setpenattr_bool(state, VTERM_ATTR_BOLD, 1);
-      if(!VTERM_COLOR_IS_DEFAULT_FG(fg) && VTERM_COLOR_IS_INDEXED(fg) && fg->indexed.idx < 8 && state->bold_is_highbright)
+      changed |= VTERM_ATTR_BOLD_MASK;
+      if(!VTERM_COLOR_IS_DEFAULT_FG(fg) && VTERM_COLOR_IS_INDEXED(fg) && fg->indexed.idx < 8 && state->bold_is_highbright) {
         set_pen_col_ansi(state, VTERM_ATTR_FOREGROUND, fg->indexed.idx + (state->pen.bold ? 8 : 0));
+        changed |= VTERM_ATTR_FOREGROUND_MASK;
+      }
       break;
     }
 
     case 3: // Italic on
       state->pen.italic = 1;
-      setpenattr_bool(state, VTERM_ATTR_ITALIC, 1);
+      changed |= VTERM_ATTR_ITALIC_MASK;
       break;
 
     case 4: // Underline
@@ -316,63 +358,63 @@ INTERNAL void vterm_state_setpen(VTermState *state, const long args[], int argco
             break;
         }
       }
-      setpenattr_int(state, VTERM_ATTR_UNDERLINE, state->pen.underline);
+      changed |= VTERM_ATTR_UNDERLINE_MASK;
       break;
 
     case 5: // Blink
       state->pen.blink = 1;
-      setpenattr_bool(state, VTERM_ATTR_BLINK, 1);
+      changed |= VTERM_ATTR_BLINK_MASK;
       break;
 
     case 7: // Reverse on
       state->pen.reverse = 1;
-      setpenattr_bool(state, VTERM_ATTR_REVERSE, 1);
+      changed |= VTERM_ATTR_REVERSE_MASK;
       break;
 
     case 9: // Strikethrough on
       state->pen.strike = 1;
-      setpenattr_bool(state, VTERM_ATTR_STRIKE, 1);
+      changed |= VTERM_ATTR_STRIKE_MASK;
       break;
 
     case 10: case 11: case 12: case 13: case 14:
     case 15: case 16: case 17: case 18: case 19: // Select font
       state->pen.font = CSI_ARG(args[argi]) - 10;
-      setpenattr_int(state, VTERM_ATTR_FONT, state->pen.font);
+      changed |= VTERM_ATTR_FONT_MASK;
       break;
 
     case 21: // Underline double
       state->pen.underline = VTERM_UNDERLINE_DOUBLE;
-      setpenattr_int(state, VTERM_ATTR_UNDERLINE, state->pen.underline);
+      changed |= VTERM_ATTR_UNDERLINE_MASK;
       break;
 
     case 22: // Bold off
       state->pen.bold = 0;
-      setpenattr_bool(state, VTERM_ATTR_BOLD, 0);
+      changed |= VTERM_ATTR_BOLD_MASK;
       break;
 
     case 23: // Italic and Gothic (currently unsupported) off
       state->pen.italic = 0;
-      setpenattr_bool(state, VTERM_ATTR_ITALIC, 0);
+      changed |= VTERM_ATTR_ITALIC_MASK;
       break;
 
     case 24: // Underline off
       state->pen.underline = 0;
-      setpenattr_int(state, VTERM_ATTR_UNDERLINE, 0);
+      changed |= VTERM_ATTR_UNDERLINE_MASK;
       break;
 
     case 25: // Blink off
       state->pen.blink = 0;
-      setpenattr_bool(state, VTERM_ATTR_BLINK, 0);
+      changed |= VTERM_ATTR_BLINK_MASK;
       break;
 
     case 27: // Reverse off
       state->pen.reverse = 0;
-      setpenattr_bool(state, VTERM_ATTR_REVERSE, 0);
+      changed |= VTERM_ATTR_REVERSE_MASK;
       break;
 
     case 29: // Strikethrough off
       state->pen.strike = 0;
-      setpenattr_bool(state, VTERM_ATTR_STRIKE, 0);
+      changed |= VTERM_ATTR_STRIKE_MASK;
       break;
 
     case 30: case 31: case 32: case 33:
@@ -381,48 +423,52 @@ INTERNAL void vterm_state_setpen(VTermState *state, const long args[], int argco
       if(state->pen.bold && state->bold_is_highbright)
         value += 8;
       set_pen_col_ansi(state, VTERM_ATTR_FOREGROUND, value);
+      changed |= VTERM_ATTR_FOREGROUND_MASK;
       break;
 
     case 38: // Foreground colour alternative palette
       if(argcount - argi < 1)
-        return;
+        goto done;
       argi += 1 + lookup_colour(state, CSI_ARG(args[argi+1]), args+argi+2, argcount-argi-2, &state->pen.fg);
-      setpenattr_col(state, VTERM_ATTR_FOREGROUND, state->pen.fg);
+      changed |= VTERM_ATTR_FOREGROUND_MASK;
       break;
 
     case 39: // Foreground colour default
       state->pen.fg = state->default_fg;
-      setpenattr_col(state, VTERM_ATTR_FOREGROUND, state->pen.fg);
+      changed |= VTERM_ATTR_FOREGROUND_MASK;
       break;
 
     case 40: case 41: case 42: case 43:
     case 44: case 45: case 46: case 47: // Background colour palette
       value = CSI_ARG(args[argi]) - 40;
       set_pen_col_ansi(state, VTERM_ATTR_BACKGROUND, value);
+      changed |= VTERM_ATTR_BACKGROUND_MASK;
       break;
 
     case 48: // Background colour alternative palette
       if(argcount - argi < 1)
-        return;
+        goto done;
       argi += 1 + lookup_colour(state, CSI_ARG(args[argi+1]), args+argi+2, argcount-argi-2, &state->pen.bg);
-      setpenattr_col(state, VTERM_ATTR_BACKGROUND, state->pen.bg);
+      changed |= VTERM_ATTR_BACKGROUND_MASK;
       break;
 
     case 49: // Default background
       state->pen.bg = state->default_bg;
-      setpenattr_col(state, VTERM_ATTR_BACKGROUND, state->pen.bg);
+      changed |= VTERM_ATTR_BACKGROUND_MASK;
       break;
 
     case 90: case 91: case 92: case 93:
     case 94: case 95: case 96: case 97: // Foreground colour high-intensity palette
       value = CSI_ARG(args[argi]) - 90 + 8;
       set_pen_col_ansi(state, VTERM_ATTR_FOREGROUND, value);
+      changed |= VTERM_ATTR_FOREGROUND_MASK;
       break;
 
     case 100: case 101: case 102: case 103:
     case 104: case 105: case 106: case 107: // Background colour high-intensity palette
       value = CSI_ARG(args[argi]) - 100 + 8;
       set_pen_col_ansi(state, VTERM_ATTR_BACKGROUND, value);
+      changed |= VTERM_ATTR_BACKGROUND_MASK;
       break;
 
     default:
@@ -435,6 +481,9 @@ INTERNAL void vterm_state_setpen(VTermState *state, const long args[], int argco
 
     while(CSI_ARG_HAS_MORE(args[argi++]));
   }
+
+done:
+  setpen(state, changed);
 }
 
 static int vterm_state_getpen_color(const VTermColor *col, int argi, long args[], int fg)
@@ -546,6 +595,7 @@ int vterm_state_get_penattr(const VTermState *state, VTermAttr attr, VTermValue
     val->color = state->pen.bg;
     return 1;
 
+  case VTERM_ATTR_HYPERLINK: // not kept by the state
   case VTERM_N_ATTRS:
     return 0;
   }
@@ -27,8 +27,19 @@ typedef struct
   unsigned int protected_cell : 1;
   unsigned int dwl            : 1; /* on a DECDWL or DECDHL line */
   unsigned int dhl            : 2; /* on a DECDHL line (1=top 2=bottom) */
+  unsigned int hyperlink      : 16; /* index into VTermScreen.links; 0 => none */
 } ScreenPen;
 
+/* An interned OSC 8 hyperlink. uri and id share one allocation */
+typedef struct
+{
+  char *uri;
+  char *id; /* NULL if the link has no id */
+  uint32_t hash;
+} ScreenHyperlink;
+
+#define HYPERLINKS_MAX 65535
+
 /* Internal representation of a screen cell */
 typedef struct
 {
@@ -36,6 +47,22 @@ typedef struct
   ScreenPen pen;
 } ScreenCell;
 
+/* Bookkeeping kept for each row of a buffer */
+typedef struct
+{
+  int eol; /* one past the rightmost non-erased column */
+  bool continuation; /* mirrors VTermLineInfo, for the scrollback store */
+
+  /* A row erased whole is only marked as such; its cells are all blank, but
+   * not written out until writecell() next needs them */
+  bool cleared;
+  ScreenCell blank;
+
+  /* Content hash, computed on demand and kept until the row next changes */
+  bool hashed;
+  uint64_t hash;
+} ScreenRow;
+
 struct VTermScreen
 {
   VTerm *vt;
@@ -50,54 +77,416 @@ struct VTermScreen
   VTermRect pending_scrollrect;
   int pending_scroll_downward, pending_scroll_rightward;
 
+  /* Synchronized output; damage accumulates while set */
+  int sync_output;
+  int sync_budget; /* in cells; 0 => unlimited */
+  bool sync_budget_set; /* by the embedder, rather than from the size */
+  int sync_cells;
+
   int rows;
   int cols;
   int global_reverse;
 
-  /* Primary and Altscreen. buffers[1] is lazily allocated as needed */
+  /* Primary and Altscreen. buffers[1] is allocated when the altscreen is
+   * entered, if enabled, and kept until released */
   ScreenCell *buffers[2];
+  bool altscreen_enabled;
+
+  /* Both buffers have room for rows_capacity rows of cols_capacity cells,
+   * so resizing within that only moves cells around */
+  int rows_capacity;
+  int cols_capacity;
 
   /* buffer will == buffers[0] or buffers[1], depending on altscreen */
   ScreenCell *buffer;
 
+  /* Per-row data for each buffer, switched along with it */
+  ScreenRow *rowinfos[2];
+  ScreenRow *rowinfo;
+
   /* buffer for a single screen row used in scrollback storage callbacks */
   VTermScreenCell *sb_buffer;
 
+  /* Built-in scrollback store; NULL if the callbacks are used instead */
+  VTermScrollback *sb;
+  VTermSearchIndex *search; /* of sb, if enabled */
+
+  VTermMatcher *matcher; /* of the visible buffer, if enabled */
+  VTermSnapshots *snapshots;
+  VTermShmExport *shm;
+
   ScreenPen pen;
+
+  /* Interned hyperlinks, indexed by ScreenPen.hyperlink. links[0] is unused.
+   * Entries no cell refers to are reclaimed when the table fills up */
+  ScreenHyperlink *links;
+  int links_len; /* one past the highest index in use */
+  int links_size;
+  int links_free; /* no entry below this one is free */
+  /* Open-addressed by hash, twice the size of links; 0 => empty */
+  uint16_t *links_index;
+
+  /* While hibernating, the buffers are freed and packed in here instead */
+  unsigned char *packed;
+  size_t packed_len;
+  bool packed_altactive; /* the altscreen was in use, so is packed after the primary */
 };
 
 static inline void clearcell(const VTermScreen *screen, ScreenCell *cell)
 {
   cell->chars[0] = 0;
   cell->pen = screen->pen;
+  cell->pen.hyperlink = 0;
+}
+
+/* Sets n cells to tmpl, copying in doubling runs rather than one at a time */
+static void fill_cells(ScreenCell *cells, const ScreenCell *tmpl, int n)
+{
+  if(n <= 0)
+    return;
+
+  cells[0] = *tmpl;
+  for(int done = 1; done < n; ) {
+    int len = done < n - done ? done : n - done;
+    memcpy(cells + done, cells, sizeof(ScreenCell) * len);
+    done += len;
+  }
+}
+
+static void materialize_row(const VTermScreen *screen, ScreenCell *buffer, ScreenRow *rowinfo, int row)
+{
+  fill_cells(&buffer[row * screen->cols_capacity], &rowinfo[row].blank, screen->cols);
+  rowinfo[row].cleared = false;
 }
 
-static inline ScreenCell *getcell(const VTermScreen *screen, int row, int col)
+/* For reading only; a cleared row is left as it is, and read from its blank */
+static inline const ScreenCell *getcell(const VTermScreen *screen, int row, int col)
 {
   if(row < 0 || row >= screen->rows)
     return NULL;
   if(col < 0 || col >= screen->cols)
     return NULL;
-  return screen->buffer + (screen->cols * row) + col;
+  if(screen->rowinfo[row].cleared)
+    return &screen->rowinfo[row].blank;
+  return screen->buffer + (screen->cols_capacity * row) + col;
 }
 
-static ScreenCell *alloc_buffer(VTermScreen *screen, int rows, int cols)
+static inline ScreenCell *writecell(VTermScreen *screen, int row, int col)
 {
-  ScreenCell *new_buffer = vterm_allocator_malloc(screen->vt, sizeof(ScreenCell) * rows * cols);
+  if(row < 0 || row >= screen->rows)
+    return NULL;
+  if(col < 0 || col >= screen->cols)
+    return NULL;
+  if(screen->rowinfo[row].cleared)
+    materialize_row(screen, screen->buffer, screen->rowinfo, row);
+  return screen->buffer + (screen->cols_capacity * row) + col;
+}
+
+/* Lower rowinfo->eol past any erased cells it currently covers */
+static void trim_eol(ScreenRow *rowinfo, const ScreenCell *line)
+{
+  while(rowinfo->eol > 0 && line[rowinfo->eol - 1].chars[0] == 0)
+    rowinfo->eol--;
+}
+
+static ScreenCell *alloc_buffer(VTermScreen *screen)
+{
+  int ncells = screen->rows_capacity * screen->cols_capacity;
+  ScreenCell *new_buffer = vterm_allocator_malloc(screen->vt, sizeof(ScreenCell) * ncells);
+
+  for(int i = 0; i < ncells; i++)
+    clearcell(screen, &new_buffer[i]);
+
+  return new_buffer;
+}
+
+/* The i'th visible cell of a buffer, counting along each row in turn */
+static inline const ScreenCell *nthcell(const VTermScreen *screen, const ScreenCell *buffer, const ScreenRow *rowinfo, int i)
+{
+  int row = i / screen->cols;
+  if(rowinfo[row].cleared)
+    return &rowinfo[row].blank;
+  return &buffer[row * screen->cols_capacity + i % screen->cols];
+}
+
+/* A hibernating screen's buffers are packed as a bitmap of their rows'
+ * continuation flags followed by the cells in order. Each cell is a varint
+ * of chars[0] << 3 | PACK_* flags, then
+ *   PACK_MORE    its other chars, each a varint of char << 1 | another follows
+ *   PACK_PEN     its pen, if different from the previous cell's
+ *   PACK_REPEAT  a varint count of following cells identical to it
+ * An inactive altscreen is released rather than packed, as entering it again
+ * erases it anyway. */
+#define PACK_MORE   (1 << 0)
+#define PACK_PEN    (1 << 1)
+#define PACK_REPEAT (1 << 2)
+
+/* Returns the length of the varint, only storing it if p is non-NULL */
+static size_t pack_varint(unsigned char *p, uint64_t v)
+{
+  size_t n = 0;
+  while(v >= 0x80) {
+    if(p)
+      p[n] = (v & 0x7f) | 0x80;
+    n++;
+    v >>= 7;
+  }
+  if(p)
+    p[n] = v;
+  return n + 1;
+}
+
+static uint64_t unpack_varint(const unsigned char **pp)
+{
+  const unsigned char *p = *pp;
+  uint64_t v = 0;
+  int shift = 0;
+  do {
+    v |= (uint64_t)(*p & 0x7f) << shift;
+    shift += 7;
+  } while(*p++ & 0x80);
+
+  *pp = p;
+  return v;
+}
 
-  for(int row = 0; row < rows; row++) {
-    for(int col = 0; col < cols; col++) {
-      clearcell(screen, &new_buffer[row * cols + col]);
+static int cell_nchars(const ScreenCell *cell)
+{
+  int n = 1;
+  while(n < VTERM_MAX_CHARS_PER_CELL && cell->chars[0] && cell->chars[n])
+    n++;
+  return n;
+}
+
+static bool cells_equal(const ScreenCell *a, const ScreenCell *b, int nchars)
+{
+  for(int i = 0; i < nchars; i++)
+    if(a->chars[i] != b->chars[i])
+      return false;
+  if(a->chars[0] && nchars < VTERM_MAX_CHARS_PER_CELL && b->chars[nchars])
+    return false;
+
+  return !memcmp(&a->pen, &b->pen, sizeof(ScreenPen));
+}
+
+/* Returns the packed length, only storing it if out is non-NULL */
+static size_t pack_buffer(const VTermScreen *screen, const ScreenCell *buffer, const ScreenRow *rowinfo, unsigned char *out)
+{
+  size_t len = 0;
+
+  for(int row = 0; row < screen->rows; row += 8) {
+    unsigned char bits = 0;
+    for(int i = 0; i < 8 && row + i < screen->rows; i++)
+      if(rowinfo[row + i].continuation)
+        bits |= 1 << i;
+    if(out)
+      out[len] = bits;
+    len++;
+  }
+
+  int ncells = screen->rows * screen->cols;
+  const ScreenPen *pen = NULL;
+
+  for(int i = 0; i < ncells; ) {
+    const ScreenCell *cell = nthcell(screen, buffer, rowinfo, i);
+    int nchars = cell_nchars(cell);
+
+    int repeat = 0;
+    while(i + 1 + repeat < ncells && cells_equal(cell, nthcell(screen, buffer, rowinfo, i + 1 + repeat), nchars))
+      repeat++;
+
+    bool newpen = !pen || memcmp(pen, &cell->pen, sizeof(ScreenPen));
+
+    uint64_t head = (uint64_t)cell->chars[0] << 3 |
+      (nchars > 1 ? PACK_MORE : 0) | (newpen ? PACK_PEN : 0) | (repeat ? PACK_REPEAT : 0);
+    len += pack_varint(out ? out + len : NULL, head);
+    for(int c = 1; c < nchars; c++)
+      len += pack_varint(out ? out + len : NULL, (uint64_t)cell->chars[c] << 1 | (c + 1 < nchars));
+    if(newpen) {
+      if(out)
+        memcpy(out + len, &cell->pen, sizeof(ScreenPen));
+      len += sizeof(ScreenPen);
     }
+    if(repeat)
+      len += pack_varint(out ? out + len : NULL, repeat);
+
+    pen = &cell->pen;
+    i += 1 + repeat;
   }
 
-  return new_buffer;
+  return len;
 }
 
+/* Fills in a zeroed buffer and rowinfo of exactly the screen's size; returns
+ * the end of the packed data */
+static const unsigned char *unpack_buffer(const VTermScreen *screen, const unsigned char *p, ScreenCell *buffer, ScreenRow *rowinfo)
+{
+  for(int row = 0; row < screen->rows; row++)
+    rowinfo[row].continuation = p[row / 8] >> (row % 8) & 1;
+  p += (screen->rows + 7) / 8;
+
+  int ncells = screen->rows * screen->cols;
+  ScreenPen pen = screen->pen;
+
+  for(int i = 0; i < ncells; ) {
+    ScreenCell *cell = &buffer[i];
+    uint64_t head = unpack_varint(&p);
+
+    cell->chars[0] = head >> 3;
+    if(head & PACK_MORE)
+      for(int c = 1; c < VTERM_MAX_CHARS_PER_CELL; c++) {
+        uint64_t v = unpack_varint(&p);
+        cell->chars[c] = v >> 1;
+        if(!(v & 1))
+          break;
+      }
+    if(head & PACK_PEN) {
+      memcpy(&pen, p, sizeof(ScreenPen));
+      p += sizeof(ScreenPen);
+    }
+    cell->pen = pen;
+
+    int repeat = (head & PACK_REPEAT) ? unpack_varint(&p) : 0;
+    for(int r = 1; r <= repeat; r++)
+      buffer[i + r] = *cell;
+    i += 1 + repeat;
+  }
+
+  for(int row = 0; row < screen->rows; row++) {
+    rowinfo[row].eol = screen->cols;
+    trim_eol(&rowinfo[row], &buffer[row * screen->cols]);
+  }
+
+  return p;
+}
+
+static void wake(VTermScreen *screen)
+{
+  int rows = screen->rows, cols = screen->cols;
+  const unsigned char *p = screen->packed;
+
+  /* Any spare capacity from earlier resizes isn't restored */
+  screen->rows_capacity = rows;
+  screen->cols_capacity = cols;
+
+  for(int bufidx = BUFIDX_PRIMARY; bufidx <= BUFIDX_ALTSCREEN; bufidx++) {
+    if(bufidx == BUFIDX_ALTSCREEN && !screen->packed_altactive)
+      break;
+
+    screen->buffers[bufidx] = vterm_allocator_malloc(screen->vt, sizeof(ScreenCell) * rows * cols);
+    screen->rowinfos[bufidx] = vterm_allocator_malloc(screen->vt, sizeof(ScreenRow) * rows);
+    p = unpack_buffer(screen, p, screen->buffers[bufidx], screen->rowinfos[bufidx]);
+  }
+
+  int bufidx = screen->packed_altactive ? BUFIDX_ALTSCREEN : BUFIDX_PRIMARY;
+  screen->buffer  = screen->buffers[bufidx];
+  screen->rowinfo = screen->rowinfos[bufidx];
+
+  screen->sb_buffer = vterm_allocator_malloc(screen->vt, sizeof(VTermScreenCell) * cols);
+
+  vterm_allocator_free(screen->vt, screen->packed);
+  screen->packed = NULL;
+  screen->packed_len = 0;
+}
+
+/* Anything about to touch the buffers must call this first */
+static inline void ensure_awake(const VTermScreen *screen)
+{
+  if(screen->packed)
+    wake((VTermScreen *)screen);
+}
+
+INTERNAL void vterm_screen_hibernate(VTermScreen *screen)
+{
+  if(screen->packed)
+    return;
+
+  bool altactive = screen->buffers[BUFIDX_ALTSCREEN] && screen->buffer == screen->buffers[BUFIDX_ALTSCREEN];
+
+  size_t len = pack_buffer(screen, screen->buffers[BUFIDX_PRIMARY], screen->rowinfos[BUFIDX_PRIMARY], NULL);
+  if(altactive)
+    len += pack_buffer(screen, screen->buffers[BUFIDX_ALTSCREEN], screen->rowinfos[BUFIDX_ALTSCREEN], NULL);
+
+  unsigned char *packed = vterm_allocator_malloc(screen->vt, len);
+  size_t pos = pack_buffer(screen, screen->buffers[BUFIDX_PRIMARY], screen->rowinfos[BUFIDX_PRIMARY], packed);
+  if(altactive)
+    pack_buffer(screen, screen->buffers[BUFIDX_ALTSCREEN], screen->rowinfos[BUFIDX_ALTSCREEN], packed + pos);
+
+  for(int bufidx = BUFIDX_PRIMARY; bufidx <= BUFIDX_ALTSCREEN; bufidx++) {
+    if(!screen->buffers[bufidx])
+      continue;
+    vterm_allocator_free(screen->vt, screen->buffers[bufidx]);
+    vterm_allocator_free(screen->vt, screen->rowinfos[bufidx]);
+    screen->buffers[bufidx] = NULL;
+    screen->rowinfos[bufidx] = NULL;
+  }
+  screen->buffer = NULL;
+  screen->rowinfo = NULL;
+
+  vterm_allocator_free(screen->vt, screen->sb_buffer);
+  screen->sb_buffer = NULL;
+
+  if(screen->sb)
+    vterm_scrollback_trim(screen->sb);
+
+  screen->packed = packed;
+  screen->packed_len = len;
+  screen->packed_altactive = altactive;
+}
+
+INTERNAL bool vterm_screen_is_hibernating(const VTermScreen *screen)
+{
+  return screen->packed != NULL;
+}
+
+INTERNAL int vterm_screen_release_altscreen(VTermScreen *screen)
+{
+  /* Also NULL while hibernating, unless in use */
+  if(!screen->buffers[BUFIDX_ALTSCREEN] || screen->buffer == screen->buffers[BUFIDX_ALTSCREEN])
+    return 0;
+
+  vterm_allocator_free(screen->vt, screen->buffers[BUFIDX_ALTSCREEN]);
+  vterm_allocator_free(screen->vt, screen->rowinfos[BUFIDX_ALTSCREEN]);
+  screen->buffers[BUFIDX_ALTSCREEN] = NULL;
+  screen->rowinfos[BUFIDX_ALTSCREEN] = NULL;
+  return 1;
+}
+
+/* Tells whatever follows the contents of the visible rows that they changed */
+static void rows_changed(VTermScreen *screen, int start_row, int end_row)
+{
+  /* A hibernating screen has no row info; it is made afresh on waking */
+  for(int row = start_row < 0 ? 0 : start_row; screen->rowinfo && row < end_row && row < screen->rows; row++)
+    screen->rowinfo[row].hashed = false;
+
+  if(screen->matcher)
+    vterm_matcher_damage(screen->matcher, start_row, end_row);
+  if(screen->snapshots)
+    vterm_snapshots_damage(screen->snapshots, start_row, end_row);
+  if(screen->shm)
+    vterm_shm_export_damage(screen->shm, start_row, end_row);
+}
+
+static void flush_damage(VTermScreen *screen);
+
 static void damagerect(VTermScreen *screen, VTermRect rect)
 {
   VTermRect emit;
 
+  if(screen->sync_output) {
+    /* Hold everything back until the update ends or grows too large */
+    if(screen->damaged.start_row == -1)
+      screen->damaged = rect;
+    else
+      rect_expand(&screen->damaged, &rect);
+
+    screen->sync_cells += (rect.end_row - rect.start_row) * (rect.end_col - rect.start_col);
+    if(screen->sync_budget && screen->sync_cells > screen->sync_budget)
+      /* Too much to hold; better a torn frame than none at all */
+      flush_damage(screen);
+    return;
+  }
+
   switch(screen->damage_merge) {
   case VTERM_DAMAGE_CELL:
     /* Always emit damage event */
@@ -109,7 +498,7 @@ static void damagerect(VTermScreen *screen, VTermRect rect)
      * the same row */
     if(rect.end_row > rect.start_row + 1) {
       // Bigger than 1 line - flush existing, emit this
-      vterm_screen_flush_damage(screen);
+      flush_damage(screen);
       emit = rect;
     }
     else if(screen->damaged.start_row == -1) {
@@ -166,7 +555,9 @@ static void damagescreen(VTermScreen *screen)
 static int putglyph(VTermGlyphInfo *info, VTermPos pos, void *user)
 {
   VTermScreen *screen = user;
-  ScreenCell *cell = getcell(screen, pos.row, pos.col);
+  ensure_awake(screen);
+
+  ScreenCell *cell = writecell(screen, pos.row, pos.col);
 
   if(!cell)
     return 0;
@@ -180,7 +571,13 @@ static int putglyph(VTermGlyphInfo *info, VTermPos pos, void *user)
     cell->chars[i] = 0;
 
   for(int col = 1; col < info->width; col++)
-    getcell(screen, pos.row, pos.col + col)->chars[0] = (uint32_t)-1;
+    writecell(screen, pos.row, pos.col + col)->chars[0] = (uint32_t)-1;
+
+  ScreenRow *rowinfo = &screen->rowinfo[pos.row];
+  if(pos.col + info->width > rowinfo->eol)
+    rowinfo->eol = pos.col + info->width;
+  if(!cell->chars[0])
+    trim_eol(rowinfo, getcell(screen, pos.row, 0));
 
   VTermRect rect = {
     .start_row = pos.row,
@@ -193,6 +590,8 @@ static int putglyph(VTermGlyphInfo *info, VTermPos pos, void *user)
   cell->pen.dwl            = info->dwl;
   cell->pen.dhl            = info->dhl;
 
+  rows_changed(screen, pos.row, pos.row + 1);
+
   damagerect(screen, rect);
 
   return 1;
@@ -204,14 +603,36 @@ static void sb_pushline_from_row(VTermScreen *screen, int row)
   for(pos.col = 0; pos.col < screen->cols; pos.col++)
     vterm_screen_get_cell(screen, pos, screen->sb_buffer + pos.col);
 
-  (screen->callbacks->sb_pushline)(screen->cols, screen->sb_buffer, screen->cbdata);
+  if(screen->sb) {
+    bool continuation = screen->rowinfos[BUFIDX_PRIMARY][row].continuation;
+    vterm_scrollback_push(screen->sb, screen->cols, screen->sb_buffer, continuation);
+    if(screen->search)
+      vterm_search_index_push(screen->search, screen->sb, screen->cols, screen->sb_buffer, continuation);
+  }
+  else
+    (screen->callbacks->sb_pushline)(screen->cols, screen->sb_buffer, screen->cbdata);
+}
+
+static int sb_popline(VTermScreen *screen, int cols, bool *continuation)
+{
+  if(screen->sb) {
+    int ret = vterm_scrollback_pop(screen->sb, cols, screen->sb_buffer, continuation);
+    if(ret && screen->search)
+      vterm_search_index_pop(screen->search, screen->sb);
+    return ret;
+  }
+
+  /* The callbacks don't carry it */
+  *continuation = false;
+  return (*screen->callbacks->sb_popline)(cols, screen->sb_buffer, screen->cbdata);
 }
 
 static int moverect_internal(VTermRect dest, VTermRect src, void *user)
 {
   VTermScreen *screen = user;
+  ensure_awake(screen);
 
-  if(screen->callbacks && screen->callbacks->sb_pushline &&
+  if((screen->sb || (screen->callbacks && screen->callbacks->sb_pushline)) &&
      dest.start_row == 0 && dest.start_col == 0 &&        // starts top-left corner
      dest.end_col == screen->cols &&                      // full width
      screen->buffer == screen->buffers[BUFIDX_PRIMARY]) { // not altscreen
@@ -222,6 +643,15 @@ static int moverect_internal(VTermRect dest, VTermRect src, void *user)
   int cols = src.end_col - src.start_col;
   int downward = src.start_row - dest.start_row;
 
+  if(screen->matcher)
+    vterm_matcher_moverect(screen->matcher, dest, src, cols == screen->cols);
+  if(screen->snapshots)
+    vterm_snapshots_moverect(screen->snapshots, dest, src, cols == screen->cols);
+  if(screen->shm) {
+    vterm_shm_export_damage(screen->shm, dest.start_row, dest.end_row);
+    vterm_shm_export_damage(screen->shm, src.start_row, src.end_row);
+  }
+
   int init_row, test_row, inc_row;
   if(downward < 0) {
     init_row = dest.end_row - 1;
@@ -234,10 +664,36 @@ static int moverect_internal(VTermRect dest, VTermRect src, void *user)
     inc_row  = +1;
   }
 
-  for(int row = init_row; row != test_row; row += inc_row)
-    memmove(getcell(screen, row, dest.start_col),
-            getcell(screen, row + downward, src.start_col),
-            cols * sizeof(ScreenCell));
+  for(int row = init_row; row != test_row; row += inc_row) {
+    if(cols == screen->cols) {
+      /* Whole rows; a cleared one only needs its marker moving */
+      if(!screen->rowinfo[row + downward].cleared)
+        memmove(&screen->buffer[row * screen->cols_capacity],
+                &screen->buffer[(row + downward) * screen->cols_capacity],
+                cols * sizeof(ScreenCell));
+      screen->rowinfo[row] = screen->rowinfo[row + downward];
+    }
+    else {
+      ScreenCell *dst = writecell(screen, row, dest.start_col);
+      const ScreenRow *srcinfo = &screen->rowinfo[row + downward];
+      if(srcinfo->cleared)
+        fill_cells(dst, &srcinfo->blank, cols);
+      else
+        memmove(dst, getcell(screen, row + downward, src.start_col), cols * sizeof(ScreenCell));
+
+      screen->rowinfo[row].eol = screen->cols;
+      trim_eol(&screen->rowinfo[row], getcell(screen, row, 0));
+      screen->rowinfo[row].hashed = false;
+    }
+  }
+
+  if(cols == screen->cols) {
+    /* As the state does for its lineinfo, rows left behind start afresh */
+    int start_row = downward > 0 ? dest.end_row : src.start_row;
+    int end_row   = downward > 0 ? src.end_row  : dest.start_row;
+    for(int row = start_row; row < end_row; row++)
+      screen->rowinfo[row].continuation = false;
+  }
 
   return 1;
 }
@@ -249,7 +705,7 @@ static int moverect_user(VTermRect dest, VTermRect src, void *user)
   if(screen->callbacks && screen->callbacks->moverect) {
     if(screen->damage_merge != VTERM_DAMAGE_SCROLL)
       // Avoid an infinite loop
-      vterm_screen_flush_damage(screen);
+      flush_damage(screen);
 
     if((*screen->callbacks->moverect)(dest, src, screen->cbdata))
       return 1;
@@ -263,20 +719,41 @@ static int moverect_user(VTermRect dest, VTermRect src, void *user)
 static int erase_internal(VTermRect rect, int selective, void *user)
 {
   VTermScreen *screen = user;
+  ensure_awake(screen);
+
+  rows_changed(screen, rect.start_row, rect.end_row);
+
+  bool wholerow = !selective && rect.start_col == 0 && rect.end_col >= screen->cols;
 
   for(int row = rect.start_row; row < screen->state->rows && row < rect.end_row; row++) {
     const VTermLineInfo *info = vterm_state_get_lineinfo(screen->state, row);
+    ScreenRow *rowinfo = &screen->rowinfo[row];
+
+    ScreenCell blank = { .pen = screen->pen };
+    blank.pen.hyperlink = 0;
+    blank.pen.dwl = info->doublewidth;
+    blank.pen.dhl = info->doubleheight;
+
+    if(wholerow) {
+      rowinfo->cleared = true;
+      rowinfo->blank = blank;
+      rowinfo->eol = 0;
+      continue;
+    }
 
-    for(int col = rect.start_col; col < rect.end_col; col++) {
-      ScreenCell *cell = getcell(screen, row, col);
-
-      if(selective && cell->pen.protected_cell)
-        continue;
+    if(!selective)
+      fill_cells(writecell(screen, row, rect.start_col), &blank, rect.end_col - rect.start_col);
+    else
+      for(int col = rect.start_col; col < rect.end_col; col++) {
+        ScreenCell *cell = writecell(screen, row, col);
+        if(!cell->pen.protected_cell)
+          *cell = blank;
+      }
 
-      cell->chars[0] = 0;
-      cell->pen = screen->pen;
-      cell->pen.dwl = info->doublewidth;
-      cell->pen.dhl = info->doubleheight;
+    if(rect.start_col < rowinfo->eol && rect.end_col >= rowinfo->eol) {
+      if(!selective)
+        rowinfo->eol = rect.start_col;
+      trim_eol(rowinfo, getcell(screen, row, 0));
     }
   }
 
@@ -301,12 +778,29 @@ static int erase(VTermRect rect, int selective, void *user)
 static int scrollrect(VTermRect rect, int downward, int rightward, void *user)
 {
   VTermScreen *screen = user;
+  ensure_awake(screen);
+
+  if(rect.start_col == 0 && rect.end_col == screen->cols &&
+     abs(downward) >= rect.end_row - rect.start_row)
+    /* Nothing will move, so moverect_internal() won't get to do this */
+    for(int row = rect.start_row; row < rect.end_row; row++)
+      screen->rowinfo[row].continuation = false;
+
+  if(screen->sync_output) {
+    /* No moverect during an update; the moved area just becomes damage */
+    vterm_scroll_rect(rect, downward, rightward,
+        moverect_internal, erase_internal, screen);
+
+    damagerect(screen, rect);
+
+    return 1;
+  }
 
   if(screen->damage_merge != VTERM_DAMAGE_SCROLL) {
     vterm_scroll_rect(rect, downward, rightward,
         moverect_internal, erase_internal, screen);
 
-    vterm_screen_flush_damage(screen);
+    flush_damage(screen);
 
     vterm_scroll_rect(rect, downward, rightward,
         moverect_user, erase_user, screen);
@@ -316,7 +810,7 @@ static int scrollrect(VTermRect rect, int downward, int rightward, void *user)
 
   if(screen->damaged.start_row != -1 &&
      !rect_intersects(&rect, &screen->damaged)) {
-    vterm_screen_flush_damage(screen);
+    flush_damage(screen);
   }
 
   if(screen->pending_scrollrect.start_row == -1) {
@@ -331,7 +825,7 @@ static int scrollrect(VTermRect rect, int downward, int rightward, void *user)
     screen->pending_scroll_rightward += rightward;
   }
   else {
-    vterm_screen_flush_damage(screen);
+    flush_damage(screen);
 
     screen->pending_scrollrect = rect;
     screen->pending_scroll_downward  = downward;
@@ -392,6 +886,192 @@ static int movecursor(VTermPos pos, VTermPos oldpos, int visible, void *user)
   return 0;
 }
 
+static uint32_t hash_hyperlink(const char *uri, size_t urilen, const char *id, size_t idlen)
+{
+  /* FNV-1a over both strings */
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < urilen; i++)
+    hash = (hash ^ (unsigned char)uri[i]) * 16777619u;
+  hash = (hash ^ ';') * 16777619u;
+  for(size_t i = 0; i < idlen; i++)
+    hash = (hash ^ (unsigned char)id[i]) * 16777619u;
+  return hash;
+}
+
+static void mark_hyperlinks(const VTermScreen *screen, const ScreenCell *buffer, const ScreenRow *rowinfo, unsigned char *marks)
+{
+  for(int row = 0; row < screen->rows; row++)
+    /* A cleared row's blank never has one */
+    for(int col = 0; !rowinfo[row].cleared && col < screen->cols; col++)
+      marks[buffer[row * screen->cols_capacity + col].pen.hyperlink] = 1;
+}
+
+/* Frees every link no cell or the pen refers to; returns how many */
+static int sweep_hyperlinks(VTermScreen *screen)
+{
+  ensure_awake(screen);
+
+  unsigned char *marks = vterm_allocator_malloc(screen->vt, screen->links_len);
+
+  for(int i = BUFIDX_PRIMARY; i <= BUFIDX_ALTSCREEN; i++)
+    if(screen->buffers[i])
+      mark_hyperlinks(screen, screen->buffers[i], screen->rowinfos[i], marks);
+  marks[screen->pen.hyperlink] = 1;
+
+  int freed = 0;
+  int len = 1;
+  screen->links_free = 1;
+  for(int idx = 1; idx < screen->links_len; idx++) {
+    ScreenHyperlink *link = &screen->links[idx];
+    if(!link->uri)
+      continue;
+    if(!marks[idx]) {
+      vterm_allocator_free(screen->vt, link->uri);
+      link->uri = NULL;
+      link->id  = NULL;
+      freed++;
+    }
+    else
+      len = idx + 1;
+  }
+  screen->links_len = len;
+
+  vterm_allocator_free(screen->vt, marks);
+  return freed;
+}
+
+static void index_hyperlink(VTermScreen *screen, int idx)
+{
+  int mask = 2 * screen->links_size - 1;
+  int pos = screen->links[idx].hash & mask;
+  while(screen->links_index[pos])
+    pos = (pos + 1) & mask;
+  screen->links_index[pos] = idx;
+}
+
+/* Index entries can't be removed one at a time, so it is only rebuilt */
+static void reindex_hyperlinks(VTermScreen *screen)
+{
+  if(screen->links_index)
+    vterm_allocator_free(screen->vt, screen->links_index);
+  screen->links_index = vterm_allocator_malloc(screen->vt, sizeof(uint16_t) * 2 * screen->links_size);
+
+  for(int idx = 1; idx < screen->links_len; idx++)
+    if(screen->links[idx].uri)
+      index_hyperlink(screen, idx);
+}
+
+static int find_hyperlink(const VTermScreen *screen, uint32_t hash, const char *uri, size_t urilen, const char *id, size_t idlen)
+{
+  if(!screen->links_index)
+    return 0;
+
+  int mask = 2 * screen->links_size - 1;
+  for(int pos = hash & mask; screen->links_index[pos]; pos = (pos + 1) & mask) {
+    int idx = screen->links_index[pos];
+    const ScreenHyperlink *link = &screen->links[idx];
+    if(link->hash != hash)
+      continue;
+    if(strncmp(link->uri, uri, urilen) || link->uri[urilen])
+      continue;
+    if(id ? !link->id || strncmp(link->id, id, idlen) || link->id[idlen] : link->id != NULL)
+      continue;
+    return idx;
+  }
+
+  return 0;
+}
+
+/* Returns the index of the given link, adding it if necessary, or 0 if the
+ * table is full of links that are still in use */
+static int intern_hyperlink(VTermScreen *screen, const char *uri, size_t urilen, const char *id, size_t idlen)
+{
+  uint32_t hash = hash_hyperlink(uri, urilen, id, idlen);
+
+  int idx = find_hyperlink(screen, hash, uri, urilen, id, idlen);
+  if(idx)
+    return idx;
+
+  while(screen->links_free < screen->links_len && screen->links[screen->links_free].uri)
+    screen->links_free++;
+
+  if(screen->links_free == screen->links_len && screen->links_len == screen->links_size) {
+    int freed = screen->links_size ? sweep_hyperlinks(screen) : 0;
+
+    if((!screen->links_size || freed < screen->links_size / 4) &&
+       screen->links_size < HYPERLINKS_MAX + 1) {
+      int new_size = screen->links_size ? screen->links_size * 2 : 16;
+      if(new_size > HYPERLINKS_MAX + 1)
+        new_size = HYPERLINKS_MAX + 1;
+
+      ScreenHyperlink *new_links = vterm_allocator_malloc(screen->vt, sizeof(ScreenHyperlink) * new_size);
+      if(screen->links) {
+        memcpy(new_links, screen->links, sizeof(ScreenHyperlink) * screen->links_len);
+        vterm_allocator_free(screen->vt, screen->links);
+      }
+      screen->links = new_links;
+      screen->links_size = new_size;
+    }
+
+    reindex_hyperlinks(screen);
+
+    while(screen->links_free < screen->links_len && screen->links[screen->links_free].uri)
+      screen->links_free++;
+  }
+
+  int free_idx = screen->links_free;
+  if(free_idx == screen->links_len) {
+    if(screen->links_len == screen->links_size) {
+      DEBUG_LOG("libvterm: hyperlink table full; dropping link\n");
+      return 0;
+    }
+    if(!free_idx)
+      free_idx = screen->links_free = 1;
+    screen->links_len = free_idx + 1;
+  }
+
+  ScreenHyperlink *link = &screen->links[free_idx];
+  link->uri = vterm_allocator_malloc(screen->vt, urilen + 1 + (id ? idlen + 1 : 0));
+  memcpy(link->uri, uri, urilen);
+  if(id) {
+    link->id = link->uri + urilen + 1;
+    memcpy(link->id, id, idlen);
+  }
+  link->hash = hash;
+  index_hyperlink(screen, free_idx);
+
+  return free_idx;
+}
+
+/* Parses an OSC 8 "params;URI" payload into an interned link index */
+static int parse_hyperlink(VTermScreen *screen, VTermStringFragment payload)
+{
+  const char *semi = memchr(payload.str, ';', payload.len);
+  if(!semi)
+    return 0;
+
+  const char *uri = semi + 1;
+  size_t urilen = payload.str + payload.len - uri;
+  if(!urilen)
+    return 0;
+
+  /* params is a ':'-separated list of key=value pairs; only id is used */
+  const char *id = NULL;
+  size_t idlen = 0;
+  for(const char *param = payload.str; param < semi; ) {
+    const char *end = memchr(param, ':', semi - param);
+    if(!end)
+      end = semi;
+    if(end - param > 3 && strncmp(param, "id=", 3) == 0) {
+      id = param + 3;
+      idlen = end - id;
+    }
+    param = end + 1;
+  }
+
+  return intern_hyperlink(screen, uri, urilen, id, idlen);
+}
+
 static int setpenattr(VTermAttr attr, VTermValue *val, void *user)
 {
   VTermScreen *screen = user;
@@ -424,6 +1104,9 @@ static int setpenattr(VTermAttr attr, VTermValue *val, void *user)
   case VTERM_ATTR_BACKGROUND:
     screen->pen.bg = val->color;
     return 1;
+  case VTERM_ATTR_HYPERLINK:
+    screen->pen.hyperlink = parse_hyperlink(screen, val->string);
+    return 1;
 
   case VTERM_N_ATTRS:
     return 0;
@@ -432,16 +1115,45 @@ static int setpenattr(VTermAttr attr, VTermValue *val, void *user)
   return 0;
 }
 
+static int setpen(const VTermPen *pen, VTermAttrMask changed, void *user)
+{
+  VTermScreen *screen = user;
+
+  screen->pen.bold      = pen->bold;
+  screen->pen.underline = pen->underline;
+  screen->pen.italic    = pen->italic;
+  screen->pen.blink     = pen->blink;
+  screen->pen.reverse   = pen->reverse;
+  screen->pen.strike    = pen->strike;
+  screen->pen.font      = pen->font;
+  screen->pen.fg        = pen->fg;
+  screen->pen.bg        = pen->bg;
+
+  return 1;
+}
+
 static int settermprop(VTermProp prop, VTermValue *val, void *user)
 {
   VTermScreen *screen = user;
 
   switch(prop) {
   case VTERM_PROP_ALTSCREEN:
-    if(val->boolean && !screen->buffers[BUFIDX_ALTSCREEN])
+    ensure_awake(screen);
+    if(val->boolean && !screen->altscreen_enabled)
       return 0;
 
+    if(val->boolean && !screen->buffers[BUFIDX_ALTSCREEN]) {
+      screen->buffers[BUFIDX_ALTSCREEN] = alloc_buffer(screen);
+      screen->rowinfos[BUFIDX_ALTSCREEN] = vterm_allocator_malloc(screen->vt, sizeof(ScreenRow) * screen->rows_capacity);
+    }
+    else if(val->boolean)
+      /* As the state clears its line info */
+      for(int row = 0; row < screen->rows; row++)
+        screen->rowinfos[BUFIDX_ALTSCREEN][row].continuation = false;
+
     screen->buffer = val->boolean ? screen->buffers[BUFIDX_ALTSCREEN] : screen->buffers[BUFIDX_PRIMARY];
+    screen->rowinfo = val->boolean ? screen->rowinfos[BUFIDX_ALTSCREEN] : screen->rowinfos[BUFIDX_PRIMARY];
+    rows_changed(screen, 0, screen->rows);
     /* only send a damage event on disable; because during enable there's an
      * erase that sends a damage anyway
      */
@@ -450,8 +1162,14 @@ static int settermprop(VTermProp prop, VTermValue *val, void *user)
     break;
   case VTERM_PROP_REVERSE:
     screen->global_reverse = val->boolean;
+    rows_changed(screen, 0, screen->rows);
     damagescreen(screen);
     break;
+  case VTERM_PROP_SYNCOUTPUT:
+    /* Either way, anything outstanding goes out now */
+    flush_damage(screen);
+    screen->sync_output = val->boolean;
+    break;
   default:
     ; /* ignore */
   }
@@ -472,55 +1190,113 @@ static int bell(void *user)
   return 0;
 }
 
-static void resize_buffer(VTermScreen *screen, int bufidx, int new_rows, int new_cols, bool active, VTermStateFields *statefields)
+/* Moves the buffers into larger ones, keeping each cell's row and column */
+static void grow_buffers(VTermScreen *screen, int rows_capacity, int cols_capacity)
 {
-  int old_rows = screen->rows;
-  int old_cols = screen->cols;
+  for(int bufidx = BUFIDX_PRIMARY; bufidx <= BUFIDX_ALTSCREEN; bufidx++) {
+    ScreenCell *old_buffer = screen->buffers[bufidx];
+    if(!old_buffer)
+      continue;
 
-  ScreenCell *old_buffer = screen->buffers[bufidx];
-  ScreenCell *new_buffer = vterm_allocator_malloc(screen->vt, sizeof(ScreenCell) * new_rows * new_cols);
+    ScreenCell *new_buffer = vterm_allocator_malloc(screen->vt, sizeof(ScreenCell) * rows_capacity * cols_capacity);
+    for(int row = 0; row < screen->rows; row++)
+      memcpy(&new_buffer[row * cols_capacity], &old_buffer[row * screen->cols_capacity], sizeof(ScreenCell) * screen->cols);
 
-  int old_row = old_rows - 1;
-  int new_row = new_rows - 1;
+    ScreenRow *new_rowinfo = vterm_allocator_malloc(screen->vt, sizeof(ScreenRow) * rows_capacity);
+    memcpy(new_rowinfo, screen->rowinfos[bufidx], sizeof(ScreenRow) * screen->rows);
 
-  while(new_row >= 0 && old_row >= 0) {
-    int col;
-    for(col = 0; col < old_cols && col < new_cols; col++)
-      new_buffer[new_row * new_cols + col] = old_buffer[old_row * old_cols + col];
-    for( ; col < new_cols; col++)
-      clearcell(screen, &new_buffer[new_row * new_cols + col]);
+    if(screen->buffer == old_buffer) {
+      screen->buffer = new_buffer;
+      screen->rowinfo = new_rowinfo;
+    }
 
-    old_row--;
-    new_row--;
+    vterm_allocator_free(screen->vt, old_buffer);
+    screen->buffers[bufidx] = new_buffer;
 
-    if(new_row < 0 && old_row >= 0 &&
-        new_buffer[(new_rows - 1) * new_cols].chars[0] == 0 &&
-        (!active || statefields->pos.row < (new_rows - 1))) {
-      int moverows = new_rows - 1;
-      memmove(&new_buffer[1 * new_cols], &new_buffer[0], moverows * new_cols * sizeof(ScreenCell));
+    vterm_allocator_free(screen->vt, screen->rowinfos[bufidx]);
+    screen->rowinfos[bufidx] = new_rowinfo;
+  }
 
-      new_row++;
-    }
+  /* Large enough for a row of either the old or new size */
+  if(cols_capacity > screen->cols_capacity) {
+    vterm_allocator_free(screen->vt, screen->sb_buffer);
+    screen->sb_buffer = vterm_allocator_malloc(screen->vt, sizeof(VTermScreenCell) * cols_capacity);
+  }
+
+  screen->rows_capacity = rows_capacity;
+  screen->cols_capacity = cols_capacity;
+}
+
+/* Resizes a buffer in place, which has room for both the old and new sizes */
+static void resize_buffer(VTermScreen *screen, int bufidx, int new_rows, int new_cols, bool active, VTermStateFields *statefields)
+{
+  int old_rows = screen->rows;
+  int old_cols = screen->cols;
+  int stride = screen->cols_capacity;
+
+  ScreenCell *buffer = screen->buffers[bufidx];
+  ScreenRow *rowinfo = screen->rowinfos[bufidx];
+  /* Moved along with the rows, so the state's line info keeps matching */
+  VTermLineInfo *lineinfo = statefields->lineinfos[bufidx];
+
+  /* Rows stay aligned to the bottom, so on shrinking some fall off the top;
+   * but blank ones at the bottom below the cursor go first */
+  int spare = 0;
+  if(new_rows < old_rows) {
+    spare = old_rows - new_rows;
+    while(spare > 0 && buffer[(spare + new_rows - 1) * stride].chars[0] == 0 &&
+        (!active || statefields->pos.row < (new_rows - 1)))
+      spare--;
   }
 
-  if(old_row >= 0 && bufidx == BUFIDX_PRIMARY) {
+  if(spare && bufidx == BUFIDX_PRIMARY) {
     /* Push spare lines to scrollback buffer */
-    for(int row = 0; row <= old_row; row++)
-      sb_pushline_from_row(screen, row);
+    if(screen->sb || (screen->callbacks && screen->callbacks->sb_pushline))
+      for(int row = 0; row < spare; row++)
+        sb_pushline_from_row(screen, row);
     if(active)
-      statefields->pos.row -= (old_row + 1);
+      statefields->pos.row -= spare;
+  }
+
+  /* The lowest row not yet filled in, if any */
+  int new_row = -1;
+  int kept = old_rows;
+  if(new_rows < old_rows) {
+    memmove(&buffer[0], &buffer[spare * stride], sizeof(ScreenCell) * new_rows * stride);
+    memmove(&rowinfo[0], &rowinfo[spare], sizeof(ScreenRow) * new_rows);
+    if(lineinfo)
+      memmove(&lineinfo[0], &lineinfo[spare], sizeof(VTermLineInfo) * new_rows);
+    kept = new_rows;
   }
+  else if(new_rows > old_rows) {
+    new_row = new_rows - old_rows - 1;
+    memmove(&buffer[(new_row + 1) * stride], &buffer[0], sizeof(ScreenCell) * old_rows * stride);
+    memmove(&rowinfo[new_row + 1], &rowinfo[0], sizeof(ScreenRow) * old_rows);
+    if(lineinfo)
+      memmove(&lineinfo[new_row + 1], &lineinfo[0], sizeof(VTermLineInfo) * old_rows);
+  }
+
+  for(int row = new_row + 1; row < new_row + 1 + kept; row++)
+    for(int col = old_cols; col < new_cols; col++)
+      clearcell(screen, &buffer[row * stride + col]);
+
   if(new_row >= 0 && bufidx == BUFIDX_PRIMARY &&
-      screen->callbacks && screen->callbacks->sb_popline) {
+      (screen->sb || (screen->callbacks && screen->callbacks->sb_popline))) {
     /* Try to backfill rows by popping scrollback buffer */
     while(new_row >= 0) {
-      if(!(screen->callbacks->sb_popline(old_cols, screen->sb_buffer, screen->cbdata)))
+      bool continuation;
+      if(!sb_popline(screen, old_cols, &continuation))
         break;
 
+      memset(&buffer[new_row * stride], 0, sizeof(ScreenCell) * new_cols);
+      rowinfo[new_row] = (ScreenRow){ .continuation = continuation };
+      if(lineinfo)
+        lineinfo[new_row] = (VTermLineInfo){ .continuation = continuation };
+
       VTermPos pos = { .row = new_row };
       for(pos.col = 0; pos.col < old_cols && pos.col < new_cols; pos.col += screen->sb_buffer[pos.col].width) {
         VTermScreenCell *src = &screen->sb_buffer[pos.col];
-        ScreenCell *dst = &new_buffer[pos.row * new_cols + pos.col];
+        ScreenCell *dst = &buffer[pos.row * stride + pos.col];
 
         for(int i = 0; i < VTERM_MAX_CHARS_PER_CELL; i++) {
           dst->chars[i] = src->chars[i];
@@ -551,15 +1327,24 @@ static void resize_buffer(VTermScreen *screen, int bufidx, int new_rows, int new
   if(new_row >= 0) {
     /* Scroll new rows back up to the top and fill in blanks at the bottom */
     int moverows = new_rows - new_row - 1;
-    memmove(&new_buffer[0], &new_buffer[(new_row + 1) * new_cols], moverows * new_cols * sizeof(ScreenCell));
+    memmove(&buffer[0], &buffer[(new_row + 1) * stride], sizeof(ScreenCell) * moverows * stride);
+    memmove(&rowinfo[0], &rowinfo[new_row + 1], sizeof(ScreenRow) * moverows);
+    if(lineinfo)
+      memmove(&lineinfo[0], &lineinfo[new_row + 1], sizeof(VTermLineInfo) * moverows);
 
-    for(new_row = moverows; new_row < new_rows; new_row++)
+    for(new_row = moverows; new_row < new_rows; new_row++) {
       for(int col = 0; col < new_cols; col++)
-        clearcell(screen, &new_buffer[new_row * new_cols + col]);
+        clearcell(screen, &buffer[new_row * stride + col]);
+      rowinfo[new_row] = (ScreenRow){ 0 };
+      if(lineinfo)
+        lineinfo[new_row] = (VTermLineInfo){ 0 };
+    }
   }
 
-  vterm_allocator_free(screen->vt, old_buffer);
-  screen->buffers[bufidx] = new_buffer;
+  for(int row = 0; row < new_rows; row++) {
+    rowinfo[row] = (ScreenRow){ .eol = new_cols, .continuation = rowinfo[row].continuation };
+    trim_eol(&rowinfo[row], &buffer[row * stride]);
+  }
 
   return;
 
@@ -571,34 +1356,39 @@ static void resize_buffer(VTermScreen *screen, int bufidx, int new_rows, int new
 static int resize(int new_rows, int new_cols, VTermStateFields *fields, void *user)
 {
   VTermScreen *screen = user;
+  ensure_awake(screen);
 
   int altscreen_active = (screen->buffers[BUFIDX_ALTSCREEN] && screen->buffer == screen->buffers[BUFIDX_ALTSCREEN]);
 
-  int old_cols = screen->cols;
-
-  if(new_cols > old_cols) {
-    /* Ensure that ->sb_buffer is large enough for a new or and old row */
-    if(screen->sb_buffer)
-      vterm_allocator_free(screen->vt, screen->sb_buffer);
+  /* Rows still marked as erased are written out, as they're about to move */
+  for(int bufidx = BUFIDX_PRIMARY; bufidx <= BUFIDX_ALTSCREEN; bufidx++)
+    for(int row = 0; screen->buffers[bufidx] && row < screen->rows; row++)
+      if(screen->rowinfos[bufidx][row].cleared)
+        materialize_row(screen, screen->buffers[bufidx], screen->rowinfos[bufidx], row);
 
-    screen->sb_buffer = vterm_allocator_malloc(screen->vt, sizeof(VTermScreenCell) * new_cols);
-  }
+  if(new_rows > screen->rows_capacity || new_cols > screen->cols_capacity)
+    grow_buffers(screen,
+        GROW_CAPACITY(screen->rows_capacity, new_rows), GROW_CAPACITY(screen->cols_capacity, new_cols));
 
   resize_buffer(screen, 0, new_rows, new_cols, !altscreen_active, fields);
   if(screen->buffers[BUFIDX_ALTSCREEN])
     resize_buffer(screen, 1, new_rows, new_cols, altscreen_active, fields);
 
   screen->buffer = altscreen_active ? screen->buffers[BUFIDX_ALTSCREEN] : screen->buffers[BUFIDX_PRIMARY];
+  screen->rowinfo = altscreen_active ? screen->rowinfos[BUFIDX_ALTSCREEN] : screen->rowinfos[BUFIDX_PRIMARY];
 
   screen->rows = new_rows;
   screen->cols = new_cols;
 
-  if(new_cols <= old_cols) {
-    if(screen->sb_buffer)
-      vterm_allocator_free(screen->vt, screen->sb_buffer);
+  if(!screen->sync_budget_set)
+    screen->sync_budget = 4 * new_rows * new_cols;
 
-    screen->sb_buffer = vterm_allocator_malloc(screen->vt, sizeof(VTermScreenCell) * new_cols);
-  }
+  if(screen->matcher)
+    vterm_matcher_resize(screen->matcher, new_rows);
+  if(screen->snapshots)
+    vterm_snapshots_resize(screen->snapshots, new_rows, new_cols);
+  if(screen->shm)
+    vterm_shm_export_resize(screen->shm, new_rows, new_cols);
 
   /* TODO: Maaaaybe we can optimise this if there's no reflow happening */
   damagescreen(screen);
@@ -612,11 +1402,20 @@ static int resize(int new_rows, int new_cols, VTermStateFields *fields, void *us
 static int setlineinfo(int row, const VTermLineInfo *newinfo, const VTermLineInfo *oldinfo, void *user)
 {
   VTermScreen *screen = user;
+  ensure_awake(screen);
+
+  screen->rowinfo[row].continuation = newinfo->continuation;
+
+  /* Joins two lines or splits one */
+  if(newinfo->continuation != oldinfo->continuation)
+    rows_changed(screen, row - 1, row + 1);
 
   if(newinfo->doublewidth != oldinfo->doublewidth ||
      newinfo->doubleheight != oldinfo->doubleheight) {
+    rows_changed(screen, row, row + 1);
+
     for(int col = 0; col < screen->cols; col++) {
-      ScreenCell *cell = getcell(screen, row, col);
+      ScreenCell *cell = writecell(screen, row, col);
       cell->pen.dwl = newinfo->doublewidth;
       cell->pen.dhl = newinfo->doubleheight;
     }
@@ -646,6 +1445,7 @@ static VTermStateCallbacks state_cbs = {
   .scrollrect  = &scrollrect,
   .erase       = &erase,
   .setpenattr  = &setpenattr,
+  .setpen      = &setpen,
   .settermprop = &settermprop,
   .bell        = &bell,
   .resize      = &resize,
@@ -670,15 +1470,21 @@ static VTermScreen *screen_new(VTerm *vt)
   screen->damaged.start_row = -1;
   screen->pending_scrollrect.start_row = -1;
 
+  screen->sync_budget = 4 * rows * cols;
+
   screen->rows = rows;
   screen->cols = cols;
+  screen->rows_capacity = rows;
+  screen->cols_capacity = cols;
 
   screen->callbacks = NULL;
   screen->cbdata    = NULL;
 
-  screen->buffers[BUFIDX_PRIMARY] = alloc_buffer(screen, rows, cols);
+  screen->buffers[BUFIDX_PRIMARY] = alloc_buffer(screen);
+  screen->rowinfos[BUFIDX_PRIMARY] = vterm_allocator_malloc(vt, sizeof(ScreenRow) * rows);
 
   screen->buffer = screen->buffers[BUFIDX_PRIMARY];
+  screen->rowinfo = screen->rowinfos[BUFIDX_PRIMARY];
 
   screen->sb_buffer = vterm_allocator_malloc(screen->vt, sizeof(VTermScreenCell) * cols);
 
@@ -689,15 +1495,77 @@ static VTermScreen *screen_new(VTerm *vt)
 
 INTERNAL void vterm_screen_free(VTermScreen *screen)
 {
-  vterm_allocator_free(screen->vt, screen->buffers[BUFIDX_PRIMARY]);
-  if(screen->buffers[BUFIDX_ALTSCREEN])
-    vterm_allocator_free(screen->vt, screen->buffers[BUFIDX_ALTSCREEN]);
+  if(screen->packed)
+    vterm_allocator_free(screen->vt, screen->packed);
+  else {
+    vterm_allocator_free(screen->vt, screen->buffers[BUFIDX_PRIMARY]);
+    vterm_allocator_free(screen->vt, screen->rowinfos[BUFIDX_PRIMARY]);
+    if(screen->buffers[BUFIDX_ALTSCREEN]) {
+      vterm_allocator_free(screen->vt, screen->buffers[BUFIDX_ALTSCREEN]);
+      vterm_allocator_free(screen->vt, screen->rowinfos[BUFIDX_ALTSCREEN]);
+    }
 
-  vterm_allocator_free(screen->vt, screen->sb_buffer);
+    vterm_allocator_free(screen->vt, screen->sb_buffer);
+  }
+
+  if(screen->search)
+    vterm_search_index_free(screen->search);
+  if(screen->matcher)
+    vterm_matcher_free(screen->matcher);
+  if(screen->snapshots)
+    vterm_snapshots_free(screen->snapshots);
+  if(screen->shm)
+    vterm_shm_export_free(screen->shm);
+  if(screen->sb)
+    vterm_scrollback_free(screen->sb);
+
+  if(screen->links) {
+    for(int idx = 1; idx < screen->links_len; idx++)
+      if(screen->links[idx].uri)
+        vterm_allocator_free(screen->vt, screen->links[idx].uri);
+    vterm_allocator_free(screen->vt, screen->links);
+    vterm_allocator_free(screen->vt, screen->links_index);
+  }
 
   vterm_allocator_free(screen->vt, screen);
 }
 
+INTERNAL void vterm_screen_add_memory_usage(const VTermScreen *screen, VTermMemoryUsage *usage)
+{
+  size_t buffer_size = (sizeof(ScreenCell) * screen->cols_capacity + sizeof(ScreenRow)) * screen->rows_capacity;
+
+  usage->core += sizeof(VTermScreen);
+
+  if(screen->packed)
+    usage->screen += screen->packed_len;
+  else {
+    usage->screen += buffer_size + sizeof(VTermScreenCell) * screen->cols_capacity;
+    if(screen->buffers[BUFIDX_ALTSCREEN])
+      usage->altscreen += buffer_size;
+  }
+
+  if(screen->sb)
+    usage->scrollback += vterm_scrollback_memory_usage(screen->sb);
+  if(screen->search)
+    usage->scrollback += vterm_search_index_memory_usage(screen->search);
+
+  if(screen->links) {
+    usage->interned += (sizeof(ScreenHyperlink) + 2 * sizeof(uint16_t)) * screen->links_size;
+    for(int idx = 1; idx < screen->links_len; idx++) {
+      const ScreenHyperlink *link = &screen->links[idx];
+      if(link->uri)
+        usage->interned += strlen(link->uri) + 1 + (link->id ? strlen(link->id) + 1 : 0);
+    }
+  }
+
+  if(screen->matcher)
+    usage->extras += vterm_matcher_memory_usage(screen->matcher);
+  if(screen->snapshots)
+    usage->extras += vterm_snapshots_memory_usage(screen->snapshots);
+  if(screen->shm)
+    usage->extras += vterm_shm_export_memory_usage(screen->shm);
+}
+
 void vterm_screen_reset(VTermScreen *screen, int hard)
 {
   screen->damaged.start_row = -1;
@@ -711,6 +1579,8 @@ static size_t _get_chars(const VTermScreen *screen, const int utf8, void *buffer
   size_t outpos = 0;
   int padding = 0;
 
+  ensure_awake(screen);
+
 #define PUT(c)                                             \
   if(utf8) {                                               \
     size_t thislen = utf8_seqlen(c);                       \
@@ -727,8 +1597,14 @@ static size_t _get_chars(const VTermScreen *screen, const int utf8, void *buffer
   }
 
   for(int row = rect.start_row; row < rect.end_row; row++) {
-    for(int col = rect.start_col; col < rect.end_col; col++) {
-      ScreenCell *cell = getcell(screen, row, col);
+    /* Everything past the row's EOL is erased and would only become padding
+     * that is never emitted */
+    int end_col = rect.end_col;
+    if(end_col > screen->rowinfo[row].eol)
+      end_col = screen->rowinfo[row].eol;
+
+    for(int col = rect.start_col; col < end_col; col++) {
+      const ScreenCell *cell = getcell(screen, row, col);
 
       if(cell->chars[0] == 0)
         // Erased cell, might need a space
@@ -769,7 +1645,9 @@ size_t vterm_screen_get_text(const VTermScreen *screen, char *str, size_t len, c
 /* Copy internal to external representation of a screen cell */
 int vterm_screen_get_cell(const VTermScreen *screen, VTermPos pos, VTermScreenCell *cell)
 {
-  ScreenCell *intcell = getcell(screen, pos.row, pos.col);
+  ensure_awake(screen);
+
+  const ScreenCell *intcell = getcell(screen, pos.row, pos.col);
   if(!intcell)
     return 0;
 
@@ -804,13 +1682,93 @@ int vterm_screen_get_cell(const VTermScreen *screen, VTermPos pos, VTermScreenCe
 
 int vterm_screen_is_eol(const VTermScreen *screen, VTermPos pos)
 {
+  ensure_awake(screen);
+
   /* This cell is EOL if this and every cell to the right is black */
-  for(; pos.col < screen->cols; pos.col++) {
-    ScreenCell *cell = getcell(screen, pos.row, pos.col);
-    if(cell->chars[0] != 0)
-      return 0;
+  return pos.col >= screen->rowinfo[pos.row].eol;
+}
+
+/* FNV-1a, taking a 32-bit word at a time rather than a byte */
+static inline uint64_t hash_word(uint64_t hash, uint32_t word)
+{
+  return (hash ^ word) * 1099511628211u;
+}
+
+static uint32_t color_word(const VTermColor *col)
+{
+  if(VTERM_COLOR_IS_RGB(col))
+    return (uint32_t)col->type << 24 | col->rgb.red << 16 | col->rgb.green << 8 | col->rgb.blue;
+  return (uint32_t)col->type << 24 | col->indexed.idx;
+}
+
+static uint64_t hash_row(const VTermScreen *screen, int row)
+{
+  const ScreenRow *rowinfo = &screen->rowinfo[row];
+  uint64_t hash = 14695981039346656037u;
+
+  for(int col = 0; col < screen->cols; col++) {
+    /* A cleared row hashes the same as the cells it stands for */
+    const ScreenCell *cell = rowinfo->cleared ? &rowinfo->blank :
+        &screen->buffer[row * screen->cols_capacity + col];
+
+    /* Behind a wide character, anything past the -1 is left over */
+    for(int i = 0; i < VTERM_MAX_CHARS_PER_CELL; i++) {
+      hash = hash_word(hash, cell->chars[i]);
+      if(!cell->chars[i] || cell->chars[i] == (uint32_t)-1)
+        break;
+    }
+
+    const ScreenPen *pen = &cell->pen;
+    hash = hash_word(hash,
+        pen->bold | pen->underline << 1 | pen->italic << 3 | pen->blink << 4 |
+        pen->reverse << 5 | pen->strike << 6 | pen->font << 7 |
+        pen->dwl << 11 | pen->dhl << 12 | (uint32_t)pen->hyperlink << 16);
+    hash = hash_word(hash, color_word(&pen->fg));
+    hash = hash_word(hash, color_word(&pen->bg));
+  }
+
+  return hash;
+}
+
+uint64_t vterm_screen_get_row_hash(const VTermScreen *screen, int row)
+{
+  ensure_awake(screen);
+
+  if(row < 0 || row >= screen->rows)
+    return 0;
+
+  ScreenRow *rowinfo = &screen->rowinfo[row];
+  if(!rowinfo->hashed) {
+    rowinfo->hash = hash_row(screen, row);
+    rowinfo->hashed = true;
   }
 
+  /* Kept out of the cached hash, which then needn't change with it */
+  if(screen->global_reverse)
+    return hash_word(rowinfo->hash, 1);
+  return rowinfo->hash;
+}
+
+int vterm_screen_get_hyperlink(const VTermScreen *screen, VTermPos pos, const char **uri, const char **id)
+{
+  ensure_awake(screen);
+
+  const ScreenCell *cell = getcell(screen, pos.row, pos.col);
+  if(!cell)
+    return 0;
+
+  /* The right half of a wide character belongs to its left */
+  if(cell->chars[0] == (uint32_t)-1 && pos.col > 0)
+    cell--;
+
+  if(!cell->pen.hyperlink)
+    return 0;
+
+  const ScreenHyperlink *link = &screen->links[cell->pen.hyperlink];
+  *uri = link->uri;
+  if(id)
+    *id = link->id;
+
   return 1;
 }
 
@@ -827,14 +1785,127 @@ VTermScreen *vterm_obtain_screen(VTerm *vt)
 
 void vterm_screen_enable_altscreen(VTermScreen *screen, int altscreen)
 {
-  if(!screen->buffers[BUFIDX_ALTSCREEN] && altscreen) {
-    int rows, cols;
-    vterm_get_size(screen->vt, &rows, &cols);
+  /* The buffer itself waits until the altscreen is first entered */
+  screen->altscreen_enabled = altscreen;
+}
+
+void vterm_screen_set_scrollback(VTermScreen *screen, size_t max_lines)
+{
+  if(!max_lines) {
+    vterm_screen_enable_search_index(screen, 0);
+    if(screen->sb)
+      vterm_scrollback_free(screen->sb);
+    screen->sb = NULL;
+  }
+  else if(!screen->sb)
+    screen->sb = vterm_scrollback_new(screen->vt, max_lines);
+  else
+    vterm_scrollback_set_max_lines(screen->sb, max_lines);
+}
+
+void vterm_screen_set_scrollback_compression(VTermScreen *screen, size_t hot_lines, size_t block_lines)
+{
+  if(screen->sb)
+    vterm_scrollback_set_compression(screen->sb, hot_lines, block_lines);
+}
+
+int vterm_screen_set_scrollback_file(VTermScreen *screen, const char *path)
+{
+  return screen->sb ? vterm_scrollback_set_spill(screen->sb, path) : 0;
+}
+
+size_t vterm_screen_get_scrollback_count(const VTermScreen *screen)
+{
+  return screen->sb ? vterm_scrollback_count(screen->sb) : 0;
+}
+
+int vterm_screen_get_scrollback_line(const VTermScreen *screen, size_t index, int cols, VTermScreenCell *cells, VTermLineInfo *info)
+{
+  if(!screen->sb)
+    return 0;
+
+  return vterm_scrollback_get_line(screen->sb, index, cols, cells, info);
+}
+
+void vterm_screen_enable_search_index(VTermScreen *screen, int enabled)
+{
+  if(enabled && !screen->search && screen->sb)
+    screen->search = vterm_search_index_new(screen->vt, screen->sb);
+  else if(!enabled && screen->search) {
+    vterm_search_index_free(screen->search);
+    screen->search = NULL;
+  }
+}
+
+int vterm_screen_search(VTermScreen *screen, const char *query, size_t len, VTermSearchFlags flags,
+    VTermPos from, VTermSearchHit hits[], int max_hits)
+{
+  return vterm_search(screen->vt, screen->search, screen->sb, screen, query, len, flags, from, hits, max_hits);
+}
+
+void vterm_screen_enable_matcher(VTermScreen *screen, VTermMatchKind kinds)
+{
+  if(screen->matcher) {
+    vterm_matcher_free(screen->matcher);
+    screen->matcher = NULL;
+  }
+
+  if(kinds)
+    screen->matcher = vterm_matcher_new(screen->vt, kinds, screen->rows);
+}
+
+int vterm_screen_get_matches(VTermScreen *screen, int row, VTermMatch matches[], int max_matches)
+{
+  if(!screen->matcher)
+    return 0;
+
+  return vterm_matcher_get(screen->matcher, screen, row, matches, max_matches);
+}
 
-    screen->buffers[BUFIDX_ALTSCREEN] = alloc_buffer(screen, rows, cols);
+void vterm_screen_enable_snapshots(VTermScreen *screen, int enabled)
+{
+  if(enabled && !screen->snapshots)
+    screen->snapshots = vterm_snapshots_new(screen->vt, screen, screen->rows, screen->cols);
+  else if(!enabled && screen->snapshots) {
+    vterm_snapshots_free(screen->snapshots);
+    screen->snapshots = NULL;
   }
 }
 
+void vterm_screen_publish_snapshot(VTermScreen *screen)
+{
+  if(screen->snapshots)
+    vterm_snapshots_publish(screen->snapshots);
+}
+
+const VTermScreenSnapshot *vterm_screen_acquire_snapshot(VTermScreen *screen)
+{
+  if(!screen->snapshots)
+    return NULL;
+
+  return vterm_snapshots_acquire(screen->snapshots);
+}
+
+int vterm_screen_export_shm(VTermScreen *screen, const char *name)
+{
+  if(screen->shm) {
+    vterm_shm_export_free(screen->shm);
+    screen->shm = NULL;
+  }
+
+  if(!name)
+    return 1;
+
+  screen->shm = vterm_shm_export_new(screen->vt, screen, name, screen->rows, screen->cols);
+  return screen->shm != NULL;
+}
+
+void vterm_screen_update_shm(VTermScreen *screen)
+{
+  if(screen->shm)
+    vterm_shm_export_update(screen->shm);
+}
+
 void vterm_screen_set_callbacks(VTermScreen *screen, const VTermScreenCallbacks *callbacks, void *user)
 {
   screen->callbacks = callbacks;
@@ -857,6 +1928,22 @@ void *vterm_screen_get_unrecognised_fbdata(VTermScreen *screen)
 }
 
 void vterm_screen_flush_damage(VTermScreen *screen)
+{
+  /* Its damage goes out along with the rest */
+  vterm_apply_pending_resize(screen->vt);
+
+  /* Nothing of a synchronized update goes out until it ends */
+  if(!screen->sync_output)
+    flush_damage(screen);
+}
+
+void vterm_screen_force_flush_damage(VTermScreen *screen)
+{
+  vterm_apply_pending_resize(screen->vt);
+  flush_damage(screen);
+}
+
+static void flush_damage(VTermScreen *screen)
 {
   if(screen->pending_scrollrect.start_row != -1) {
     vterm_scroll_rect(screen->pending_scrollrect, screen->pending_scroll_downward, screen->pending_scroll_rightward,
@@ -871,6 +1958,8 @@ void vterm_screen_flush_damage(VTermScreen *screen)
 
     screen->damaged.start_row = -1;
   }
+
+  screen->sync_cells = 0;
 }
 
 void vterm_screen_set_damage_merge(VTermScreen *screen, VTermDamageSize size)
@@ -879,7 +1968,13 @@ void vterm_screen_set_damage_merge(VTermScreen *screen, VTermDamageSize size)
   screen->damage_merge = size;
 }
 
-static int attrs_differ(VTermAttrMask attrs, ScreenCell *a, ScreenCell *b)
+void vterm_screen_set_sync_budget(VTermScreen *screen, int cells)
+{
+  screen->sync_budget = cells;
+  screen->sync_budget_set = true;
+}
+
+static int attrs_differ(VTermAttrMask attrs, const ScreenCell *a, const ScreenCell *b)
 {
   if((attrs & VTERM_ATTR_BOLD_MASK)       && (a->pen.bold != b->pen.bold))
     return 1;
@@ -899,13 +1994,17 @@ static int attrs_differ(VTermAttrMask attrs, ScreenCell *a, ScreenCell *b)
     return 1;
   if((attrs & VTERM_ATTR_BACKGROUND_MASK) && !vterm_color_is_equal(&a->pen.bg, &b->pen.bg))
     return 1;
+  if((attrs & VTERM_ATTR_HYPERLINK_MASK)  && (a->pen.hyperlink != b->pen.hyperlink))
+    return 1;
 
   return 0;
 }
 
 int vterm_screen_get_attrs_extent(const VTermScreen *screen, VTermRect *extent, VTermPos pos, VTermAttrMask attrs)
 {
-  ScreenCell *target = getcell(screen, pos.row, pos.col);
+  ensure_awake(screen);
+
+  const ScreenCell *target = getcell(screen, pos.row, pos.col);
 
   // TODO: bounds check
   extent->start_row = pos.row;
@@ -0,0 +1,1046 @@
+#include "vterm_internal.h"
+
+#include <string.h>
+
+#include "utf8.h"
+
+/* The built-in store for lines scrolled off the top of the primary screen.
+ *
+ * Each line is serialized into a record, and records are interned by their
+ * hash so that repeated lines share one copy. A blank line serializes to just
+ * its trailing style, so all the blank lines of one style share a single
+ * record and cost nothing beyond their slot in the ring.
+ *
+ * A record holds one UTF-8 codepoint per cell (0 for an empty cell), with
+ *   SB_STYLE + SB_STYLE_LEN bytes   the style of the cells that follow
+ *   SB_OP SB_OP_WIDE                the next cell is double width
+ *   SB_OP SB_OP_COMBINE cp          cp joins the previous cell
+ * Neither marker byte can occur in UTF-8. Trailing empty cells of the line's
+ * final style are left out; that style is in effect at the end of the record
+ * and pads the line out to any width.
+ *
+ * Only the most recent hot_lines lines are kept like that. Older ones are
+ * frozen block_lines at a time into SBBlocks: their records are concatenated,
+ * each after a varint of (length << 1 | continuation), and compressed. A few
+ * recently used blocks are kept decompressed.
+ *
+ * Alternatively, frozen lines are appended in the same raw form to a spill
+ * file and read back through a mapping of it; see src/spill.c.
+ */
+#define SB_STYLE      0xff
+#define SB_OP         0xfe
+#define SB_OP_WIDE    1
+#define SB_OP_COMBINE 2
+
+#define SB_STYLE_LEN 10
+
+/* Longest serialization of one cell: a style, a width marker, and each of its
+ * chars as a 6-byte sequence after a 2-byte marker */
+#define SB_CELL_MAX (1 + SB_STYLE_LEN + 2 + VTERM_MAX_CHARS_PER_CELL * (2 + 6))
+
+typedef struct SBRecord SBRecord;
+struct SBRecord {
+  SBRecord *next; /* in the same hash bucket */
+  uint32_t  hash;
+  uint32_t  refcount;
+  size_t    len;
+  unsigned char data[];
+};
+
+typedef struct {
+  SBRecord *rec;
+  bool continuation;
+} SBLine;
+
+typedef struct {
+  uint64_t first;  /* number of the first line; numbers only ever go up */
+  size_t   nlines;
+  uint64_t serial; /* identifies the block in the cache */
+
+  unsigned char *data;
+  size_t         len;
+  size_t         rawlen;
+} SBBlock;
+
+#define SB_CACHE_BLOCKS 4
+
+/* Spilled lines are indexed by a 64-bit offset for every SPILL_GROUP lines
+ * and a 32-bit one relative to that for each */
+#define SPILL_GROUP 256
+
+/* Dropped lines' space in the spill file is given back once there is at
+ * least this much of it, and more than there is of live lines */
+#define SPILL_COMPACT_MIN (16 << 20)
+
+#define SB_DEFAULT_HOT_LINES   1024
+#define SB_DEFAULT_BLOCK_LINES 64
+
+struct VTermScrollback {
+  VTerm *vt;
+
+  size_t max_lines;
+  int width; /* widest line pushed */
+
+  /* Ring of hot lines; the oldest is lines[head] */
+  SBLine *lines;
+  size_t  lines_size;
+  size_t  head;
+  size_t  count;
+
+  size_t hot_lines;
+  size_t block_lines; /* 0 => never freeze */
+
+  /* Ring of frozen blocks; the oldest is blocks[block_head]. The lines
+   * cold_first to cold_end-1 are present, cold_first possibly being part
+   * way into the oldest block */
+  SBBlock *blocks;
+  size_t   blocks_size;
+  size_t   block_head;
+  size_t   block_count;
+  uint64_t cold_first, cold_end;
+  uint64_t next_serial;
+
+  struct {
+    uint64_t serial; /* 0 => unused */
+    unsigned int used;
+    unsigned char *data;
+    size_t         size;
+  } cache[SB_CACHE_BLOCKS];
+  unsigned int cache_clock;
+
+  uint32_t *lz_table;
+
+  /* If set, frozen lines go here instead of into blocks. The lines from
+   * spill_first on are indexed */
+  VTermSpillFile *spill;
+  uint64_t  spill_first;
+  uint64_t *spill_base;
+  uint32_t *spill_rel;
+  size_t    spill_size; /* in lines; a multiple of SPILL_GROUP */
+
+  /* Records by hash; buckets_size is a power of 2 */
+  SBRecord **buckets;
+  size_t     buckets_size;
+  size_t     records;
+
+  unsigned char *scratch;
+  size_t         scratch_len;
+};
+
+static uint32_t hash_bytes(const unsigned char *data, size_t len)
+{
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < len; i++)
+    hash = (hash ^ data[i]) * 16777619u;
+  return hash;
+}
+
+static void put_color(unsigned char *p, const VTermColor *col)
+{
+  p[0] = col->type;
+  if(VTERM_COLOR_IS_INDEXED(col)) {
+    p[1] = col->indexed.idx;
+    p[2] = p[3] = 0;
+  }
+  else {
+    p[1] = col->rgb.red;
+    p[2] = col->rgb.green;
+    p[3] = col->rgb.blue;
+  }
+}
+
+static void get_color(const unsigned char *p, VTermColor *col)
+{
+  col->type = p[0];
+  if(VTERM_COLOR_IS_INDEXED(col))
+    col->indexed.idx = p[1];
+  else {
+    col->rgb.red   = p[1];
+    col->rgb.green = p[2];
+    col->rgb.blue  = p[3];
+  }
+}
+
+static void put_style(unsigned char *p, const VTermScreenCell *cell)
+{
+  unsigned int attrs = cell->attrs.bold           |
+                       cell->attrs.underline << 1 |
+                       cell->attrs.italic    << 3 |
+                       cell->attrs.blink     << 4 |
+                       cell->attrs.reverse   << 5 |
+                       cell->attrs.strike    << 6 |
+                       cell->attrs.font      << 7 |
+                       cell->attrs.dwl       << 11 |
+                       cell->attrs.dhl       << 12;
+  p[0] = attrs & 0xff;
+  p[1] = attrs >> 8;
+  put_color(p + 2, &cell->fg);
+  put_color(p + 6, &cell->bg);
+}
+
+static void get_style(const unsigned char *p, VTermScreenCell *cell)
+{
+  unsigned int attrs = p[0] | p[1] << 8;
+  cell->attrs.bold      = attrs       & 0x01;
+  cell->attrs.underline = attrs >> 1  & 0x03;
+  cell->attrs.italic    = attrs >> 3  & 0x01;
+  cell->attrs.blink     = attrs >> 4  & 0x01;
+  cell->attrs.reverse   = attrs >> 5  & 0x01;
+  cell->attrs.strike    = attrs >> 6  & 0x01;
+  cell->attrs.font      = attrs >> 7  & 0x0f;
+  cell->attrs.dwl       = attrs >> 11 & 0x01;
+  cell->attrs.dhl       = attrs >> 12 & 0x03;
+  get_color(p + 2, &cell->fg);
+  get_color(p + 6, &cell->bg);
+}
+
+static int put_char(unsigned char *p, uint32_t codepoint)
+{
+  if(codepoint > 0x7fffffff)
+    codepoint = 0xfffd;
+  return fill_utf8(codepoint, (char *)p);
+}
+
+static uint32_t get_char(const unsigned char **pp)
+{
+  const unsigned char *p = *pp;
+  uint32_t codepoint;
+  int nbytes;
+
+  if(p[0] < 0x80)      { codepoint = p[0];        nbytes = 1; }
+  else if(p[0] < 0xe0) { codepoint = p[0] & 0x1f; nbytes = 2; }
+  else if(p[0] < 0xf0) { codepoint = p[0] & 0x0f; nbytes = 3; }
+  else if(p[0] < 0xf8) { codepoint = p[0] & 0x07; nbytes = 4; }
+  else if(p[0] < 0xfc) { codepoint = p[0] & 0x03; nbytes = 5; }
+  else                 { codepoint = p[0] & 0x01; nbytes = 6; }
+
+  for(int i = 1; i < nbytes; i++)
+    codepoint = codepoint << 6 | (p[i] & 0x3f);
+
+  *pp = p + nbytes;
+  return codepoint;
+}
+
+/* Serializes a line into sb->scratch, returning its length */
+static size_t serialize_line(VTermScrollback *sb, int cols, const VTermScreenCell *cells)
+{
+  size_t needed = (size_t)cols * SB_CELL_MAX + 1 + SB_STYLE_LEN;
+  if(sb->scratch_len < needed) {
+    if(sb->scratch)
+      vterm_allocator_free(sb->vt, sb->scratch);
+    sb->scratch = vterm_allocator_malloc(sb->vt, needed);
+    sb->scratch_len = needed;
+  }
+
+  unsigned char *p = sb->scratch;
+
+  unsigned char trail[SB_STYLE_LEN], style[SB_STYLE_LEN], this[SB_STYLE_LEN];
+  bool have_style = false;
+
+  if(!cols)
+    memset(trail, 0, SB_STYLE_LEN);
+  else
+    put_style(trail, &cells[cols-1]);
+
+  int end = cols;
+  while(end > 0 && !cells[end-1].chars[0]) {
+    put_style(this, &cells[end-1]);
+    if(memcmp(this, trail, SB_STYLE_LEN) != 0)
+      break;
+    end--;
+  }
+
+  for(int col = 0; col < end; ) {
+    const VTermScreenCell *cell = &cells[col];
+
+    put_style(this, cell);
+    if(!have_style || memcmp(this, style, SB_STYLE_LEN) != 0) {
+      *p++ = SB_STYLE;
+      memcpy(p, this, SB_STYLE_LEN);
+      p += SB_STYLE_LEN;
+      memcpy(style, this, SB_STYLE_LEN);
+      have_style = true;
+    }
+
+    if(cell->width == 2) {
+      *p++ = SB_OP;
+      *p++ = SB_OP_WIDE;
+    }
+
+    p += put_char(p, cell->chars[0]);
+    for(int i = 1; i < VTERM_MAX_CHARS_PER_CELL && cell->chars[0] && cell->chars[i]; i++) {
+      *p++ = SB_OP;
+      *p++ = SB_OP_COMBINE;
+      p += put_char(p, cell->chars[i]);
+    }
+
+    col += cell->width > 1 ? cell->width : 1;
+  }
+
+  if(!have_style || memcmp(style, trail, SB_STYLE_LEN) != 0) {
+    *p++ = SB_STYLE;
+    memcpy(p, trail, SB_STYLE_LEN);
+    p += SB_STYLE_LEN;
+  }
+
+  return p - sb->scratch;
+}
+
+static void deserialize_line(const unsigned char *data, size_t len, int cols, VTermScreenCell *cells)
+{
+  VTermScreenCell pen = { .width = 1 };
+  const unsigned char *p = data, *end = data + len;
+
+  int col = 0;
+  int last = -1; /* the cell a combining char would join */
+  int width = 1;
+  int clipped = -1; /* where the line stopped fitting */
+
+  while(p < end) {
+    if(p[0] == SB_STYLE) {
+      get_style(p + 1, &pen);
+      p += 1 + SB_STYLE_LEN;
+      continue;
+    }
+    if(p[0] == SB_OP) {
+      unsigned char op = p[1];
+      p += 2;
+      if(op == SB_OP_WIDE)
+        width = 2;
+      else if(op == SB_OP_COMBINE) {
+        uint32_t codepoint = get_char(&p);
+        if(last < 0)
+          continue;
+        int i;
+        for(i = 0; i < VTERM_MAX_CHARS_PER_CELL && cells[last].chars[i]; i++)
+          ;
+        if(i < VTERM_MAX_CHARS_PER_CELL)
+          cells[last].chars[i] = codepoint;
+        if(i + 1 < VTERM_MAX_CHARS_PER_CELL)
+          cells[last].chars[i + 1] = 0;
+      }
+      continue;
+    }
+
+    uint32_t codepoint = get_char(&p);
+
+    if(col + width > cols) {
+      /* doesn't fit; the rest of the line is clipped */
+      if(clipped < 0)
+        clipped = col;
+      col = cols;
+      last = -1;
+      width = 1;
+      continue;
+    }
+
+    VTermScreenCell *cell = &cells[col];
+    *cell = pen;
+    cell->chars[0] = codepoint;
+    cell->chars[1] = 0;
+    cell->width = width;
+
+    if(width == 2) {
+      cells[col + 1] = pen;
+      cells[col + 1].chars[0] = (uint32_t)-1;
+      cells[col + 1].chars[1] = 0;
+    }
+
+    last = codepoint ? col : -1;
+    col += width;
+    width = 1;
+  }
+
+  for(col = clipped >= 0 ? clipped : col; col < cols; col++) {
+    cells[col] = pen;
+    cells[col].chars[0] = 0;
+  }
+}
+
+static SBRecord *intern_record(VTermScrollback *sb, const unsigned char *data, size_t len)
+{
+  uint32_t hash = hash_bytes(data, len);
+
+  for(SBRecord *rec = sb->buckets[hash & (sb->buckets_size - 1)]; rec; rec = rec->next)
+    if(rec->hash == hash && rec->len == len && memcmp(rec->data, data, len) == 0) {
+      rec->refcount++;
+      return rec;
+    }
+
+  if(sb->records >= sb->buckets_size) {
+    size_t new_size = sb->buckets_size * 2;
+    SBRecord **new_buckets = vterm_allocator_malloc(sb->vt, sizeof(SBRecord *) * new_size);
+
+    for(size_t i = 0; i < sb->buckets_size; i++)
+      for(SBRecord *rec = sb->buckets[i], *next; rec; rec = next) {
+        next = rec->next;
+        rec->next = new_buckets[rec->hash & (new_size - 1)];
+        new_buckets[rec->hash & (new_size - 1)] = rec;
+      }
+
+    vterm_allocator_free(sb->vt, sb->buckets);
+    sb->buckets = new_buckets;
+    sb->buckets_size = new_size;
+  }
+
+  SBRecord *rec = vterm_allocator_malloc(sb->vt, sizeof(SBRecord) + len);
+  rec->hash = hash;
+  rec->refcount = 1;
+  rec->len = len;
+  memcpy(rec->data, data, len);
+
+  SBRecord **bucket = &sb->buckets[hash & (sb->buckets_size - 1)];
+  rec->next = *bucket;
+  *bucket = rec;
+  sb->records++;
+
+  return rec;
+}
+
+static void release_record(VTermScrollback *sb, SBRecord *rec)
+{
+  if(--rec->refcount)
+    return;
+
+  SBRecord **linkp = &sb->buckets[rec->hash & (sb->buckets_size - 1)];
+  while(*linkp != rec)
+    linkp = &(*linkp)->next;
+  *linkp = rec->next;
+
+  vterm_allocator_free(sb->vt, rec);
+  sb->records--;
+}
+
+static SBLine *sb_line(const VTermScrollback *sb, size_t index)
+{
+  /* index 0 is the most recently pushed */
+  return &sb->lines[(sb->head + sb->count - 1 - index) % sb->lines_size];
+}
+
+/* Reallocates the ring of hot lines to hold new_size */
+static void resize_ring(VTermScrollback *sb, size_t new_size)
+{
+  SBLine *new_lines = vterm_allocator_malloc(sb->vt, sizeof(SBLine) * new_size);
+  for(size_t i = 0; i < sb->count; i++)
+    new_lines[i] = sb->lines[(sb->head + i) % sb->lines_size];
+
+  if(sb->lines)
+    vterm_allocator_free(sb->vt, sb->lines);
+  sb->lines = new_lines;
+  sb->lines_size = new_size;
+  sb->head = 0;
+}
+
+static SBBlock *sb_block(const VTermScrollback *sb, size_t i)
+{
+  /* i 0 is the oldest */
+  return &sb->blocks[(sb->block_head + i) % sb->blocks_size];
+}
+
+static size_t put_varint(unsigned char *p, size_t v)
+{
+  size_t n = 0;
+  while(v >= 0x80) {
+    p[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+static size_t get_varint(const unsigned char **pp)
+{
+  const unsigned char *p = *pp;
+  size_t v = 0;
+  int shift = 0;
+  do {
+    v |= (size_t)(*p & 0x7f) << shift;
+    shift += 7;
+  } while(*p++ & 0x80);
+
+  *pp = p;
+  return v;
+}
+
+static void drop_block(VTermScrollback *sb, SBBlock *block)
+{
+  for(int i = 0; i < SB_CACHE_BLOCKS; i++)
+    if(sb->cache[i].serial == block->serial) {
+      sb->cache[i].serial = 0;
+      sb->cache[i].used = 0;
+    }
+
+  vterm_allocator_free(sb->vt, block->data);
+}
+
+static void add_block(VTermScrollback *sb, const unsigned char *raw, size_t rawlen, size_t n)
+{
+  if(!sb->lz_table)
+    sb->lz_table = vterm_allocator_malloc(sb->vt, sizeof(uint32_t) << LZ_HASH_BITS);
+
+  unsigned char *compressed = vterm_allocator_malloc(sb->vt, LZ_COMPRESS_BOUND(rawlen));
+  size_t len = vterm_lz_compress(raw, rawlen, compressed, sb->lz_table);
+
+  if(sb->block_count == sb->blocks_size) {
+    size_t new_size = sb->blocks_size ? sb->blocks_size * 2 : 16;
+    SBBlock *new_blocks = vterm_allocator_malloc(sb->vt, sizeof(SBBlock) * new_size);
+    for(size_t i = 0; i < sb->block_count; i++)
+      new_blocks[i] = *sb_block(sb, i);
+    if(sb->blocks)
+      vterm_allocator_free(sb->vt, sb->blocks);
+    sb->blocks = new_blocks;
+    sb->blocks_size = new_size;
+    sb->block_head = 0;
+  }
+
+  SBBlock *block = sb_block(sb, sb->block_count++);
+  *block = (SBBlock){
+    .first  = sb->cold_end,
+    .nlines = n,
+    .serial = ++sb->next_serial,
+    .data   = vterm_allocator_malloc(sb->vt, len),
+    .len    = len,
+    .rawlen = rawlen,
+  };
+  memcpy(block->data, compressed, len);
+  sb->cold_end += n;
+
+  vterm_allocator_free(sb->vt, compressed);
+}
+
+static uint64_t spill_offset(const VTermScrollback *sb, uint64_t lineno)
+{
+  size_t i = lineno - sb->spill_first;
+  return sb->spill_base[i / SPILL_GROUP] + sb->spill_rel[i];
+}
+
+/* Forgets the index of dropped lines, in whole groups */
+static size_t spill_index_trim(VTermScrollback *sb, size_t new_size)
+{
+  size_t dead = (sb->cold_first - sb->spill_first) / SPILL_GROUP * SPILL_GROUP;
+  size_t live = sb->cold_end - sb->spill_first - dead;
+  size_t groups = (live + SPILL_GROUP - 1) / SPILL_GROUP;
+
+  if(new_size != sb->spill_size) {
+    uint32_t *rel = vterm_allocator_malloc(sb->vt, sizeof(uint32_t) * new_size);
+    uint64_t *base = vterm_allocator_malloc(sb->vt, sizeof(uint64_t) * (new_size / SPILL_GROUP));
+    if(live) {
+      memcpy(rel, sb->spill_rel + dead, sizeof(uint32_t) * live);
+      memcpy(base, sb->spill_base + dead / SPILL_GROUP, sizeof(uint64_t) * groups);
+    }
+    if(sb->spill_rel) {
+      vterm_allocator_free(sb->vt, sb->spill_rel);
+      vterm_allocator_free(sb->vt, sb->spill_base);
+    }
+    sb->spill_rel = rel;
+    sb->spill_base = base;
+    sb->spill_size = new_size;
+  }
+  else if(dead) {
+    memmove(sb->spill_rel, sb->spill_rel + dead, sizeof(uint32_t) * live);
+    memmove(sb->spill_base, sb->spill_base + dead / SPILL_GROUP, sizeof(uint64_t) * groups);
+  }
+
+  sb->spill_first += dead;
+  return groups;
+}
+
+/* Appends n lines in raw form to the spill file, indexing them */
+static int spill_lines(VTermScrollback *sb, const unsigned char *raw, size_t rawlen, size_t n)
+{
+  uint64_t offset = vterm_spill_length(sb->spill);
+  if(!vterm_spill_append(sb->spill, raw, rawlen))
+    return 0;
+
+  size_t needed = sb->cold_end + n - sb->spill_first;
+  if(needed > sb->spill_size) {
+    size_t live = needed - (sb->cold_first - sb->spill_first) / SPILL_GROUP * SPILL_GROUP;
+    size_t new_size = (live * 2 + SPILL_GROUP - 1) / SPILL_GROUP * SPILL_GROUP;
+    spill_index_trim(sb, live > sb->spill_size / 2 ? new_size : sb->spill_size);
+  }
+
+  for(size_t j = 0; j < n; j++) {
+    size_t i = sb->cold_end - sb->spill_first;
+    if(i % SPILL_GROUP == 0)
+      sb->spill_base[i / SPILL_GROUP] = offset;
+    sb->spill_rel[i] = offset - sb->spill_base[i / SPILL_GROUP];
+    sb->cold_end++;
+
+    const unsigned char *p = raw;
+    size_t v = get_varint(&p);
+    p += v >> 1;
+    offset += p - raw;
+    raw = p;
+  }
+
+  return 1;
+}
+
+/* Gives back the spill file's space before the first live group */
+static void spill_compact(VTermScrollback *sb)
+{
+  size_t dead = (sb->cold_first - sb->spill_first) / SPILL_GROUP * SPILL_GROUP;
+  uint64_t offset = sb->spill_base[dead / SPILL_GROUP];
+  if(offset < SPILL_COMPACT_MIN || !vterm_spill_compact(sb->spill, offset))
+    return;
+
+  size_t groups = spill_index_trim(sb, sb->spill_size);
+  for(size_t g = 0; g < groups; g++)
+    sb->spill_base[g] -= offset;
+}
+
+/* Moves the n oldest hot lines into a new block or the spill file. Leaves
+ * them if the spill file can't be written */
+static void freeze_lines(VTermScrollback *sb, size_t n)
+{
+  size_t rawlen = 0;
+  for(size_t i = 0; i < n; i++)
+    rawlen += sb->lines[(sb->head + i) % sb->lines_size].rec->len + 10;
+
+  unsigned char *raw = vterm_allocator_malloc(sb->vt, rawlen);
+  unsigned char *p = raw;
+  for(size_t i = 0; i < n; i++) {
+    SBLine *line = &sb->lines[(sb->head + i) % sb->lines_size];
+    p += put_varint(p, line->rec->len << 1 | line->continuation);
+    memcpy(p, line->rec->data, line->rec->len);
+    p += line->rec->len;
+  }
+  rawlen = p - raw;
+
+  if(!sb->spill)
+    add_block(sb, raw, rawlen, n);
+  else if(!spill_lines(sb, raw, rawlen, n)) {
+    vterm_allocator_free(sb->vt, raw);
+    return;
+  }
+
+  for(size_t i = 0; i < n; i++) {
+    release_record(sb, sb->lines[sb->head].rec);
+    sb->head = (sb->head + 1) % sb->lines_size;
+    sb->count--;
+  }
+
+  vterm_allocator_free(sb->vt, raw);
+}
+
+/* Returns the decompressed contents of a block, from the cache if possible */
+static const unsigned char *thaw_block(VTermScrollback *sb, const SBBlock *block)
+{
+  int victim = 0;
+  for(int i = 0; i < SB_CACHE_BLOCKS; i++) {
+    if(sb->cache[i].serial == block->serial) {
+      sb->cache[i].used = ++sb->cache_clock;
+      return sb->cache[i].data;
+    }
+    if(sb->cache[i].used < sb->cache[victim].used)
+      victim = i;
+  }
+
+  if(sb->cache[victim].size < block->rawlen) {
+    if(sb->cache[victim].data)
+      vterm_allocator_free(sb->vt, sb->cache[victim].data);
+    sb->cache[victim].data = vterm_allocator_malloc(sb->vt, block->rawlen);
+    sb->cache[victim].size = block->rawlen;
+  }
+
+  vterm_lz_decompress(block->data, block->len, sb->cache[victim].data, block->rawlen);
+  sb->cache[victim].serial = block->serial;
+  sb->cache[victim].used = ++sb->cache_clock;
+
+  return sb->cache[victim].data;
+}
+
+/* Finds the line after skip others in the raw contents of a block */
+static const unsigned char *find_frozen_line(const unsigned char *raw, size_t skip, size_t *len, bool *continuation)
+{
+  for(;;) {
+    size_t v = get_varint(&raw);
+    if(!skip--) {
+      *len = v >> 1;
+      *continuation = v & 1;
+      return raw;
+    }
+    raw += v >> 1;
+  }
+}
+
+static void get_frozen_line(VTermScrollback *sb, uint64_t lineno, int cols, VTermScreenCell *cells, bool *continuation)
+{
+  /* binary search for the block holding lineno */
+  size_t lo = 0, hi = sb->block_count;
+  while(hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if(sb_block(sb, mid)->first <= lineno)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  const SBBlock *block = sb_block(sb, lo);
+
+  size_t len;
+  const unsigned char *data = find_frozen_line(thaw_block(sb, block), lineno - block->first, &len, continuation);
+  deserialize_line(data, len, cols, cells);
+}
+
+/* Moves the newest block back into the (empty) ring of hot lines */
+static void unfreeze_newest(VTermScrollback *sb)
+{
+  SBBlock *block = sb_block(sb, sb->block_count - 1);
+  const unsigned char *raw = thaw_block(sb, block);
+
+  /* Lines before cold_first in this block have already been dropped */
+  size_t skip = sb->cold_first > block->first ? sb->cold_first - block->first : 0;
+
+  if(sb->lines_size < block->nlines - skip)
+    resize_ring(sb, block->nlines - skip);
+
+  for(size_t i = 0; i < block->nlines; i++) {
+    size_t v = get_varint(&raw);
+    if(i >= skip) {
+      sb->lines[(sb->head + sb->count) % sb->lines_size] = (SBLine){
+        .rec          = intern_record(sb, raw, v >> 1),
+        .continuation = v & 1,
+      };
+      sb->count++;
+    }
+    raw += v >> 1;
+  }
+
+  sb->cold_end = block->first + skip;
+  if(sb->cold_first > sb->cold_end)
+    sb->cold_first = sb->cold_end;
+
+  drop_block(sb, block);
+  sb->block_count--;
+}
+
+/* Returns the raw form of a spilled line, or NULL if it can't be mapped */
+static const unsigned char *get_spilled_line(VTermScrollback *sb, uint64_t lineno, size_t *len, bool *continuation)
+{
+  const unsigned char *raw = vterm_spill_map(sb->spill, spill_offset(sb, lineno));
+  if(!raw)
+    return NULL;
+
+  size_t v = get_varint(&raw);
+  *len = v >> 1;
+  *continuation = v & 1;
+  return raw;
+}
+
+static void drop_oldest(VTermScrollback *sb)
+{
+  if(sb->cold_first < sb->cold_end && sb->spill) {
+    sb->cold_first++;
+    if(sb->cold_first == sb->cold_end) {
+      vterm_spill_truncate(sb->spill, 0);
+      sb->spill_first = sb->cold_end;
+    }
+    else if((sb->cold_first - sb->spill_first) % SPILL_GROUP == 0)
+      spill_compact(sb);
+    return;
+  }
+
+  if(sb->cold_first < sb->cold_end) {
+    SBBlock *block = sb_block(sb, 0);
+    sb->cold_first++;
+    if(sb->cold_first == block->first + block->nlines) {
+      drop_block(sb, block);
+      sb->block_head = (sb->block_head + 1) % sb->blocks_size;
+      sb->block_count--;
+    }
+    return;
+  }
+
+  release_record(sb, sb->lines[sb->head].rec);
+  sb->head = (sb->head + 1) % sb->lines_size;
+  sb->count--;
+
+  /* Keep the numbering of the rest */
+  sb->cold_first = ++sb->cold_end;
+  if(sb->spill)
+    sb->spill_first = sb->cold_end;
+}
+
+static size_t total_lines(const VTermScrollback *sb)
+{
+  return sb->count + (sb->cold_end - sb->cold_first);
+}
+
+INTERNAL VTermScrollback *vterm_scrollback_new(VTerm *vt, size_t max_lines)
+{
+  VTermScrollback *sb = vterm_allocator_malloc(vt, sizeof(VTermScrollback));
+
+  sb->vt = vt;
+  sb->max_lines = max_lines;
+
+  sb->hot_lines   = SB_DEFAULT_HOT_LINES;
+  sb->block_lines = SB_DEFAULT_BLOCK_LINES;
+
+  sb->buckets_size = 64;
+  sb->buckets = vterm_allocator_malloc(vt, sizeof(SBRecord *) * sb->buckets_size);
+
+  return sb;
+}
+
+INTERNAL void vterm_scrollback_free(VTermScrollback *sb)
+{
+  vterm_scrollback_clear(sb);
+
+  if(sb->lines)
+    vterm_allocator_free(sb->vt, sb->lines);
+  if(sb->blocks)
+    vterm_allocator_free(sb->vt, sb->blocks);
+  for(int i = 0; i < SB_CACHE_BLOCKS; i++)
+    if(sb->cache[i].data)
+      vterm_allocator_free(sb->vt, sb->cache[i].data);
+  vterm_allocator_free(sb->vt, sb->buckets);
+  if(sb->lz_table)
+    vterm_allocator_free(sb->vt, sb->lz_table);
+  if(sb->spill) {
+    vterm_spill_close(sb->spill);
+    vterm_allocator_free(sb->vt, sb->spill_base);
+    vterm_allocator_free(sb->vt, sb->spill_rel);
+  }
+  if(sb->scratch)
+    vterm_allocator_free(sb->vt, sb->scratch);
+
+  vterm_allocator_free(sb->vt, sb);
+}
+
+/* Frees the scratch space and decompressed blocks, which are made again
+ * when next needed */
+INTERNAL void vterm_scrollback_trim(VTermScrollback *sb)
+{
+  for(int i = 0; i < SB_CACHE_BLOCKS; i++)
+    if(sb->cache[i].data) {
+      vterm_allocator_free(sb->vt, sb->cache[i].data);
+      sb->cache[i].data = NULL;
+      sb->cache[i].size = 0;
+      sb->cache[i].serial = 0;
+      sb->cache[i].used = 0;
+    }
+
+  if(sb->lz_table) {
+    vterm_allocator_free(sb->vt, sb->lz_table);
+    sb->lz_table = NULL;
+  }
+
+  if(sb->scratch) {
+    vterm_allocator_free(sb->vt, sb->scratch);
+    sb->scratch = NULL;
+    sb->scratch_len = 0;
+  }
+}
+
+INTERNAL size_t vterm_scrollback_memory_usage(const VTermScrollback *sb)
+{
+  size_t bytes = sizeof(VTermScrollback) +
+    sizeof(SBLine) * sb->lines_size +
+    sizeof(SBBlock) * sb->blocks_size +
+    (sb->lz_table ? sizeof(uint32_t) << LZ_HASH_BITS : 0) +
+    sizeof(SBRecord *) * sb->buckets_size +
+    sb->scratch_len;
+
+  for(size_t i = 0; i < sb->block_count; i++)
+    bytes += sb_block(sb, i)->len;
+  for(int i = 0; i < SB_CACHE_BLOCKS; i++)
+    bytes += sb->cache[i].size;
+
+  if(sb->spill)
+    bytes += sizeof(uint32_t) * sb->spill_size + sizeof(uint64_t) * (sb->spill_size / SPILL_GROUP);
+
+  /* Each distinct record once, however many lines share it */
+  for(size_t i = 0; i < sb->buckets_size; i++)
+    for(const SBRecord *rec = sb->buckets[i]; rec; rec = rec->next)
+      bytes += sizeof(SBRecord) + rec->len;
+
+  return bytes;
+}
+
+INTERNAL void vterm_scrollback_set_max_lines(VTermScrollback *sb, size_t max_lines)
+{
+  sb->max_lines = max_lines;
+  while(total_lines(sb) > max_lines)
+    drop_oldest(sb);
+
+  if(sb->lines_size > max_lines)
+    resize_ring(sb, max_lines);
+}
+
+INTERNAL void vterm_scrollback_set_compression(VTermScrollback *sb, size_t hot_lines, size_t block_lines)
+{
+  /* Blocks already made stay as they are */
+  sb->hot_lines   = hot_lines;
+  sb->block_lines = block_lines;
+}
+
+INTERNAL int vterm_scrollback_set_spill(VTermScrollback *sb, const char *path)
+{
+  if(sb->spill)
+    return 0;
+
+  sb->spill = vterm_spill_open(sb->vt, path);
+  if(!sb->spill)
+    return 0;
+
+  /* Move the lines already frozen into blocks over to the file */
+  uint64_t cold_end = sb->cold_end;
+  sb->spill_first = sb->cold_end = sb->cold_first;
+
+  for(size_t i = 0; i < sb->block_count; i++) {
+    const SBBlock *block = sb_block(sb, i);
+    const unsigned char *raw = thaw_block(sb, block), *p = raw;
+
+    size_t skip = sb->cold_first > block->first ? sb->cold_first - block->first : 0;
+    for(size_t j = 0; j < skip; j++)
+      p += get_varint(&p) >> 1;
+
+    if(!spill_lines(sb, p, block->rawlen - (p - raw), block->nlines - skip)) {
+      vterm_spill_close(sb->spill);
+      sb->spill = NULL;
+      if(sb->spill_rel) {
+        vterm_allocator_free(sb->vt, sb->spill_base);
+        vterm_allocator_free(sb->vt, sb->spill_rel);
+        sb->spill_base = NULL;
+        sb->spill_rel = NULL;
+      }
+      sb->spill_size = 0;
+      sb->cold_end = cold_end;
+      return 0;
+    }
+  }
+
+  for(size_t i = 0; i < sb->block_count; i++)
+    drop_block(sb, sb_block(sb, i));
+  sb->block_head = 0;
+  sb->block_count = 0;
+
+  return 1;
+}
+
+INTERNAL void vterm_scrollback_clear(VTermScrollback *sb)
+{
+  for(size_t i = 0; i < sb->count; i++)
+    release_record(sb, sb->lines[(sb->head + i) % sb->lines_size].rec);
+
+  sb->head = 0;
+  sb->cold_end += sb->count; /* numbers are never reused */
+  sb->count = 0;
+
+  for(size_t i = 0; i < sb->block_count; i++)
+    drop_block(sb, sb_block(sb, i));
+
+  sb->block_head = 0;
+  sb->block_count = 0;
+  sb->cold_first = sb->cold_end;
+
+  if(sb->spill) {
+    vterm_spill_truncate(sb->spill, 0);
+    sb->spill_first = sb->cold_end;
+  }
+}
+
+INTERNAL size_t vterm_scrollback_count(const VTermScrollback *sb)
+{
+  return total_lines(sb);
+}
+
+INTERNAL uint64_t vterm_scrollback_end(const VTermScrollback *sb)
+{
+  return sb->cold_end + sb->count;
+}
+
+INTERNAL int vterm_scrollback_width(const VTermScrollback *sb)
+{
+  return sb->width;
+}
+
+INTERNAL void vterm_scrollback_push(VTermScrollback *sb, int cols, const VTermScreenCell *cells, bool continuation)
+{
+  if(cols > sb->width)
+    sb->width = cols;
+
+  size_t len = serialize_line(sb, cols, cells);
+  SBRecord *rec = intern_record(sb, sb->scratch, len);
+
+  if(total_lines(sb) == sb->max_lines)
+    drop_oldest(sb);
+
+  if(sb->count == sb->lines_size) {
+    size_t new_size = sb->lines_size ? sb->lines_size * 2 : 64;
+    if(new_size > sb->max_lines)
+      new_size = sb->max_lines;
+    resize_ring(sb, new_size);
+  }
+
+  sb->count++;
+  *sb_line(sb, 0) = (SBLine){
+    .rec          = rec,
+    .continuation = continuation,
+  };
+
+  if(sb->block_lines && sb->count >= sb->hot_lines + sb->block_lines)
+    freeze_lines(sb, sb->block_lines);
+}
+
+INTERNAL int vterm_scrollback_pop(VTermScrollback *sb, int cols, VTermScreenCell *cells, bool *continuation)
+{
+  if(!sb->count && sb->spill && sb->cold_first < sb->cold_end) {
+    uint64_t lineno = sb->cold_end - 1;
+    size_t len;
+    const unsigned char *raw = get_spilled_line(sb, lineno, &len, continuation);
+    if(!raw)
+      return 0;
+
+    deserialize_line(raw, len, cols, cells);
+    sb->cold_end--;
+    if(sb->cold_first == sb->cold_end) {
+      vterm_spill_truncate(sb->spill, 0);
+      sb->spill_first = sb->cold_end;
+    }
+    else
+      vterm_spill_truncate(sb->spill, spill_offset(sb, lineno));
+    return 1;
+  }
+
+  if(!sb->count && sb->block_count)
+    unfreeze_newest(sb);
+  if(!sb->count)
+    return 0;
+
+  SBLine *line = sb_line(sb, 0);
+  deserialize_line(line->rec->data, line->rec->len, cols, cells);
+  *continuation = line->continuation;
+  release_record(sb, line->rec);
+  sb->count--;
+
+  return 1;
+}
+
+INTERNAL int vterm_scrollback_get_line(VTermScrollback *sb, size_t index, int cols, VTermScreenCell *cells, VTermLineInfo *info)
+{
+  if(index >= total_lines(sb))
+    return 0;
+
+  bool continuation;
+  if(index < sb->count) {
+    const SBLine *line = sb_line(sb, index);
+    deserialize_line(line->rec->data, line->rec->len, cols, cells);
+    continuation = line->continuation;
+  }
+  else if(sb->spill) {
+    size_t len;
+    const unsigned char *raw = get_spilled_line(sb, sb->cold_end - 1 - (index - sb->count), &len, &continuation);
+    if(!raw)
+      return 0;
+    deserialize_line(raw, len, cols, cells);
+  }
+  else
+    get_frozen_line(sb, sb->cold_end - 1 - (index - sb->count), cols, cells, &continuation);
+
+  if(info)
+    *info = (VTermLineInfo){ .continuation = continuation };
+
+  return 1;
+}
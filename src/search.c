@@ -0,0 +1,770 @@
+#include "vterm_internal.h"
+
+#include <string.h>
+
+/* Substring search over the screen and the built-in scrollback store.
+ *
+ * Text is matched a logical line at a time: a line together with the lines
+ * soft-wrapped on from it, as marked by VTermLineInfo.continuation. Each cell
+ * contributes its chars, an empty one a space; trailing empty cells are left
+ * out.
+ *
+ * The scrollback can be indexed, by the trigrams of its case-folded text.
+ * Lines are grouped into granules of about SEARCH_GRANULE lines, only ever
+ * split between logical lines, and each trigram has a posting list of the
+ * granules it occurs in. A query then only looks at the granules holding
+ * every one of its trigrams. Lines on the screen are never indexed; they
+ * change too often, and there are few enough of them to just scan.
+ *
+ * Lines are numbered as the store does (see vterm_scrollback_end()), and the
+ * screen's rows follow on from the newest of them. Posting lists of dropped
+ * granules are trimmed once there are as many of those as live ones.
+ */
+#define SEARCH_GRANULE 32
+
+typedef struct {
+  uint64_t key; /* 0 => empty slot */
+  uint64_t first, last;
+  uint32_t count;
+  uint32_t len, size;
+  unsigned char *data; /* varints of the differences between successive ids */
+} SearchPostings;
+
+struct VTermSearchIndex {
+  VTerm *vt;
+
+  /* Open addressing; table_size is a power of 2 */
+  SearchPostings *table;
+  size_t table_size;
+  size_t table_used;
+
+  /* Ring of the first line of each granule; the oldest has id base */
+  uint64_t *granules;
+  size_t    granules_size;
+  size_t    gran_head;
+  size_t    gran_count;
+  uint64_t  base;
+  uint64_t  trimmed; /* no posting list holds an id below this */
+
+  uint64_t end; /* one past the newest line indexed */
+
+  /* Last two folded chars of line tail_line, for trigrams across a wrap */
+  uint32_t tail[2];
+  int      tail_len;
+  uint64_t tail_line;
+
+  uint32_t *text;
+  size_t    text_size;
+  VTermScreenCell *cells;
+  int              cells_len;
+};
+
+typedef struct {
+  uint32_t ch, folded;
+  int line; /* from the start of the logical line */
+  int col;
+  int width;
+} SearchChar;
+
+static uint32_t fold(uint32_t c)
+{
+  if(c < 0x80)
+    return c >= 'A' && c <= 'Z' ? c + 0x20 : c;
+  if((c >= 0xc0 && c <= 0xde && c != 0xd7) ||
+     (c >= 0x391 && c <= 0x3a9 && c != 0x3a2) ||
+     (c >= 0x410 && c <= 0x42f))
+    return c + 0x20;
+  if(c >= 0x400 && c <= 0x40f)
+    return c + 0x50;
+  /* Latin Extended-A pairs upper and lower case neighbours */
+  if(((c >= 0x100 && c <= 0x137) || (c >= 0x14a && c <= 0x177)) && !(c & 1))
+    return c + 1;
+  if(c >= 0x139 && c <= 0x148 && (c & 1))
+    return c + 1;
+  return c;
+}
+
+static uint64_t trigram_key(uint32_t a, uint32_t b, uint32_t c)
+{
+  return 1ULL << 63 | (uint64_t)(a & 0x1fffff) << 42 | (uint64_t)(b & 0x1fffff) << 21 | (c & 0x1fffff);
+}
+
+static size_t key_slot(uint64_t key, size_t size)
+{
+  key *= 0x9e3779b97f4a7c15ULL;
+  return (key ^ key >> 29) & (size - 1);
+}
+
+static size_t put_varint(unsigned char *p, uint64_t v)
+{
+  size_t n = 0;
+  while(v >= 0x80) {
+    p[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+static uint64_t get_varint(const unsigned char **pp)
+{
+  const unsigned char *p = *pp;
+  uint64_t v = 0;
+  int shift = 0;
+  do {
+    v |= (uint64_t)(*p & 0x7f) << shift;
+    shift += 7;
+  } while(*p++ & 0x80);
+
+  *pp = p;
+  return v;
+}
+
+/* Decodes the ids of a posting list from base on into ids[] */
+static size_t decode_postings(const SearchPostings *post, uint64_t base, uint64_t *ids)
+{
+  size_t n = 0;
+  uint64_t id = post->first;
+  const unsigned char *p = post->data;
+  for(uint32_t i = 0; i < post->count; i++) {
+    if(i)
+      id += get_varint(&p);
+    if(id >= base)
+      ids[n++] = id;
+  }
+  return n;
+}
+
+static SearchPostings *find_postings(const VTermSearchIndex *idx, uint64_t key)
+{
+  for(size_t i = key_slot(key, idx->table_size); idx->table[i].key; i = (i + 1) & (idx->table_size - 1))
+    if(idx->table[i].key == key)
+      return &idx->table[i];
+  return NULL;
+}
+
+static SearchPostings *insert_postings(SearchPostings *table, size_t size, uint64_t key)
+{
+  size_t i = key_slot(key, size);
+  while(table[i].key && table[i].key != key)
+    i = (i + 1) & (size - 1);
+  table[i].key = key;
+  return &table[i];
+}
+
+/* Rehashes into a table of new_size, first dropping ids below base */
+static void rebuild_table(VTermSearchIndex *idx, size_t new_size, uint64_t base)
+{
+  SearchPostings *table = vterm_allocator_malloc(idx->vt, sizeof(SearchPostings) * new_size);
+  uint64_t *ids = NULL;
+  size_t ids_size = 0;
+  size_t used = 0;
+
+  for(size_t i = 0; i < idx->table_size; i++) {
+    SearchPostings *post = &idx->table[i];
+    if(!post->key)
+      continue;
+
+    if(post->first < base) {
+      if(ids_size < post->count) {
+        if(ids)
+          vterm_allocator_free(idx->vt, ids);
+        ids_size = post->count * 2;
+        ids = vterm_allocator_malloc(idx->vt, sizeof(uint64_t) * ids_size);
+      }
+      size_t n = decode_postings(post, base, ids);
+      if(!n) {
+        if(post->data)
+          vterm_allocator_free(idx->vt, post->data);
+        continue;
+      }
+
+      /* Re-encoding can only shrink it, so reuse the buffer */
+      post->first = ids[0];
+      post->count = n;
+      post->len = 0;
+      for(size_t j = 1; j < n; j++)
+        post->len += put_varint(post->data + post->len, ids[j] - ids[j-1]);
+    }
+
+    *insert_postings(table, new_size, post->key) = *post;
+    used++;
+  }
+
+  if(ids)
+    vterm_allocator_free(idx->vt, ids);
+  vterm_allocator_free(idx->vt, idx->table);
+  idx->table = table;
+  idx->table_size = new_size;
+  idx->table_used = used;
+}
+
+static void add_posting(VTermSearchIndex *idx, uint64_t key, uint64_t id)
+{
+  if((idx->table_used + 1) * 4 > idx->table_size * 3)
+    rebuild_table(idx, idx->table_size * 2, 0);
+
+  SearchPostings *post = find_postings(idx, key);
+  if(!post) {
+    post = insert_postings(idx->table, idx->table_size, key);
+    post->first = post->last = id;
+    post->count = 1;
+    idx->table_used++;
+    return;
+  }
+
+  if(post->last == id)
+    return;
+
+  if(post->size - post->len < 10) {
+    uint32_t new_size = post->size ? post->size * 2 : 16;
+    unsigned char *data = vterm_allocator_malloc(idx->vt, new_size);
+    if(post->data) {
+      memcpy(data, post->data, post->len);
+      vterm_allocator_free(idx->vt, post->data);
+    }
+    post->data = data;
+    post->size = new_size;
+  }
+
+  post->len += put_varint(post->data + post->len, id - post->last);
+  post->last = id;
+  post->count++;
+}
+
+static uint64_t *granule_first(const VTermSearchIndex *idx, size_t i)
+{
+  return &idx->granules[(idx->gran_head + i) % idx->granules_size];
+}
+
+static uint64_t granule_end(const VTermSearchIndex *idx, size_t i)
+{
+  return i + 1 < idx->gran_count ? *granule_first(idx, i + 1) : idx->end;
+}
+
+/* Forgets granules wholly before line first */
+static void drop_granules(VTermSearchIndex *idx, uint64_t first)
+{
+  while(idx->gran_count && granule_end(idx, 0) <= first) {
+    idx->gran_head = (idx->gran_head + 1) % idx->granules_size;
+    idx->gran_count--;
+    idx->base++;
+  }
+
+  if(idx->base - idx->trimmed >= 64 && idx->base - idx->trimmed >= idx->gran_count) {
+    size_t new_size = idx->table_size;
+    /* Posting lists empty out along with their granules */
+    while(new_size > 1024 && idx->table_used * 4 < new_size)
+      new_size /= 2;
+    rebuild_table(idx, new_size, idx->base);
+    idx->trimmed = idx->base;
+  }
+}
+
+/* Text of a row of cells: one entry per char, with the cell it is in. Either
+ * output may be NULL */
+static int row_text(const VTermScreenCell *cells, int cols, uint32_t *text, SearchChar *chars, int line)
+{
+  int end = cols;
+  while(end > 0 && !cells[end-1].chars[0])
+    end--;
+
+  int n = 0;
+  for(int col = 0; col < end; col++) {
+    const VTermScreenCell *cell = &cells[col];
+    if(cell->chars[0] == (uint32_t)-1)
+      continue;
+
+    for(int i = 0; i < VTERM_MAX_CHARS_PER_CELL && (i == 0 || cell->chars[i]); i++) {
+      uint32_t ch = cell->chars[i] ? cell->chars[i] : ' ';
+      if(text)
+        text[n] = fold(ch);
+      if(chars)
+        chars[n] = (SearchChar){
+          .ch     = ch,
+          .folded = fold(ch),
+          .line   = line,
+          .col    = col,
+          .width  = cell->width > 1 ? cell->width : 1,
+        };
+      n++;
+      if(!cell->chars[0])
+        break;
+    }
+  }
+
+  return n;
+}
+
+static void ensure_cells(VTerm *vt, VTermScreenCell **cells, int *len, int cols)
+{
+  if(*len >= cols)
+    return;
+  if(*cells)
+    vterm_allocator_free(vt, *cells);
+  *cells = vterm_allocator_malloc(vt, sizeof(VTermScreenCell) * cols);
+  *len = cols;
+}
+
+static void index_line(VTermSearchIndex *idx, VTermScrollback *sb, uint64_t lineno, int cols, const VTermScreenCell *cells, bool continuation)
+{
+  uint64_t first = vterm_scrollback_end(sb) - vterm_scrollback_count(sb);
+  drop_granules(idx, first);
+
+  if(!idx->gran_count ||
+     (!continuation && lineno - *granule_first(idx, idx->gran_count - 1) >= SEARCH_GRANULE)) {
+    if(idx->gran_count == idx->granules_size) {
+      size_t new_size = idx->granules_size ? idx->granules_size * 2 : 64;
+      uint64_t *granules = vterm_allocator_malloc(idx->vt, sizeof(uint64_t) * new_size);
+      for(size_t i = 0; i < idx->gran_count; i++)
+        granules[i] = *granule_first(idx, i);
+      if(idx->granules)
+        vterm_allocator_free(idx->vt, idx->granules);
+      idx->granules = granules;
+      idx->granules_size = new_size;
+      idx->gran_head = 0;
+    }
+    *granule_first(idx, idx->gran_count++) = lineno;
+  }
+  uint64_t id = idx->base + idx->gran_count - 1;
+  idx->end = lineno + 1;
+
+  size_t needed = 2 + (size_t)cols * VTERM_MAX_CHARS_PER_CELL;
+  if(idx->text_size < needed) {
+    if(idx->text)
+      vterm_allocator_free(idx->vt, idx->text);
+    idx->text = vterm_allocator_malloc(idx->vt, sizeof(uint32_t) * needed);
+    idx->text_size = needed;
+  }
+
+  /* A wrapped-on line carries on the trigrams of the one before */
+  int n = 0;
+  if(continuation && lineno > first) {
+    if(idx->tail_line != lineno - 1) {
+      int width = vterm_scrollback_width(sb);
+      ensure_cells(idx->vt, &idx->cells, &idx->cells_len, width);
+      VTermLineInfo info;
+      if(vterm_scrollback_get_line(sb, vterm_scrollback_end(sb) - lineno, width, idx->cells, &info)) {
+        uint32_t *prev = vterm_allocator_malloc(idx->vt, sizeof(uint32_t) * (width * VTERM_MAX_CHARS_PER_CELL + 1));
+        int len = row_text(idx->cells, width, prev, NULL, 0);
+        idx->tail_len = len < 2 ? len : 2;
+        memcpy(idx->tail, prev + len - idx->tail_len, sizeof(uint32_t) * idx->tail_len);
+        vterm_allocator_free(idx->vt, prev);
+      }
+      else
+        idx->tail_len = 0;
+    }
+    memcpy(idx->text, idx->tail, sizeof(uint32_t) * idx->tail_len);
+    n = idx->tail_len;
+  }
+
+  int len = row_text(cells, cols, idx->text + n, NULL, 0);
+  n += len;
+
+  for(int i = 0; i + 2 < n; i++)
+    add_posting(idx, trigram_key(idx->text[i], idx->text[i+1], idx->text[i+2]), id);
+
+  /* The tail runs on from the previous line if this one is short */
+  if(len < 2 && continuation && lineno > first) {
+    idx->tail_len = n < 2 ? n : 2;
+    memmove(idx->tail, idx->text + n - idx->tail_len, sizeof(uint32_t) * idx->tail_len);
+  }
+  else {
+    idx->tail_len = len < 2 ? len : 2;
+    memcpy(idx->tail, idx->text + n - idx->tail_len, sizeof(uint32_t) * idx->tail_len);
+  }
+  idx->tail_line = lineno;
+}
+
+INTERNAL VTermSearchIndex *vterm_search_index_new(VTerm *vt, VTermScrollback *sb)
+{
+  VTermSearchIndex *idx = vterm_allocator_malloc(vt, sizeof(VTermSearchIndex));
+
+  idx->vt = vt;
+  idx->table_size = 1024;
+  idx->table = vterm_allocator_malloc(vt, sizeof(SearchPostings) * idx->table_size);
+  idx->tail_line = (uint64_t)-1;
+
+  /* Index what the store already holds, oldest first */
+  uint64_t end = vterm_scrollback_end(sb);
+  size_t count = vterm_scrollback_count(sb);
+  int width = vterm_scrollback_width(sb);
+  VTermScreenCell *cells = NULL;
+  int cells_len = 0;
+  ensure_cells(vt, &cells, &cells_len, width);
+
+  idx->base = idx->trimmed = 0;
+  idx->end = end - count;
+  for(size_t i = count; i > 0; i--) {
+    VTermLineInfo info;
+    if(!vterm_scrollback_get_line(sb, i - 1, width, cells, &info))
+      continue;
+    index_line(idx, sb, end - i, width, cells, info.continuation);
+  }
+  idx->end = end;
+
+  if(cells)
+    vterm_allocator_free(vt, cells);
+
+  return idx;
+}
+
+INTERNAL void vterm_search_index_free(VTermSearchIndex *idx)
+{
+  for(size_t i = 0; i < idx->table_size; i++)
+    if(idx->table[i].data)
+      vterm_allocator_free(idx->vt, idx->table[i].data);
+  vterm_allocator_free(idx->vt, idx->table);
+  if(idx->granules)
+    vterm_allocator_free(idx->vt, idx->granules);
+  if(idx->text)
+    vterm_allocator_free(idx->vt, idx->text);
+  if(idx->cells)
+    vterm_allocator_free(idx->vt, idx->cells);
+
+  vterm_allocator_free(idx->vt, idx);
+}
+
+INTERNAL size_t vterm_search_index_memory_usage(const VTermSearchIndex *idx)
+{
+  size_t bytes = sizeof(VTermSearchIndex) +
+    sizeof(SearchPostings) * idx->table_size +
+    sizeof(uint64_t) * idx->granules_size +
+    sizeof(uint32_t) * idx->text_size +
+    sizeof(VTermScreenCell) * idx->cells_len;
+
+  for(size_t i = 0; i < idx->table_size; i++)
+    bytes += idx->table[i].size;
+
+  return bytes;
+}
+
+INTERNAL void vterm_search_index_push(VTermSearchIndex *idx, VTermScrollback *sb, int cols, const VTermScreenCell *cells, bool continuation)
+{
+  index_line(idx, sb, vterm_scrollback_end(sb) - 1, cols, cells, continuation);
+}
+
+INTERNAL void vterm_search_index_pop(VTermSearchIndex *idx, VTermScrollback *sb)
+{
+  /* Postings for the popped line stay; they only cost a wasted look */
+  idx->end = vterm_scrollback_end(sb);
+  while(idx->gran_count && *granule_first(idx, idx->gran_count - 1) >= idx->end)
+    idx->gran_count--;
+  idx->tail_line = (uint64_t)-1;
+}
+
+/* Finds the granules holding every one of n trigrams, returning how many
+ * there are; *idsp is allocated to hold them, oldest first */
+static size_t candidate_granules(const VTermSearchIndex *idx, const uint32_t *text, int n, uint64_t **idsp)
+{
+  *idsp = NULL;
+
+  const SearchPostings *shortest = NULL;
+  for(int i = 0; i + 2 < n; i++) {
+    const SearchPostings *post = find_postings(idx, trigram_key(text[i], text[i+1], text[i+2]));
+    if(!post)
+      return 0;
+    if(!shortest || post->count < shortest->count)
+      shortest = post;
+  }
+
+  uint64_t *ids = vterm_allocator_malloc(idx->vt, sizeof(uint64_t) * shortest->count);
+  size_t count = decode_postings(shortest, idx->base, ids);
+
+  for(int i = 0; i + 2 < n && count; i++) {
+    const SearchPostings *post = find_postings(idx, trigram_key(text[i], text[i+1], text[i+2]));
+    if(post == shortest)
+      continue;
+
+    /* Intersect in place, merging against the list as it decodes */
+    size_t kept = 0, j = 0;
+    uint64_t id = post->first;
+    const unsigned char *p = post->data;
+    for(uint32_t k = 0; k < post->count && j < count; k++) {
+      if(k)
+        id += get_varint(&p);
+      while(j < count && ids[j] < id)
+        j++;
+      if(j < count && ids[j] == id)
+        ids[kept++] = ids[j++];
+    }
+    count = kept;
+  }
+
+  *idsp = ids;
+  return count;
+}
+
+typedef struct {
+  VTerm *vt;
+  VTermScrollback *sb;
+  VTermScreen *screen;
+  VTermState *state;
+  int rows, cols;
+
+  uint64_t first, end; /* scrollback lines; screen rows follow on from end */
+
+  VTermScreenCell *cells;
+  int              cells_len;
+
+  /* One line read ahead, to tell if it continues the one before */
+  uint64_t cached_line;
+  bool     cached_cont;
+  int      cached_cols;
+  bool     cached;
+
+  SearchChar *chars;
+  size_t      chars_len, chars_size;
+
+  const uint32_t *query;
+  int             query_len;
+  bool            caseless;
+
+  VTermSearchHit *found;
+  size_t          found_len, found_size;
+} SearchRun;
+
+static bool fetch_line(SearchRun *run, uint64_t line)
+{
+  if(run->cached && run->cached_line == line)
+    return true;
+
+  run->cached = false;
+  if(line < run->end) {
+    int width = vterm_scrollback_width(run->sb);
+    ensure_cells(run->vt, &run->cells, &run->cells_len, width);
+    VTermLineInfo info;
+    if(!vterm_scrollback_get_line(run->sb, run->end - 1 - line, width, run->cells, &info))
+      return false;
+    run->cached_cont = info.continuation;
+    run->cached_cols = width;
+  }
+  else {
+    int row = line - run->end;
+    ensure_cells(run->vt, &run->cells, &run->cells_len, run->cols);
+    VTermPos pos = { .row = row };
+    for(pos.col = 0; pos.col < run->cols; pos.col++)
+      vterm_screen_get_cell(run->screen, pos, &run->cells[pos.col]);
+    run->cached_cont = vterm_state_get_lineinfo(run->state, row)->continuation;
+    run->cached_cols = run->cols;
+  }
+
+  run->cached_line = line;
+  run->cached = true;
+  return true;
+}
+
+static bool is_continuation(SearchRun *run, uint64_t line)
+{
+  return line < run->end + run->rows && fetch_line(run, line) && run->cached_cont;
+}
+
+/* Reads the logical line starting at start into run->chars, returning the
+ * line after it */
+static uint64_t read_logical_line(SearchRun *run, uint64_t start)
+{
+  run->chars_len = 0;
+
+  uint64_t line = start;
+  do {
+    if(fetch_line(run, line)) {
+      size_t needed = run->chars_len + (size_t)run->cached_cols * VTERM_MAX_CHARS_PER_CELL;
+      if(run->chars_size < needed) {
+        size_t new_size = run->chars_size ? run->chars_size : 256;
+        while(new_size < needed)
+          new_size *= 2;
+        SearchChar *chars = vterm_allocator_malloc(run->vt, sizeof(SearchChar) * new_size);
+        if(run->chars) {
+          memcpy(chars, run->chars, sizeof(SearchChar) * run->chars_len);
+          vterm_allocator_free(run->vt, run->chars);
+        }
+        run->chars = chars;
+        run->chars_size = new_size;
+      }
+
+      run->chars_len += row_text(run->cells, run->cached_cols, NULL, run->chars + run->chars_len, line - start);
+    }
+    line++;
+  } while(is_continuation(run, line));
+
+  return line;
+}
+
+static void found_hit(SearchRun *run, VTermSearchHit hit)
+{
+  if(run->found_len == run->found_size) {
+    size_t new_size = run->found_size ? run->found_size * 2 : 16;
+    VTermSearchHit *found = vterm_allocator_malloc(run->vt, sizeof(VTermSearchHit) * new_size);
+    if(run->found) {
+      memcpy(found, run->found, sizeof(VTermSearchHit) * run->found_len);
+      vterm_allocator_free(run->vt, run->found);
+    }
+    run->found = found;
+    run->found_size = new_size;
+  }
+
+  run->found[run->found_len++] = hit;
+}
+
+static void match_logical_line(SearchRun *run, uint64_t start)
+{
+  const SearchChar *chars = run->chars;
+  int n = run->query_len;
+
+  for(size_t i = 0; i + n <= run->chars_len; i++) {
+    int j;
+    if(run->caseless) {
+      for(j = 0; j < n && chars[i+j].folded == run->query[j]; j++)
+        ;
+    }
+    else {
+      for(j = 0; j < n && chars[i+j].ch == run->query[j]; j++)
+        ;
+    }
+    if(j < n)
+      continue;
+
+    const SearchChar *last = &chars[i + n - 1];
+    found_hit(run, (VTermSearchHit){
+      .start = { .row = (int)(int64_t)(start + chars[i].line - run->end), .col = chars[i].col },
+      .end   = { .row = (int)(int64_t)(start + last->line - run->end),     .col = last->col + last->width },
+    });
+  }
+}
+
+static int pos_cmp(VTermPos a, VTermPos b)
+{
+  if(a.row != b.row)
+    return a.row < b.row ? -1 : 1;
+  return a.col < b.col ? -1 : a.col > b.col;
+}
+
+INTERNAL int vterm_search(VTerm *vt, VTermSearchIndex *idx, VTermScrollback *sb, VTermScreen *screen,
+    const char *query, size_t len, VTermSearchFlags flags, VTermPos from, VTermSearchHit hits[], int max_hits)
+{
+  bool backward = flags & VTERM_SEARCH_BACKWARD;
+
+  SearchRun run = {
+    .vt       = vt,
+    .sb       = sb,
+    .screen   = screen,
+    .state    = vterm_obtain_state(vt),
+    .caseless = flags & VTERM_SEARCH_CASELESS,
+  };
+  vterm_get_size(vt, &run.rows, &run.cols);
+  if(sb) {
+    run.end = vterm_scrollback_end(sb);
+    run.first = run.end - vterm_scrollback_count(sb);
+  }
+
+  /* Decode the query, and fold it for the index and caseless matching */
+  VTermEncodingInstance utf8 = { .enc = vterm_lookup_encoding(ENC_UTF8, 'u') };
+  if(utf8.enc->init)
+    (*utf8.enc->init)(utf8.enc, utf8.data);
+  uint32_t *text = vterm_allocator_malloc(vt, sizeof(uint32_t) * (len + 2));
+  uint32_t *folded = vterm_allocator_malloc(vt, sizeof(uint32_t) * (len + 2));
+  int n = 0;
+  size_t pos = 0;
+  while(pos < len) {
+    size_t was = pos;
+    (*utf8.enc->decode)(utf8.enc, utf8.data, text, &n, len + 1, query, &pos, len);
+    /* it stops at a control char, which could never match anyway */
+    if(pos == was)
+      pos++;
+  }
+  for(int i = 0; i < n; i++)
+    folded[i] = fold(text[i]);
+
+  run.query = run.caseless ? folded : text;
+  run.query_len = n;
+
+  /* Ranges of lines to look in; logical lines starting in each are matched */
+  uint64_t *ids = NULL;
+  size_t nranges;
+  if(!n || !sb)
+    nranges = 0;
+  else if(idx && n >= 3)
+    nranges = candidate_granules(idx, folded, n, &ids);
+  else if(idx)
+    nranges = idx->gran_count;
+  else
+    nranges = (run.end - run.first + SEARCH_GRANULE - 1) / SEARCH_GRANULE;
+  nranges++; /* the screen */
+
+  int nhits = 0;
+  uint64_t done_until = 0, done_from = (uint64_t)-1;
+
+  for(size_t r = 0; r < nranges && nhits < max_hits && n; r++) {
+    size_t ri = backward ? nranges - 1 - r : r;
+    uint64_t a, b;
+    if(ri == nranges - 1) {
+      a = run.end;
+      b = run.end + run.rows;
+    }
+    else if(!idx) {
+      a = run.first + ri * SEARCH_GRANULE;
+      b = a + SEARCH_GRANULE < run.end ? a + SEARCH_GRANULE : run.end;
+    }
+    else {
+      size_t g = (ids ? ids[ri] : idx->base + ri) - idx->base;
+      a = *granule_first(idx, g);
+      b = granule_end(idx, g);
+      if(a < run.first)
+        a = run.first;
+      if(b > run.end)
+        b = run.end;
+      if(a >= b)
+        continue;
+    }
+
+    /* A hit in a logical line that runs on past its range is found again
+     * from the range it runs into, so ranges wholly before or after from
+     * can be skipped */
+    if(ri != nranges - 1) {
+      int64_t from_line = (int64_t)run.end + from.row;
+      if(!backward && (int64_t)b <= from_line)
+        continue;
+      if(backward && (int64_t)a > from_line)
+        continue;
+    }
+
+    uint64_t line = a;
+    while(line > run.first && is_continuation(&run, line))
+      line--;
+
+    /* Each logical line is matched once, though ranges can share one */
+    uint64_t done_before = done_from;
+    run.found_len = 0;
+    while(line < b) {
+      uint64_t start = line;
+      bool done = backward ? start >= done_before : start < done_until;
+      line = read_logical_line(&run, start);
+      if(done)
+        continue;
+      if(start < done_from)
+        done_from = start;
+      if(line > done_until)
+        done_until = line;
+      match_logical_line(&run, start);
+    }
+
+    for(size_t i = 0; i < run.found_len && nhits < max_hits; i++) {
+      VTermSearchHit *hit = &run.found[backward ? run.found_len - 1 - i : i];
+      if(backward ? pos_cmp(hit->start, from) < 0 : pos_cmp(hit->start, from) >= 0)
+        hits[nhits++] = *hit;
+    }
+  }
+
+  if(ids)
+    vterm_allocator_free(vt, ids);
+  if(run.cells)
+    vterm_allocator_free(vt, run.cells);
+  if(run.chars)
+    vterm_allocator_free(vt, run.chars);
+  if(run.found)
+    vterm_allocator_free(vt, run.found);
+  vterm_allocator_free(vt, text);
+  vterm_allocator_free(vt, folded);
+
+  return nhits;
+}
@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "vterm_internal.h"
+
+/* A copy of the screen in a POSIX shared memory object, laid out as
+ * described in vterm.h for other processes to read without copying it
+ * again. Only rows that changed since the last update are rewritten. */
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SHM_PAGE 4096
+
+struct VTermShmExport {
+  VTerm *vt;
+  VTermScreen *screen;
+  char *name;
+  int fd;
+
+  unsigned char *map;
+  size_t         map_len;
+
+  int rows, cols;
+  bool *dirty;
+  bool changed;
+};
+
+static size_t layout(int rows, int cols, uint32_t *lineinfo_offset, uint32_t *row_version_offset, uint32_t *cells_offset)
+{
+  size_t offset = sizeof(VTermShmHeader);
+
+  *lineinfo_offset = offset;
+  offset += rows;
+
+  offset = (offset + 7) & ~(size_t)7;
+  *row_version_offset = offset;
+  offset += sizeof(uint64_t) * rows;
+
+  offset = (offset + 7) & ~(size_t)7;
+  *cells_offset = offset;
+  offset += sizeof(VTermShmCell) * rows * cols;
+
+  return offset;
+}
+
+static void convert_cell(const VTermScreenCell *cell, VTermShmCell *out)
+{
+  memcpy(out->chars, cell->chars, sizeof(out->chars));
+  out->width = cell->width;
+  out->attrs =
+    (cell->attrs.bold    ? VTERM_SHM_ATTR_BOLD    : 0) |
+    (cell->attrs.italic  ? VTERM_SHM_ATTR_ITALIC  : 0) |
+    (cell->attrs.blink   ? VTERM_SHM_ATTR_BLINK   : 0) |
+    (cell->attrs.reverse ? VTERM_SHM_ATTR_REVERSE : 0) |
+    (cell->attrs.strike  ? VTERM_SHM_ATTR_STRIKE  : 0) |
+    (cell->attrs.dwl     ? VTERM_SHM_ATTR_DWL     : 0) |
+    cell->attrs.underline << VTERM_SHM_ATTR_UNDERLINE_SHIFT |
+    cell->attrs.font      << VTERM_SHM_ATTR_FONT_SHIFT |
+    cell->attrs.dhl       << VTERM_SHM_ATTR_DHL_SHIFT;
+  out->fg = cell->fg;
+  out->bg = cell->bg;
+}
+
+static int grow(VTermShmExport *e, size_t len)
+{
+  len = (len + SHM_PAGE - 1) & ~(size_t)(SHM_PAGE - 1);
+
+  /* Never shrunk, so readers can't find their mapping cut short */
+  if(ftruncate(e->fd, len) == -1) {
+    DEBUG_LOG("libvterm: shm truncate failed\n");
+    return 0;
+  }
+
+  void *map = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, e->fd, 0);
+  if(map == MAP_FAILED) {
+    DEBUG_LOG("libvterm: shm mmap failed\n");
+    return 0;
+  }
+
+  if(e->map)
+    munmap(e->map, e->map_len);
+  e->map = map;
+  e->map_len = len;
+
+  return 1;
+}
+
+INTERNAL VTermShmExport *vterm_shm_export_new(VTerm *vt, VTermScreen *screen, const char *name, int rows, int cols)
+{
+  int fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+  if(fd == -1)
+    return NULL;
+
+  VTermShmExport *e = vterm_allocator_malloc(vt, sizeof(VTermShmExport));
+  e->vt = vt;
+  e->screen = screen;
+  e->fd = fd;
+
+  e->name = vterm_allocator_malloc(vt, strlen(name) + 1);
+  strcpy(e->name, name);
+
+  if(!grow(e, sizeof(VTermShmHeader))) {
+    vterm_shm_export_free(e);
+    return NULL;
+  }
+
+  VTermShmHeader *h = (VTermShmHeader *)e->map;
+  h->magic   = VTERM_SHM_MAGIC;
+  h->version = VTERM_SHM_VERSION;
+
+  vterm_shm_export_resize(e, rows, cols);
+  vterm_shm_export_update(e);
+
+  return e;
+}
+
+INTERNAL void vterm_shm_export_free(VTermShmExport *e)
+{
+  /* Readers that have it mapped carry on seeing the last update */
+  if(e->map)
+    munmap(e->map, e->map_len);
+  close(e->fd);
+  shm_unlink(e->name);
+
+  vterm_allocator_free(e->vt, e->name);
+  if(e->dirty)
+    vterm_allocator_free(e->vt, e->dirty);
+  vterm_allocator_free(e->vt, e);
+}
+
+INTERNAL size_t vterm_shm_export_memory_usage(const VTermShmExport *e)
+{
+  /* The region itself is shared, so isn't counted */
+  return sizeof(VTermShmExport) + strlen(e->name) + 1 + sizeof(bool) * e->rows;
+}
+
+INTERNAL void vterm_shm_export_resize(VTermShmExport *e, int rows, int cols)
+{
+  if(e->dirty)
+    vterm_allocator_free(e->vt, e->dirty);
+
+  e->dirty = vterm_allocator_malloc(e->vt, sizeof(bool) * rows);
+  e->rows = rows;
+  e->cols = cols;
+  vterm_shm_export_damage(e, 0, rows);
+}
+
+INTERNAL void vterm_shm_export_damage(VTermShmExport *e, int start_row, int end_row)
+{
+  if(start_row < 0)
+    start_row = 0;
+  if(end_row > e->rows)
+    end_row = e->rows;
+
+  for(int row = start_row; row < end_row; row++)
+    e->dirty[row] = true;
+
+  e->changed = true;
+}
+
+INTERNAL void vterm_shm_export_update(VTermShmExport *e)
+{
+  VTermState *state = vterm_obtain_state(e->vt);
+  VTermShmHeader *h = (VTermShmHeader *)e->map;
+
+  if(!e->changed &&
+     h->cursor_row == state->pos.row && h->cursor_col == state->pos.col &&
+     h->cursor_visible == state->mode.cursor_visible)
+    return;
+
+  uint32_t lineinfo_offset, row_version_offset, cells_offset;
+  size_t len = layout(e->rows, e->cols, &lineinfo_offset, &row_version_offset, &cells_offset);
+  if(len > e->map_len) {
+    if(!grow(e, len))
+      return;
+    h = (VTermShmHeader *)e->map;
+  }
+
+  uint32_t seq = h->seq;
+  __atomic_store_n(&h->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  uint64_t generation = h->generation + 1;
+
+  h->size = e->map_len;
+  h->rows = e->rows;
+  h->cols = e->cols;
+  h->lineinfo_offset    = lineinfo_offset;
+  h->row_version_offset = row_version_offset;
+  h->cells_offset       = cells_offset;
+
+  uint8_t      *lineinfo    = e->map + lineinfo_offset;
+  uint64_t     *row_version = (uint64_t *)(e->map + row_version_offset);
+  VTermShmCell *cells       = (VTermShmCell *)(e->map + cells_offset);
+
+  for(int row = 0; row < e->rows; row++) {
+    const VTermLineInfo *info = vterm_state_get_lineinfo(state, row);
+    lineinfo[row] =
+      (info->continuation ? VTERM_SHM_LINE_CONTINUATION : 0) |
+      (info->doublewidth  ? VTERM_SHM_LINE_DWL          : 0) |
+      info->doubleheight << VTERM_SHM_LINE_DHL_SHIFT;
+
+    if(!e->dirty[row])
+      continue;
+
+    for(int col = 0; col < e->cols; col++) {
+      VTermScreenCell cell;
+      vterm_screen_get_cell(e->screen, (VTermPos){ .row = row, .col = col }, &cell);
+      convert_cell(&cell, &cells[row * e->cols + col]);
+    }
+    row_version[row] = generation;
+    e->dirty[row] = false;
+  }
+
+  h->cursor_row     = state->pos.row;
+  h->cursor_col     = state->pos.col;
+  h->cursor_visible = state->mode.cursor_visible;
+  h->generation     = generation;
+
+  __atomic_store_n(&h->seq, seq + 2, __ATOMIC_RELEASE);
+
+  e->changed = false;
+}
+
+#else
+
+INTERNAL VTermShmExport *vterm_shm_export_new(VTerm *vt, VTermScreen *screen, const char *name, int rows, int cols)
+{
+  /* Not supported */
+  return NULL;
+}
+
+INTERNAL void vterm_shm_export_free(VTermShmExport *e)
+{
+}
+
+INTERNAL size_t vterm_shm_export_memory_usage(const VTermShmExport *e)
+{
+  return 0;
+}
+
+INTERNAL void vterm_shm_export_resize(VTermShmExport *e, int rows, int cols)
+{
+}
+
+INTERNAL void vterm_shm_export_damage(VTermShmExport *e, int start_row, int end_row)
+{
+}
+
+INTERNAL void vterm_shm_export_update(VTermShmExport *e)
+{
+}
+
+#endif
+
+uint32_t vterm_shm_read_begin(const VTermShmHeader *h)
+{
+  return __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+}
+
+int vterm_shm_read_retry(const VTermShmHeader *h, uint32_t seq)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return (seq & 1) || __atomic_load_n(&h->seq, __ATOMIC_RELAXED) != seq;
+}
@@ -0,0 +1,296 @@
+#include "vterm_internal.h"
+
+#include <string.h>
+
+/* Copies of the screen published for other threads to read. Each one is
+ * immutable once published, and rows that haven't changed between two of
+ * them are shared rather than copied again.
+ *
+ * Only the thread feeding the terminal creates or frees them; readers just
+ * take and drop references. A reader counts itself in while it picks up
+ * the current one, so that one that has been replaced is only freed once no
+ * reader can still be about to take a reference to it. */
+
+#define ATOMIC_LOAD(p)     __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define ATOMIC_INC(p)      __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST)
+#define ATOMIC_DEC(p)      __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST)
+
+typedef struct {
+  int refs; /* snapshots holding it; only the writer touches this */
+  VTermScreenCell cells[];
+} SnapshotRow;
+
+struct VTermScreenSnapshot {
+  int refs; /* readers holding it, plus one while it is current */
+  VTermScreenSnapshot *next_retired;
+
+  uint64_t generation;
+  int rows, cols;
+
+  VTermPos cursor;
+  bool cursor_visible;
+
+  VTermLineInfo *lineinfo;
+  SnapshotRow **row;
+};
+
+struct VTermSnapshots {
+  VTerm *vt;
+  VTermScreen *screen;
+
+  VTermScreenSnapshot *current;
+  VTermScreenSnapshot *retired; /* waiting for their readers to finish */
+  int readers;                  /* in the middle of acquiring current */
+
+  /* For each row of the screen, the row of current it still matches, or -1 */
+  int *source;
+  int rows, cols;
+  bool changed;
+
+  uint64_t generation;
+};
+
+static void free_snapshot(VTerm *vt, VTermScreenSnapshot *snap)
+{
+  for(int row = 0; row < snap->rows; row++)
+    if(!--snap->row[row]->refs)
+      vterm_allocator_free(vt, snap->row[row]);
+
+  vterm_allocator_free(vt, snap->row);
+  vterm_allocator_free(vt, snap->lineinfo);
+  vterm_allocator_free(vt, snap);
+}
+
+static void reclaim(VTermSnapshots *s)
+{
+  /* Anyone starting after this check can only find the current one */
+  if(ATOMIC_LOAD(&s->readers))
+    return;
+
+  VTermScreenSnapshot **prevp = &s->retired;
+  while(*prevp) {
+    VTermScreenSnapshot *snap = *prevp;
+    if(ATOMIC_LOAD(&snap->refs)) {
+      prevp = &snap->next_retired;
+      continue;
+    }
+
+    *prevp = snap->next_retired;
+    free_snapshot(s->vt, snap);
+  }
+}
+
+INTERNAL VTermSnapshots *vterm_snapshots_new(VTerm *vt, VTermScreen *screen, int rows, int cols)
+{
+  VTermSnapshots *s = vterm_allocator_malloc(vt, sizeof(VTermSnapshots));
+
+  s->vt = vt;
+  s->screen = screen;
+  vterm_snapshots_resize(s, rows, cols);
+
+  return s;
+}
+
+/* Must only be called once no other thread is using any of them */
+INTERNAL void vterm_snapshots_free(VTermSnapshots *s)
+{
+  if(s->current) {
+    s->current->next_retired = s->retired;
+    s->retired = s->current;
+  }
+
+  while(s->retired) {
+    VTermScreenSnapshot *snap = s->retired;
+    s->retired = snap->next_retired;
+    free_snapshot(s->vt, snap);
+  }
+
+  vterm_allocator_free(s->vt, s->source);
+  vterm_allocator_free(s->vt, s);
+}
+
+static size_t snapshot_memory_usage(const VTermScreenSnapshot *snap)
+{
+  size_t bytes = sizeof(VTermScreenSnapshot) +
+    (sizeof(VTermLineInfo) + sizeof(SnapshotRow *)) * snap->rows;
+
+  /* A row shared by several snapshots is split between them */
+  size_t row_size = sizeof(SnapshotRow) + sizeof(VTermScreenCell) * snap->cols;
+  for(int row = 0; row < snap->rows; row++)
+    bytes += row_size / snap->row[row]->refs;
+
+  return bytes;
+}
+
+INTERNAL size_t vterm_snapshots_memory_usage(const VTermSnapshots *s)
+{
+  size_t bytes = sizeof(VTermSnapshots) + sizeof(int) * s->rows;
+
+  if(s->current)
+    bytes += snapshot_memory_usage(s->current);
+  for(const VTermScreenSnapshot *snap = s->retired; snap; snap = snap->next_retired)
+    bytes += snapshot_memory_usage(snap);
+
+  return bytes;
+}
+
+INTERNAL void vterm_snapshots_resize(VTermSnapshots *s, int rows, int cols)
+{
+  if(s->source)
+    vterm_allocator_free(s->vt, s->source);
+
+  s->source = vterm_allocator_malloc(s->vt, sizeof(int) * rows);
+  s->rows = rows;
+  s->cols = cols;
+  vterm_snapshots_damage(s, 0, rows);
+}
+
+INTERNAL void vterm_snapshots_damage(VTermSnapshots *s, int start_row, int end_row)
+{
+  if(start_row < 0)
+    start_row = 0;
+  if(end_row > s->rows)
+    end_row = s->rows;
+
+  for(int row = start_row; row < end_row; row++)
+    s->source[row] = -1;
+
+  s->changed = true;
+}
+
+INTERNAL void vterm_snapshots_moverect(VTermSnapshots *s, VTermRect dest, VTermRect src, bool whole_rows)
+{
+  if(!whole_rows) {
+    vterm_snapshots_damage(s, dest.start_row, dest.end_row);
+    return;
+  }
+
+  /* Rows that only moved can still be shared with the current snapshot */
+  int downward = src.start_row - dest.start_row;
+  if(downward > 0)
+    for(int row = dest.start_row; row < dest.end_row; row++)
+      s->source[row] = s->source[row + downward];
+  else
+    for(int row = dest.end_row - 1; row >= dest.start_row; row--)
+      s->source[row] = s->source[row + downward];
+
+  if(downward > 0)
+    vterm_snapshots_damage(s, dest.end_row, src.end_row);
+  else
+    vterm_snapshots_damage(s, src.start_row, dest.start_row);
+}
+
+INTERNAL void vterm_snapshots_publish(VTermSnapshots *s)
+{
+  VTermState *state = vterm_obtain_state(s->vt);
+  VTermScreenSnapshot *prev = s->current;
+
+  if(prev && !s->changed &&
+     prev->cursor.row == state->pos.row && prev->cursor.col == state->pos.col &&
+     prev->cursor_visible == state->mode.cursor_visible) {
+    reclaim(s);
+    return;
+  }
+
+  VTermScreenSnapshot *snap = vterm_allocator_malloc(s->vt, sizeof(VTermScreenSnapshot));
+  snap->refs = 1;
+  snap->generation = ++s->generation;
+  snap->rows = s->rows;
+  snap->cols = s->cols;
+  snap->cursor = state->pos;
+  snap->cursor_visible = state->mode.cursor_visible;
+
+  snap->lineinfo = vterm_allocator_malloc(s->vt, sizeof(VTermLineInfo) * s->rows);
+  snap->row = vterm_allocator_malloc(s->vt, sizeof(SnapshotRow *) * s->rows);
+
+  for(int row = 0; row < s->rows; row++) {
+    snap->lineinfo[row] = *vterm_state_get_lineinfo(state, row);
+
+    int from = prev ? s->source[row] : -1;
+    if(from >= 0) {
+      snap->row[row] = prev->row[from];
+      snap->row[row]->refs++;
+    }
+    else {
+      SnapshotRow *r = vterm_allocator_malloc(s->vt, sizeof(SnapshotRow) + sizeof(VTermScreenCell) * s->cols);
+      r->refs = 1;
+      for(int col = 0; col < s->cols; col++)
+        vterm_screen_get_cell(s->screen, (VTermPos){ .row = row, .col = col }, &r->cells[col]);
+      snap->row[row] = r;
+    }
+
+    s->source[row] = row;
+  }
+
+  s->changed = false;
+
+  ATOMIC_STORE(&s->current, snap);
+
+  if(prev) {
+    ATOMIC_DEC(&prev->refs);
+    prev->next_retired = s->retired;
+    s->retired = prev;
+  }
+
+  reclaim(s);
+}
+
+INTERNAL const VTermScreenSnapshot *vterm_snapshots_acquire(VTermSnapshots *s)
+{
+  ATOMIC_INC(&s->readers);
+
+  VTermScreenSnapshot *snap = ATOMIC_LOAD(&s->current);
+  if(snap)
+    ATOMIC_INC(&snap->refs);
+
+  ATOMIC_DEC(&s->readers);
+
+  return snap;
+}
+
+void vterm_snapshot_release(const VTermScreenSnapshot *snap)
+{
+  if(snap)
+    ATOMIC_DEC(&((VTermScreenSnapshot *)snap)->refs);
+}
+
+uint64_t vterm_snapshot_get_generation(const VTermScreenSnapshot *snap)
+{
+  return snap->generation;
+}
+
+void vterm_snapshot_get_size(const VTermScreenSnapshot *snap, int *rowsp, int *colsp)
+{
+  if(rowsp)
+    *rowsp = snap->rows;
+  if(colsp)
+    *colsp = snap->cols;
+}
+
+void vterm_snapshot_get_cursorpos(const VTermScreenSnapshot *snap, VTermPos *cursorpos)
+{
+  *cursorpos = snap->cursor;
+}
+
+int vterm_snapshot_get_cursor_visible(const VTermScreenSnapshot *snap)
+{
+  return snap->cursor_visible;
+}
+
+int vterm_snapshot_get_cell(const VTermScreenSnapshot *snap, VTermPos pos, VTermScreenCell *cell)
+{
+  if(pos.row < 0 || pos.row >= snap->rows || pos.col < 0 || pos.col >= snap->cols)
+    return 0;
+
+  *cell = snap->row[pos.row]->cells[pos.col];
+  return 1;
+}
+
+const VTermLineInfo *vterm_snapshot_get_lineinfo(const VTermScreenSnapshot *snap, int row)
+{
+  if(row < 0 || row >= snap->rows)
+    return NULL;
+
+  return &snap->lineinfo[row];
+}
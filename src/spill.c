@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "vterm_internal.h"
+
+/* An append-only file that scrollback lines spill into, read back through a
+ * read-only mapping. The file is unlinked as soon as it is opened, so it
+ * never outlives the terminal and no other process can open it by name. */
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MAP_CHUNK (1 << 20)
+
+struct VTermSpillFile {
+  VTerm *vt;
+  int fd;
+
+  uint64_t len;
+
+  /* Mapped a whole number of MAP_CHUNKs at a time; may run past the end of
+   * the file, but only bytes before len are ever touched */
+  unsigned char *map;
+  size_t         map_len;
+};
+
+INTERNAL VTermSpillFile *vterm_spill_open(VTerm *vt, const char *path)
+{
+  int fd = open(path, O_RDWR|O_CREAT|O_EXCL, 0600);
+  if(fd == -1)
+    return NULL;
+  unlink(path);
+
+  VTermSpillFile *f = vterm_allocator_malloc(vt, sizeof(VTermSpillFile));
+  f->vt = vt;
+  f->fd = fd;
+
+  return f;
+}
+
+INTERNAL void vterm_spill_close(VTermSpillFile *f)
+{
+  if(f->map)
+    munmap(f->map, f->map_len);
+  close(f->fd);
+
+  vterm_allocator_free(f->vt, f);
+}
+
+INTERNAL uint64_t vterm_spill_length(const VTermSpillFile *f)
+{
+  return f->len;
+}
+
+INTERNAL int vterm_spill_append(VTermSpillFile *f, const unsigned char *data, size_t len)
+{
+  size_t done = 0;
+  while(done < len) {
+    ssize_t written = pwrite(f->fd, data + done, len - done, f->len + done);
+    if(written == -1 && errno == EINTR)
+      continue;
+    if(written <= 0) {
+      DEBUG_LOG("libvterm: spill write failed\n");
+      return 0;
+    }
+    done += written;
+  }
+
+  f->len += len;
+  return 1;
+}
+
+INTERNAL void vterm_spill_truncate(VTermSpillFile *f, uint64_t len)
+{
+  if(ftruncate(f->fd, len) == -1)
+    DEBUG_LOG("libvterm: spill truncate failed\n");
+
+  f->len = len;
+}
+
+/* Moves everything from offset onwards to the start of the file. Only done
+ * when that doesn't overlap the bytes being moved */
+INTERNAL int vterm_spill_compact(VTermSpillFile *f, uint64_t offset)
+{
+  uint64_t len = f->len - offset;
+  if(offset < len)
+    return 0;
+
+  const unsigned char *src = vterm_spill_map(f, offset);
+  if(!src && len)
+    return 0;
+
+  uint64_t oldlen = f->len;
+  f->len = 0;
+  if(!vterm_spill_append(f, src, (size_t)len)) {
+    f->len = oldlen;
+    return 0;
+  }
+
+  vterm_spill_truncate(f, len);
+  return 1;
+}
+
+INTERNAL const unsigned char *vterm_spill_map(VTermSpillFile *f, uint64_t offset)
+{
+  if(offset >= f->len)
+    return NULL;
+
+  if(f->len > f->map_len) {
+    if(f->map)
+      munmap(f->map, f->map_len);
+
+    size_t map_len = f->map_len ? f->map_len : MAP_CHUNK;
+    while(map_len < f->len)
+      map_len *= 2;
+
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, f->fd, 0);
+    if(map == MAP_FAILED) {
+      DEBUG_LOG("libvterm: spill mmap failed\n");
+      f->map = NULL;
+      f->map_len = 0;
+      return NULL;
+    }
+
+    f->map = map;
+    f->map_len = map_len;
+  }
+
+  return f->map + offset;
+}
+
+#else
+
+INTERNAL VTermSpillFile *vterm_spill_open(VTerm *vt, const char *path)
+{
+  /* Not supported */
+  return NULL;
+}
+
+INTERNAL void vterm_spill_close(VTermSpillFile *f)
+{
+}
+
+INTERNAL uint64_t vterm_spill_length(const VTermSpillFile *f)
+{
+  return 0;
+}
+
+INTERNAL int vterm_spill_append(VTermSpillFile *f, const unsigned char *data, size_t len)
+{
+  return 0;
+}
+
+INTERNAL void vterm_spill_truncate(VTermSpillFile *f, uint64_t len)
+{
+}
+
+INTERNAL int vterm_spill_compact(VTermSpillFile *f, uint64_t offset)
+{
+  return 0;
+}
+
+INTERNAL const unsigned char *vterm_spill_map(VTermSpillFile *f, uint64_t offset)
+{
+  return NULL;
+}
+
+#endif
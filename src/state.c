@@ -41,6 +41,17 @@ static void updatecursor(VTermState *state, VTermPos *oldpos, int cancel_phantom
       return;
 }
 
+static void set_continuation(VTermState *state, int row, int continuation)
+{
+  VTermLineInfo info = state->lineinfo[row];
+  info.continuation = continuation;
+
+  if(state->callbacks && state->callbacks->setlineinfo)
+    (*state->callbacks->setlineinfo)(row, &info, state->lineinfo + row, state->cbdata);
+
+  state->lineinfo[row] = info;
+}
+
 static void erase(VTermState *state, VTermRect rect, int selective)
 {
   if(rect.end_col == state->cols) {
@@ -48,7 +59,8 @@ static void erase(VTermState *state, VTermRect rect, int selective)
      * marker on the subsequent line
      */
     for(int row = rect.start_row + 1; row < rect.end_row + 1 && row < state->rows; row++)
-      state->lineinfo[row].continuation = 0;
+      if(state->lineinfo[row].continuation)
+        set_continuation(state, row, 0);
   }
 
   if(state->callbacks && state->callbacks->erase)
@@ -64,6 +76,8 @@ static VTermState *vterm_state_new(VTerm *vt)
 
   state->rows = vt->rows;
   state->cols = vt->cols;
+  state->rows_capacity = state->rows;
+  state->cols_capacity = state->cols;
 
   state->mouse_col     = 0;
   state->mouse_row     = 0;
@@ -81,11 +95,10 @@ static VTermState *vterm_state_new(VTerm *vt)
   state->combine_chars_size = 16;
   state->combine_chars = vterm_allocator_malloc(state->vt, state->combine_chars_size * sizeof(state->combine_chars[0]));
 
-  state->tabstops = vterm_allocator_malloc(state->vt, (state->cols + 7) / 8);
+  state->tabstops = vterm_allocator_malloc(state->vt, (state->cols_capacity + 7) / 8);
 
-  state->lineinfos[BUFIDX_PRIMARY]   = vterm_allocator_malloc(state->vt, state->rows * sizeof(VTermLineInfo));
-  /* TODO: Make an 'enable' function */
-  state->lineinfos[BUFIDX_ALTSCREEN] = vterm_allocator_malloc(state->vt, state->rows * sizeof(VTermLineInfo));
+  /* lineinfos[BUFIDX_ALTSCREEN] is allocated when the altscreen is entered */
+  state->lineinfos[BUFIDX_PRIMARY] = vterm_allocator_malloc(state->vt, state->rows_capacity * sizeof(VTermLineInfo));
   state->lineinfo = state->lineinfos[BUFIDX_PRIMARY];
 
   state->encoding_utf8.enc = vterm_lookup_encoding(ENC_UTF8, 'u');
@@ -102,6 +115,10 @@ INTERNAL void vterm_state_free(VTermState *state)
   if(state->lineinfos[BUFIDX_ALTSCREEN])
     vterm_allocator_free(state->vt, state->lineinfos[BUFIDX_ALTSCREEN]);
   vterm_allocator_free(state->vt, state->combine_chars);
+  if(state->csi_dispatch) {
+    vterm_allocator_free(state->vt, state->csi_dispatch);
+    vterm_allocator_free(state->vt, state->csi_handlers);
+  }
   vterm_allocator_free(state->vt, state);
 }
 
@@ -265,25 +282,39 @@ static void set_lineinfo(VTermState *state, int row, int force, int dwl, int dhl
     state->lineinfo[row] = info;
 }
 
+static VTermEncodingInstance *text_encoding(VTermState *state, char first)
+{
+  VTermEncodingInstance *encoding =
+    state->gsingle_set   ? &state->encoding[state->gsingle_set] :
+    !(first & 0x80)      ? &state->encoding[state->gl_set] :
+    state->vt->mode.utf8 ? &state->encoding_utf8 :
+                           &state->encoding[state->gr_set];
+
+  /* All UTF-8 text goes through the one decoder, so that a sequence split
+   * across writes is finished by the same decoder that started it */
+  if(encoding->enc == state->encoding_utf8.enc)
+    return &state->encoding_utf8;
+
+  return encoding;
+}
+
 static int on_text(const char bytes[], size_t len, void *user)
 {
   VTermState *state = user;
 
   VTermPos oldpos = state->pos;
 
-  // We'll have at most len codepoints
-  uint32_t codepoints[len];
+  /* Decode through a fixed scratch buffer, a chunk at a time, so that large
+   * writes don't need a codepoint array sized to the whole input */
+  uint32_t *codepoints = state->text_codepoints;
   int npoints = 0;
   size_t eaten = 0;
 
-  VTermEncodingInstance *encoding =
-    state->gsingle_set     ? &state->encoding[state->gsingle_set] :
-    !(bytes[eaten] & 0x80) ? &state->encoding[state->gl_set] :
-    state->vt->mode.utf8   ? &state->encoding_utf8 :
-                             &state->encoding[state->gr_set];
+  VTermEncodingInstance *encoding = text_encoding(state, bytes[0]);
 
+  /* UTF-8 can emit two codepoints for one byte, so keep a spare slot */
   (*encoding->enc->decode)(encoding->enc, encoding->data,
-      codepoints, &npoints, state->gsingle_set ? 1 : len,
+      codepoints, &npoints, state->gsingle_set ? 1 : TEXT_CHUNK_CODEPOINTS - 1,
       bytes, &eaten, len);
 
   /* There's a chance an encoding (e.g. UTF-8) hasn't found enough bytes yet
@@ -297,129 +328,148 @@ static int on_text(const char bytes[], size_t len, void *user)
 
   int i = 0;
 
-  /* This is a combining char. that needs to be merged with the previous
-   * glyph output */
-  if(vterm_unicode_is_combining(codepoints[i])) {
-    /* See if the cursor has moved since */
-    if(state->pos.row == state->combine_pos.row && state->pos.col == state->combine_pos.col + state->combine_width) {
+  while(1) {
+    /* This is a combining char. that needs to be merged with the previous
+     * glyph output */
+    if(i < npoints && vterm_unicode_is_combining(codepoints[i])) {
+      /* See if the cursor has moved since */
+      if(state->pos.row == state->combine_pos.row && state->pos.col == state->combine_pos.col + state->combine_width) {
 #ifdef DEBUG_GLYPH_COMBINE
-      int printpos;
-      printf("DEBUG: COMBINING SPLIT GLYPH of chars {");
-      for(printpos = 0; state->combine_chars[printpos]; printpos++)
-        printf("U+%04x ", state->combine_chars[printpos]);
-      printf("} + {");
+        int printpos;
+        printf("DEBUG: COMBINING SPLIT GLYPH of chars {");
+        for(printpos = 0; state->combine_chars[printpos]; printpos++)
+          printf("U+%04x ", state->combine_chars[printpos]);
+        printf("} + {");
 #endif
 
-      /* Find where we need to append these combining chars */
-      int saved_i = 0;
-      while(state->combine_chars[saved_i])
-        saved_i++;
-
-      /* Add extra ones */
-      while(i < npoints && vterm_unicode_is_combining(codepoints[i])) {
+        /* Find where we need to append these combining chars */
+        int saved_i = 0;
+        while(state->combine_chars[saved_i])
+          saved_i++;
+
+        /* Add extra ones */
+        while(i < npoints && vterm_unicode_is_combining(codepoints[i])) {
+          if(saved_i >= state->combine_chars_size)
+            grow_combine_buffer(state);
+          state->combine_chars[saved_i++] = codepoints[i++];
+        }
         if(saved_i >= state->combine_chars_size)
           grow_combine_buffer(state);
-        state->combine_chars[saved_i++] = codepoints[i++];
-      }
-      if(saved_i >= state->combine_chars_size)
-        grow_combine_buffer(state);
-      state->combine_chars[saved_i] = 0;
+        state->combine_chars[saved_i] = 0;
 
 #ifdef DEBUG_GLYPH_COMBINE
-      for(; state->combine_chars[printpos]; printpos++)
-        printf("U+%04x ", state->combine_chars[printpos]);
-      printf("}\n");
+        for(; state->combine_chars[printpos]; printpos++)
+          printf("U+%04x ", state->combine_chars[printpos]);
+        printf("}\n");
 #endif
 
-      /* Now render it */
-      putglyph(state, state->combine_chars, state->combine_width, state->combine_pos);
+        /* Now render it */
+        putglyph(state, state->combine_chars, state->combine_width, state->combine_pos);
+      }
+      else {
+        DEBUG_LOG("libvterm: TODO: Skip over split char+combining\n");
+      }
     }
-    else {
-      DEBUG_LOG("libvterm: TODO: Skip over split char+combining\n");
+
+    /* If the decoder stopped only because the scratch buffer is full, the
+     * final glyph may yet gain combining chars from the following bytes, so
+     * hold it back for the next chunk. Single-byte decoders pick GL or GR
+     * from their first byte, so they must stop where that would change */
+    int more = npoints >= TEXT_CHUNK_CODEPOINTS - 1 && eaten < len &&
+        (encoding->enc == state->encoding_utf8.enc || !((bytes[eaten] ^ bytes[0]) & 0x80));
+    int end = npoints;
+    if(more) {
+      while(end > i + 1 && vterm_unicode_is_combining(codepoints[end - 1]))
+        end--;
+      if(end > i + 1)
+        end--;
     }
-  }
 
-  for(; i < npoints; i++) {
-    // Try to find combining characters following this
-    int glyph_starts = i;
-    int glyph_ends;
-    for(glyph_ends = i + 1; glyph_ends < npoints; glyph_ends++)
-      if(!vterm_unicode_is_combining(codepoints[glyph_ends]))
-        break;
+    for(; i < end; i++) {
+      // Try to find combining characters following this
+      int glyph_starts = i;
+      int glyph_ends;
+      for(glyph_ends = i + 1; glyph_ends < end; glyph_ends++)
+        if(!vterm_unicode_is_combining(codepoints[glyph_ends]))
+          break;
 
-    int width = 0;
+      int width = 0;
 
-    uint32_t chars[glyph_ends - glyph_starts + 1];
+      /* Each glyph is kept in combine_chars, in case it has to combine with
+       * more on a later call */
+      while(glyph_ends - glyph_starts >= state->combine_chars_size)
+        grow_combine_buffer(state);
+      uint32_t *chars = state->combine_chars;
 
-    for( ; i < glyph_ends; i++) {
-      chars[i - glyph_starts] = codepoints[i];
-      int this_width = vterm_unicode_width(codepoints[i]);
+      for( ; i < glyph_ends; i++) {
+        chars[i - glyph_starts] = codepoints[i];
+        int this_width = vterm_unicode_width(codepoints[i]);
 #ifdef DEBUG
-      if(this_width < 0) {
-        fprintf(stderr, "Text with negative-width codepoint U+%04x\n", codepoints[i]);
-        abort();
-      }
+        if(this_width < 0) {
+          fprintf(stderr, "Text with negative-width codepoint U+%04x\n", codepoints[i]);
+          abort();
+        }
 #endif
-      width += this_width;
-    }
+        width += this_width;
+      }
 
-    chars[glyph_ends - glyph_starts] = 0;
-    i--;
+      chars[glyph_ends - glyph_starts] = 0;
+      i--;
 
 #ifdef DEBUG_GLYPH_COMBINE
-    int printpos;
-    printf("DEBUG: COMBINED GLYPH of %d chars {", glyph_ends - glyph_starts);
-    for(printpos = 0; printpos < glyph_ends - glyph_starts; printpos++)
-      printf("U+%04x ", chars[printpos]);
-    printf("}, onscreen width %d\n", width);
+      int printpos;
+      printf("DEBUG: COMBINED GLYPH of %d chars {", glyph_ends - glyph_starts);
+      for(printpos = 0; printpos < glyph_ends - glyph_starts; printpos++)
+        printf("U+%04x ", chars[printpos]);
+      printf("}, onscreen width %d\n", width);
 #endif
 
-    if(state->at_phantom || state->pos.col + width > THISROWWIDTH(state)) {
-      linefeed(state);
-      state->pos.col = 0;
-      state->at_phantom = 0;
-      state->lineinfo[state->pos.row].continuation = 1;
-    }
+      if(state->at_phantom || state->pos.col + width > THISROWWIDTH(state)) {
+        linefeed(state);
+        state->pos.col = 0;
+        state->at_phantom = 0;
+        set_continuation(state, state->pos.row, 1);
+      }
 
-    if(state->mode.insert) {
-      /* TODO: This will be a little inefficient for large bodies of text, as
-       * it'll have to 'ICH' effectively before every glyph. We should scan
-       * ahead and ICH as many times as required
-       */
-      VTermRect rect = {
-        .start_row = state->pos.row,
-        .end_row   = state->pos.row + 1,
-        .start_col = state->pos.col,
-        .end_col   = THISROWWIDTH(state),
-      };
-      scroll(state, rect, 0, -1);
-    }
+      if(state->mode.insert) {
+        /* TODO: This will be a little inefficient for large bodies of text, as
+         * it'll have to 'ICH' effectively before every glyph. We should scan
+         * ahead and ICH as many times as required
+         */
+        VTermRect rect = {
+          .start_row = state->pos.row,
+          .end_row   = state->pos.row + 1,
+          .start_col = state->pos.col,
+          .end_col   = THISROWWIDTH(state),
+        };
+        scroll(state, rect, 0, -1);
+      }
 
-    putglyph(state, chars, width, state->pos);
+      putglyph(state, chars, width, state->pos);
 
-    if(i == npoints - 1) {
-      /* End of the buffer. Save the chars in case we have to combine with
-       * more on the next call */
-      int save_i;
-      for(save_i = 0; chars[save_i]; save_i++) {
-        if(save_i >= state->combine_chars_size)
-          grow_combine_buffer(state);
-        state->combine_chars[save_i] = chars[save_i];
-      }
-      if(save_i >= state->combine_chars_size)
-        grow_combine_buffer(state);
-      state->combine_chars[save_i] = 0;
       state->combine_width = width;
       state->combine_pos = state->pos;
-    }
 
-    if(state->pos.col + width >= THISROWWIDTH(state)) {
-      if(state->mode.autowrap)
-        state->at_phantom = 1;
-    }
-    else {
-      state->pos.col += width;
+      if(state->pos.col + width >= THISROWWIDTH(state)) {
+        if(state->mode.autowrap)
+          state->at_phantom = 1;
+      }
+      else {
+        state->pos.col += width;
+      }
     }
+
+    if(!more)
+      break;
+
+    /* Move the held-back glyph to the front and decode the next chunk */
+    npoints -= end;
+    memmove(codepoints, codepoints + end, npoints * sizeof(codepoints[0]));
+    i = 0;
+
+    (*encoding->enc->decode)(encoding->enc, encoding->data,
+        codepoints, &npoints, TEXT_CHUNK_CODEPOINTS - 1,
+        bytes, &eaten, len);
   }
 
   updatecursor(state, &oldpos, 0);
@@ -823,6 +873,11 @@ static void set_dec_mode(VTermState *state, int num, int val)
     state->mode.bracketpaste = val;
     break;
 
+  case 2026: // Synchronized output
+    state->mode.syncoutput = val;
+    settermprop_bool(state, VTERM_PROP_SYNCOUTPUT, val);
+    break;
+
   default:
     DEBUG_LOG("libvterm: Unknown DEC mode %d\n", num);
     return;
@@ -898,6 +953,10 @@ static void request_dec_mode(VTermState *state, int num)
       reply = state->mode.bracketpaste;
       break;
 
+    case 2026:
+      reply = state->mode.syncoutput;
+      break;
+
     default:
       vterm_push_output_sprintf_ctrl(state->vt, C1_CSI, "?%d;%d$y", num, 0);
       return;
@@ -906,6 +965,75 @@ static void request_dec_mode(VTermState *state, int num)
   vterm_push_output_sprintf_ctrl(state->vt, C1_CSI, "?%d;%d$y", num, reply ? 1 : 2);
 }
 
+/* Handler ids for on_csi()'s switch; ids from CSI_N_BUILTIN upwards refer to
+ * handlers set by vterm_state_set_csi_handler() */
+enum {
+  CSI_NONE,
+  CSI_ICH, CSI_CUU, CSI_CUD, CSI_CUF, CSI_CUB, CSI_CNL, CSI_CPL, CSI_CHA,
+  CSI_CUP, CSI_CHT, CSI_ED, CSI_DECSED, CSI_EL, CSI_DECSEL, CSI_IL, CSI_DL,
+  CSI_DCH, CSI_SU, CSI_SD, CSI_ECH, CSI_CBT, CSI_HPA, CSI_HPR, CSI_REP,
+  CSI_DA, CSI_DA2, CSI_VPA, CSI_VPR, CSI_HVP, CSI_TBC, CSI_SM, CSI_DECSET,
+  CSI_HPB, CSI_VPB, CSI_RM, CSI_DECRST, CSI_SGR, CSI_DSR, CSI_DECDSR,
+  CSI_DECSTR, CSI_DECRQM, CSI_DECSCUSR, CSI_DECSCA, CSI_DECSTBM, CSI_DECSLRM,
+  CSI_DECIC, CSI_DECDC,
+
+  CSI_N_BUILTIN
+};
+
+#define CSI(l,i,c) [CSI_DISPATCH_KEY(l,i,c)]
+
+static const uint8_t csi_builtin_dispatch[CSI_DISPATCH_SIZE] = {
+  CSI(0,0,0x40)      = CSI_ICH,
+  CSI(0,0,0x41)      = CSI_CUU,
+  CSI(0,0,0x42)      = CSI_CUD,
+  CSI(0,0,0x43)      = CSI_CUF,
+  CSI(0,0,0x44)      = CSI_CUB,
+  CSI(0,0,0x45)      = CSI_CNL,
+  CSI(0,0,0x46)      = CSI_CPL,
+  CSI(0,0,0x47)      = CSI_CHA,
+  CSI(0,0,0x48)      = CSI_CUP,
+  CSI(0,0,0x49)      = CSI_CHT,
+  CSI(0,0,0x4a)      = CSI_ED,
+  CSI('?',0,0x4a)    = CSI_DECSED,
+  CSI(0,0,0x4b)      = CSI_EL,
+  CSI('?',0,0x4b)    = CSI_DECSEL,
+  CSI(0,0,0x4c)      = CSI_IL,
+  CSI(0,0,0x4d)      = CSI_DL,
+  CSI(0,0,0x50)      = CSI_DCH,
+  CSI(0,0,0x53)      = CSI_SU,
+  CSI(0,0,0x54)      = CSI_SD,
+  CSI(0,0,0x58)      = CSI_ECH,
+  CSI(0,0,0x5a)      = CSI_CBT,
+  CSI(0,0,0x60)      = CSI_HPA,
+  CSI(0,0,0x61)      = CSI_HPR,
+  CSI(0,0,0x62)      = CSI_REP,
+  CSI(0,0,0x63)      = CSI_DA,
+  CSI('>',0,0x63)    = CSI_DA2,
+  CSI(0,0,0x64)      = CSI_VPA,
+  CSI(0,0,0x65)      = CSI_VPR,
+  CSI(0,0,0x66)      = CSI_HVP,
+  CSI(0,0,0x67)      = CSI_TBC,
+  CSI(0,0,0x68)      = CSI_SM,
+  CSI('?',0,0x68)    = CSI_DECSET,
+  CSI(0,0,0x6a)      = CSI_HPB,
+  CSI(0,0,0x6b)      = CSI_VPB,
+  CSI(0,0,0x6c)      = CSI_RM,
+  CSI('?',0,0x6c)    = CSI_DECRST,
+  CSI(0,0,0x6d)      = CSI_SGR,
+  CSI(0,0,0x6e)      = CSI_DSR,
+  CSI('?',0,0x6e)    = CSI_DECDSR,
+  CSI(0,'!',0x70)    = CSI_DECSTR,
+  CSI('?','$',0x70)  = CSI_DECRQM,
+  CSI(0,' ',0x71)    = CSI_DECSCUSR,
+  CSI(0,'"',0x71)    = CSI_DECSCA,
+  CSI(0,0,0x72)      = CSI_DECSTBM,
+  CSI(0,0,0x73)      = CSI_DECSLRM,
+  CSI(0,'\'',0x7D)   = CSI_DECIC,
+  CSI(0,'\'',0x7E)   = CSI_DECDC,
+};
+
+#undef CSI
+
 static int on_csi(const char *leader, const long args[], int argcount, const char *intermed, char command, void *user)
 {
   VTermState *state = user;
@@ -916,31 +1044,26 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
   if(leader && leader[0]) {
     if(leader[1]) // longer than 1 char
       return 0;
-
-    switch(leader[0]) {
-    case '?':
-    case '>':
-      leader_byte = leader[0];
-      break;
-    default:
-      return 0;
-    }
+    leader_byte = leader[0];
   }
 
   if(intermed && intermed[0]) {
     if(intermed[1]) // longer than 1 char
       return 0;
+    intermed_byte = intermed[0];
+  }
 
-    switch(intermed[0]) {
-    case ' ':
-    case '"':
-    case '$':
-    case '\'':
-      intermed_byte = intermed[0];
-      break;
-    default:
-      return 0;
-    }
+  if(!CSI_DISPATCH_VALID(leader_byte, intermed_byte, command))
+    return 0;
+
+  const uint8_t *dispatch = state->csi_dispatch ? state->csi_dispatch : csi_builtin_dispatch;
+  int id = dispatch[CSI_DISPATCH_KEY(leader_byte, intermed_byte, command)];
+
+  if(id >= CSI_N_BUILTIN) {
+    VTermCSIHandlerSlot *h = &state->csi_handlers[id - CSI_N_BUILTIN];
+    if((*h->handler)(leader, args, argcount, intermed, command, h->user))
+      return 1;
+    id = CSI_NONE;
   }
 
   VTermPos oldpos = state->pos;
@@ -954,11 +1077,8 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 #define LBOUND(v,min) if((v) < (min)) (v) = (min)
 #define UBOUND(v,max) if((v) > (max)) (v) = (max)
 
-#define LEADER(l,b) ((l << 8) | b)
-#define INTERMED(i,b) ((i << 16) | b)
-
-  switch(intermed_byte << 16 | leader_byte << 8 | command) {
-  case 0x40: // ICH - ECMA-48 8.3.64
+  switch(id) {
+  case CSI_ICH: // ICH - ECMA-48 8.3.64
     count = CSI_ARG_COUNT(args[0]);
 
     if(!is_cursor_in_scrollregion(state))
@@ -976,51 +1096,51 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case 0x41: // CUU - ECMA-48 8.3.22
+  case CSI_CUU: // CUU - ECMA-48 8.3.22
     count = CSI_ARG_COUNT(args[0]);
     state->pos.row -= count;
     state->at_phantom = 0;
     break;
 
-  case 0x42: // CUD - ECMA-48 8.3.19
+  case CSI_CUD: // CUD - ECMA-48 8.3.19
     count = CSI_ARG_COUNT(args[0]);
     state->pos.row += count;
     state->at_phantom = 0;
     break;
 
-  case 0x43: // CUF - ECMA-48 8.3.20
+  case CSI_CUF: // CUF - ECMA-48 8.3.20
     count = CSI_ARG_COUNT(args[0]);
     state->pos.col += count;
     state->at_phantom = 0;
     break;
 
-  case 0x44: // CUB - ECMA-48 8.3.18
+  case CSI_CUB: // CUB - ECMA-48 8.3.18
     count = CSI_ARG_COUNT(args[0]);
     state->pos.col -= count;
     state->at_phantom = 0;
     break;
 
-  case 0x45: // CNL - ECMA-48 8.3.12
+  case CSI_CNL: // CNL - ECMA-48 8.3.12
     count = CSI_ARG_COUNT(args[0]);
     state->pos.col = 0;
     state->pos.row += count;
     state->at_phantom = 0;
     break;
 
-  case 0x46: // CPL - ECMA-48 8.3.13
+  case CSI_CPL: // CPL - ECMA-48 8.3.13
     count = CSI_ARG_COUNT(args[0]);
     state->pos.col = 0;
     state->pos.row -= count;
     state->at_phantom = 0;
     break;
 
-  case 0x47: // CHA - ECMA-48 8.3.9
+  case CSI_CHA: // CHA - ECMA-48 8.3.9
     val = CSI_ARG_OR(args[0], 1);
     state->pos.col = val-1;
     state->at_phantom = 0;
     break;
 
-  case 0x48: // CUP - ECMA-48 8.3.21
+  case CSI_CUP: // CUP - ECMA-48 8.3.21
     row = CSI_ARG_OR(args[0], 1);
     col = argcount < 2 || CSI_ARG_IS_MISSING(args[1]) ? 1 : CSI_ARG(args[1]);
     // zero-based
@@ -1033,13 +1153,13 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
     state->at_phantom = 0;
     break;
 
-  case 0x49: // CHT - ECMA-48 8.3.10
+  case CSI_CHT: // CHT - ECMA-48 8.3.10
     count = CSI_ARG_COUNT(args[0]);
     tab(state, count, +1);
     break;
 
-  case 0x4a: // ED - ECMA-48 8.3.39
-  case LEADER('?', 0x4a): // DECSED - Selective Erase in Display
+  case CSI_ED: // ED - ECMA-48 8.3.39
+  case CSI_DECSED: // DECSED - Selective Erase in Display
     selective = (leader_byte == '?');
     switch(CSI_ARG(args[0])) {
     case CSI_ARG_MISSING:
@@ -1081,8 +1201,8 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
     }
     break;
 
-  case 0x4b: // EL - ECMA-48 8.3.41
-  case LEADER('?', 0x4b): // DECSEL - Selective Erase in Line
+  case CSI_EL: // EL - ECMA-48 8.3.41
+  case CSI_DECSEL: // DECSEL - Selective Erase in Line
     selective = (leader_byte == '?');
     rect.start_row = state->pos.row;
     rect.end_row   = state->pos.row + 1;
@@ -1104,7 +1224,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case 0x4c: // IL - ECMA-48 8.3.67
+  case CSI_IL: // IL - ECMA-48 8.3.67
     count = CSI_ARG_COUNT(args[0]);
 
     if(!is_cursor_in_scrollregion(state))
@@ -1119,7 +1239,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case 0x4d: // DL - ECMA-48 8.3.32
+  case CSI_DL: // DL - ECMA-48 8.3.32
     count = CSI_ARG_COUNT(args[0]);
 
     if(!is_cursor_in_scrollregion(state))
@@ -1134,7 +1254,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case 0x50: // DCH - ECMA-48 8.3.26
+  case CSI_DCH: // DCH - ECMA-48 8.3.26
     count = CSI_ARG_COUNT(args[0]);
 
     if(!is_cursor_in_scrollregion(state))
@@ -1152,7 +1272,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case 0x53: // SU - ECMA-48 8.3.147
+  case CSI_SU: // SU - ECMA-48 8.3.147
     count = CSI_ARG_COUNT(args[0]);
 
     rect.start_row = state->scrollregion_top;
@@ -1164,7 +1284,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case 0x54: // SD - ECMA-48 8.3.113
+  case CSI_SD: // SD - ECMA-48 8.3.113
     count = CSI_ARG_COUNT(args[0]);
 
     rect.start_row = state->scrollregion_top;
@@ -1176,7 +1296,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case 0x58: // ECH - ECMA-48 8.3.38
+  case CSI_ECH: // ECH - ECMA-48 8.3.38
     count = CSI_ARG_COUNT(args[0]);
 
     rect.start_row = state->pos.row;
@@ -1188,24 +1308,24 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
     erase(state, rect, 0);
     break;
 
-  case 0x5a: // CBT - ECMA-48 8.3.7
+  case CSI_CBT: // CBT - ECMA-48 8.3.7
     count = CSI_ARG_COUNT(args[0]);
     tab(state, count, -1);
     break;
 
-  case 0x60: // HPA - ECMA-48 8.3.57
+  case CSI_HPA: // HPA - ECMA-48 8.3.57
     col = CSI_ARG_OR(args[0], 1);
     state->pos.col = col-1;
     state->at_phantom = 0;
     break;
 
-  case 0x61: // HPR - ECMA-48 8.3.59
+  case CSI_HPR: // HPR - ECMA-48 8.3.59
     count = CSI_ARG_COUNT(args[0]);
     state->pos.col += count;
     state->at_phantom = 0;
     break;
 
-  case 0x62: { // REP - ECMA-48 8.3.103
+  case CSI_REP: { // REP - ECMA-48 8.3.103
     const int row_width = THISROWWIDTH(state);
     count = CSI_ARG_COUNT(args[0]);
     col = state->pos.col + count;
@@ -1223,18 +1343,18 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
     break;
   }
 
-  case 0x63: // DA - ECMA-48 8.3.24
+  case CSI_DA: // DA - ECMA-48 8.3.24
     val = CSI_ARG_OR(args[0], 0);
     if(val == 0)
       // DEC VT100 response
       vterm_push_output_sprintf_ctrl(state->vt, C1_CSI, "?1;2c");
     break;
 
-  case LEADER('>', 0x63): // DEC secondary Device Attributes
+  case CSI_DA2: // DEC secondary Device Attributes
     vterm_push_output_sprintf_ctrl(state->vt, C1_CSI, ">%d;%d;%dc", 0, 100, 0);
     break;
 
-  case 0x64: // VPA - ECMA-48 8.3.158
+  case CSI_VPA: // VPA - ECMA-48 8.3.158
     row = CSI_ARG_OR(args[0], 1);
     state->pos.row = row-1;
     if(state->mode.origin)
@@ -1242,13 +1362,13 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
     state->at_phantom = 0;
     break;
 
-  case 0x65: // VPR - ECMA-48 8.3.160
+  case CSI_VPR: // VPR - ECMA-48 8.3.160
     count = CSI_ARG_COUNT(args[0]);
     state->pos.row += count;
     state->at_phantom = 0;
     break;
 
-  case 0x66: // HVP - ECMA-48 8.3.63
+  case CSI_HVP: // HVP - ECMA-48 8.3.63
     row = CSI_ARG_OR(args[0], 1);
     col = argcount < 2 || CSI_ARG_IS_MISSING(args[1]) ? 1 : CSI_ARG(args[1]);
     // zero-based
@@ -1261,7 +1381,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
     state->at_phantom = 0;
     break;
 
-  case 0x67: // TBC - ECMA-48 8.3.154
+  case CSI_TBC: // TBC - ECMA-48 8.3.154
     val = CSI_ARG_OR(args[0], 0);
 
     switch(val) {
@@ -1283,44 +1403,44 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
     }
     break;
 
-  case 0x68: // SM - ECMA-48 8.3.125
+  case CSI_SM: // SM - ECMA-48 8.3.125
     if(!CSI_ARG_IS_MISSING(args[0]))
       set_mode(state, CSI_ARG(args[0]), 1);
     break;
 
-  case LEADER('?', 0x68): // DEC private mode set
+  case CSI_DECSET: // DEC private mode set
     if(!CSI_ARG_IS_MISSING(args[0]))
       set_dec_mode(state, CSI_ARG(args[0]), 1);
     break;
 
-  case 0x6a: // HPB - ECMA-48 8.3.58
+  case CSI_HPB: // HPB - ECMA-48 8.3.58
     count = CSI_ARG_COUNT(args[0]);
     state->pos.col -= count;
     state->at_phantom = 0;
     break;
 
-  case 0x6b: // VPB - ECMA-48 8.3.159
+  case CSI_VPB: // VPB - ECMA-48 8.3.159
     count = CSI_ARG_COUNT(args[0]);
     state->pos.row -= count;
     state->at_phantom = 0;
     break;
 
-  case 0x6c: // RM - ECMA-48 8.3.106
+  case CSI_RM: // RM - ECMA-48 8.3.106
     if(!CSI_ARG_IS_MISSING(args[0]))
       set_mode(state, CSI_ARG(args[0]), 0);
     break;
 
-  case LEADER('?', 0x6c): // DEC private mode reset
+  case CSI_DECRST: // DEC private mode reset
     if(!CSI_ARG_IS_MISSING(args[0]))
       set_dec_mode(state, CSI_ARG(args[0]), 0);
     break;
 
-  case 0x6d: // SGR - ECMA-48 8.3.117
+  case CSI_SGR: // SGR - ECMA-48 8.3.117
     vterm_state_setpen(state, args, argcount);
     break;
 
-  case 0x6e: // DSR - ECMA-48 8.3.35
-  case LEADER('?', 0x6e): // DECDSR
+  case CSI_DSR: // DSR - ECMA-48 8.3.35
+  case CSI_DECDSR: // DECDSR
     val = CSI_ARG_OR(args[0], 0);
 
     {
@@ -1341,15 +1461,15 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
     break;
 
 
-  case LEADER('!', 0x70): // DECSTR - DEC soft terminal reset
+  case CSI_DECSTR: // DECSTR - DEC soft terminal reset
     vterm_state_reset(state, 0);
     break;
 
-  case LEADER('?', INTERMED('$', 0x70)):
+  case CSI_DECRQM: // DECRQM - DEC request mode
     request_dec_mode(state, CSI_ARG(args[0]));
     break;
 
-  case INTERMED(' ', 0x71): // DECSCUSR - DEC set cursor shape
+  case CSI_DECSCUSR: // DECSCUSR - DEC set cursor shape
     val = CSI_ARG_OR(args[0], 1);
 
     switch(val) {
@@ -1381,7 +1501,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case INTERMED('"', 0x71): // DECSCA - DEC select character protection attribute
+  case CSI_DECSCA: // DECSCA - DEC select character protection attribute
     val = CSI_ARG_OR(args[0], 0);
 
     switch(val) {
@@ -1395,7 +1515,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case 0x72: // DECSTBM - DEC custom
+  case CSI_DECSTBM: // DECSTBM - DEC custom
     state->scrollregion_top = CSI_ARG_OR(args[0], 1) - 1;
     state->scrollregion_bottom = argcount < 2 || CSI_ARG_IS_MISSING(args[1]) ? -1 : CSI_ARG(args[1]);
     LBOUND(state->scrollregion_top, 0);
@@ -1414,7 +1534,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case 0x73: // DECSLRM - DEC custom
+  case CSI_DECSLRM: // DECSLRM - DEC custom
     // Always allow setting these margins, just they won't take effect without DECVSSM
     state->scrollregion_left = CSI_ARG_OR(args[0], 1) - 1;
     state->scrollregion_right = argcount < 2 || CSI_ARG_IS_MISSING(args[1]) ? -1 : CSI_ARG(args[1]);
@@ -1435,7 +1555,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case INTERMED('\'', 0x7D): // DECIC
+  case CSI_DECIC: // DECIC
     count = CSI_ARG_COUNT(args[0]);
 
     if(!is_cursor_in_scrollregion(state))
@@ -1450,7 +1570,7 @@ static int on_csi(const char *leader, const long args[], int argcount, const cha
 
     break;
 
-  case INTERMED('\'', 0x7E): // DECDC
+  case CSI_DECDC: // DECDC
     count = CSI_ARG_COUNT(args[0]);
 
     if(!is_cursor_in_scrollregion(state))
@@ -1530,6 +1650,14 @@ static int on_osc(int command, VTermStringFragment frag, void *user)
       settermprop_string(state, VTERM_PROP_TITLE, frag);
       return 1;
 
+    case 8:
+      /* Delivered whole as set up by vterm_obtain_state(), unless the
+       * embedder changed that */
+      if(frag.initial && frag.final) {
+        vterm_state_sethyperlink(state, frag);
+        return 1;
+      }
+      /* fallthrough */
     default:
       if(state->fallbacks && state->fallbacks->osc)
         if((*state->fallbacks->osc)(command, frag, state->fbdata))
@@ -1645,57 +1773,50 @@ static int on_resize(int rows, int cols, void *user)
   VTermState *state = user;
   VTermPos oldpos = state->pos;
 
-  if(cols != state->cols) {
-    unsigned char *newtabstops = vterm_allocator_malloc(state->vt, (cols + 7) / 8);
-
-    /* TODO: This can all be done much more efficiently bytewise */
-    int col;
-    for(col = 0; col < state->cols && col < cols; col++) {
-      unsigned char mask = 1 << (col & 7);
-      if(state->tabstops[col >> 3] & mask)
-        newtabstops[col >> 3] |= mask;
-      else
-        newtabstops[col >> 3] &= ~mask;
-      }
-
-    for( ; col < cols; col++) {
-      unsigned char mask = 1 << (col & 7);
-      if(col % 8 == 0)
-        newtabstops[col >> 3] |= mask;
-      else
-        newtabstops[col >> 3] &= ~mask;
-    }
+  if(cols > state->cols_capacity) {
+    int capacity = GROW_CAPACITY(state->cols_capacity, cols);
+    unsigned char *newtabstops = vterm_allocator_malloc(state->vt, (capacity + 7) / 8);
+    memcpy(newtabstops, state->tabstops, (state->cols_capacity + 7) / 8);
 
     vterm_allocator_free(state->vt, state->tabstops);
     state->tabstops = newtabstops;
+    state->cols_capacity = capacity;
   }
 
-  if(rows != state->rows) {
+  /* TODO: This can all be done much more efficiently bytewise */
+  for(int col = state->cols; col < cols; col++) {
+    unsigned char mask = 1 << (col & 7);
+    if(col % 8 == 0)
+      state->tabstops[col >> 3] |= mask;
+    else
+      state->tabstops[col >> 3] &= ~mask;
+  }
+
+  if(rows > state->rows_capacity) {
+    int capacity = GROW_CAPACITY(state->rows_capacity, rows);
+
     for(int bufidx = BUFIDX_PRIMARY; bufidx <= BUFIDX_ALTSCREEN; bufidx++) {
       VTermLineInfo *oldlineinfo = state->lineinfos[bufidx];
       if(!oldlineinfo)
         continue;
 
-      VTermLineInfo *newlineinfo = vterm_allocator_malloc(state->vt, rows * sizeof(VTermLineInfo));
-
-      int row;
-      for(row = 0; row < state->rows && row < rows; row++) {
-        newlineinfo[row] = oldlineinfo[row];
-      }
-
-      for( ; row < rows; row++) {
-        newlineinfo[row] = (VTermLineInfo){
-          .doublewidth = 0,
-        };
-      }
+      VTermLineInfo *newlineinfo = vterm_allocator_malloc(state->vt, capacity * sizeof(VTermLineInfo));
+      memcpy(newlineinfo, oldlineinfo, state->rows * sizeof(VTermLineInfo));
 
       vterm_allocator_free(state->vt, state->lineinfos[bufidx]);
       state->lineinfos[bufidx] = newlineinfo;
     }
 
+    state->rows_capacity = capacity;
     state->lineinfo = state->lineinfos[state->mode.alt_screen ? BUFIDX_ALTSCREEN : BUFIDX_PRIMARY];
   }
 
+  for(int bufidx = BUFIDX_PRIMARY; bufidx <= BUFIDX_ALTSCREEN; bufidx++)
+    for(int row = state->rows; state->lineinfos[bufidx] && row < rows; row++)
+      state->lineinfos[bufidx][row] = (VTermLineInfo){
+        .doublewidth = 0,
+      };
+
   state->rows = rows;
   state->cols = cols;
 
@@ -1706,6 +1827,7 @@ static int on_resize(int rows, int cols, void *user)
 
   VTermStateFields fields = {
     .pos = state->pos,
+    .lineinfos = { [BUFIDX_PRIMARY] = state->lineinfos[BUFIDX_PRIMARY], [BUFIDX_ALTSCREEN] = state->lineinfos[BUFIDX_ALTSCREEN] },
   };
 
   if(state->callbacks && state->callbacks->resize)
@@ -1713,6 +1835,10 @@ static int on_resize(int rows, int cols, void *user)
 
   state->pos = fields.pos;
 
+  state->lineinfos[BUFIDX_PRIMARY] = fields.lineinfos[BUFIDX_PRIMARY];
+  state->lineinfos[BUFIDX_ALTSCREEN] = fields.lineinfos[BUFIDX_ALTSCREEN];
+  state->lineinfo = state->lineinfos[state->mode.alt_screen ? BUFIDX_ALTSCREEN : BUFIDX_PRIMARY];
+
   if(state->at_phantom && state->pos.col < cols-1) {
     state->at_phantom = 0;
     state->pos.col++;
@@ -1748,6 +1874,9 @@ VTermState *vterm_obtain_state(VTerm *vt)
 
   vterm_parser_set_callbacks(vt, &parser_callbacks, state);
 
+  /* One too long still ends the current link */
+  vterm_parser_accumulate_osc(vt, 8, HYPERLINK_MAX, VTERM_STRING_EMPTY);
+
   return state;
 }
 
@@ -1777,14 +1906,21 @@ void vterm_state_reset(VTermState *state, int hard)
     else
       clear_col_tabstop(state, col);
 
-  for(int row = 0; row < state->rows; row++)
+  for(int row = 0; row < state->rows; row++) {
     set_lineinfo(state, row, FORCE, DWL_OFF, DHL_OFF);
+    /* The top row no longer follows on from anything */
+    if(state->lineinfo[row].continuation)
+      set_continuation(state, row, 0);
+  }
 
   if(state->callbacks && state->callbacks->initpen)
     (*state->callbacks->initpen)(state->cbdata);
 
   vterm_state_resetpen(state);
 
+  if(state->hyperlink)
+    vterm_state_sethyperlink(state, (VTermStringFragment){ .str = "", .initial = true, .final = true });
+
   VTermEncoding *default_enc = state->vt->mode.utf8 ?
       vterm_lookup_encoding(ENC_UTF8,      'u') :
       vterm_lookup_encoding(ENC_SINGLE_94, 'B');
@@ -1806,6 +1942,11 @@ void vterm_state_reset(VTermState *state, int hard)
   settermprop_bool(state, VTERM_PROP_CURSORBLINK,   1);
   settermprop_int (state, VTERM_PROP_CURSORSHAPE,   VTERM_PROP_CURSORSHAPE_BLOCK);
 
+  if(state->mode.syncoutput) {
+    state->mode.syncoutput = 0;
+    settermprop_bool(state, VTERM_PROP_SYNCOUTPUT, 0);
+  }
+
   if(hard) {
     state->pos.row = 0;
     state->pos.col = 0;
@@ -1858,6 +1999,50 @@ void *vterm_state_get_unrecognised_fbdata(VTermState *state)
   return state->fbdata;
 }
 
+#define CSI_USER_HANDLERS (256 - CSI_N_BUILTIN)
+
+int vterm_state_set_csi_handler(VTermState *state, char leader, char intermed, char command, VTermCSIHandler *handler, void *user)
+{
+  if(!CSI_DISPATCH_VALID(leader, intermed, command))
+    return 0;
+
+  int key = CSI_DISPATCH_KEY(leader, intermed, command);
+
+  if(!state->csi_dispatch) {
+    if(!handler)
+      return 1;
+
+    state->csi_dispatch = vterm_allocator_malloc(state->vt, CSI_DISPATCH_SIZE);
+    memcpy(state->csi_dispatch, csi_builtin_dispatch, CSI_DISPATCH_SIZE);
+    state->csi_handlers = vterm_allocator_malloc(state->vt, CSI_USER_HANDLERS * sizeof(VTermCSIHandlerSlot));
+  }
+
+  int id = state->csi_dispatch[key];
+
+  if(!handler) {
+    if(id >= CSI_N_BUILTIN)
+      state->csi_handlers[id - CSI_N_BUILTIN].handler = NULL;
+    state->csi_dispatch[key] = csi_builtin_dispatch[key];
+    return 1;
+  }
+
+  if(id < CSI_N_BUILTIN) {
+    int slot;
+    for(slot = 0; slot < CSI_USER_HANDLERS; slot++)
+      if(!state->csi_handlers[slot].handler)
+        break;
+    if(slot == CSI_USER_HANDLERS)
+      return 0;
+
+    id = CSI_N_BUILTIN + slot;
+    state->csi_dispatch[key] = id;
+  }
+
+  state->csi_handlers[id - CSI_N_BUILTIN].handler = handler;
+  state->csi_handlers[id - CSI_N_BUILTIN].user    = user;
+  return 1;
+}
+
 int vterm_state_set_termprop(VTermState *state, VTermProp prop, VTermValue *val)
 {
   /* Only store the new value of the property if usercode said it was happy.
@@ -1885,6 +2070,11 @@ int vterm_state_set_termprop(VTermState *state, VTermProp prop, VTermValue *val)
     return 1;
   case VTERM_PROP_ALTSCREEN:
     state->mode.alt_screen = val->boolean;
+    if(state->mode.alt_screen && !state->lineinfos[BUFIDX_ALTSCREEN])
+      state->lineinfos[BUFIDX_ALTSCREEN] = vterm_allocator_malloc(state->vt, state->rows_capacity * sizeof(VTermLineInfo));
+    else if(state->mode.alt_screen)
+      /* Entering erases it, line attributes included */
+      memset(state->lineinfos[BUFIDX_ALTSCREEN], 0, state->rows * sizeof(VTermLineInfo));
     state->lineinfo = state->lineinfos[state->mode.alt_screen ? BUFIDX_ALTSCREEN : BUFIDX_PRIMARY];
     if(state->mode.alt_screen) {
       VTermRect rect = {
@@ -1905,6 +2095,9 @@ int vterm_state_set_termprop(VTermState *state, VTermProp prop, VTermValue *val)
     if(val->number == VTERM_PROP_MOUSE_MOVE)
       state->mouse_flags |= MOUSE_WANT_MOVE;
     return 1;
+  case VTERM_PROP_SYNCOUTPUT:
+    state->mode.syncoutput = val->boolean;
+    return 1;
 
   case VTERM_N_PROPS:
     return 0;
@@ -1929,3 +2122,28 @@ const VTermLineInfo *vterm_state_get_lineinfo(const VTermState *state, int row)
 {
   return state->lineinfo + row;
 }
+
+INTERNAL int vterm_state_release_altscreen(VTermState *state)
+{
+  if(!state->lineinfos[BUFIDX_ALTSCREEN] || state->lineinfo == state->lineinfos[BUFIDX_ALTSCREEN])
+    return 0;
+
+  vterm_allocator_free(state->vt, state->lineinfos[BUFIDX_ALTSCREEN]);
+  state->lineinfos[BUFIDX_ALTSCREEN] = NULL;
+  return 1;
+}
+
+INTERNAL void vterm_state_add_memory_usage(const VTermState *state, VTermMemoryUsage *usage)
+{
+  usage->core += sizeof(VTermState);
+
+  for(int bufidx = BUFIDX_PRIMARY; bufidx <= BUFIDX_ALTSCREEN; bufidx++)
+    if(state->lineinfos[bufidx])
+      usage->lineinfo += state->rows_capacity * sizeof(VTermLineInfo);
+
+  usage->tabstops += (state->cols_capacity + 7) / 8;
+  usage->combine  += state->combine_chars_size * sizeof(state->combine_chars[0]);
+
+  if(state->csi_dispatch)
+    usage->interned += CSI_DISPATCH_SIZE + CSI_USER_HANDLERS * sizeof(VTermCSIHandlerSlot);
+}
@@ -72,6 +72,14 @@ void vterm_free(VTerm *vt)
   vterm_allocator_free(vt, vt->outbuffer);
   vterm_allocator_free(vt, vt->tmpbuffer);
 
+  if(vt->inputv_buffer)
+    vterm_allocator_free(vt, vt->inputv_buffer);
+
+  if(vt->string_accums)
+    vterm_allocator_free(vt, vt->string_accums);
+  if(vt->strbuffer)
+    vterm_allocator_free(vt, vt->strbuffer);
+
   vterm_allocator_free(vt, vt);
 }
 
@@ -93,7 +101,7 @@ void vterm_get_size(const VTerm *vt, int *rowsp, int *colsp)
     *colsp = vt->cols;
 }
 
-void vterm_set_size(VTerm *vt, int rows, int cols)
+static void apply_size(VTerm *vt, int rows, int cols)
 {
   vt->rows = rows;
   vt->cols = cols;
@@ -102,6 +110,98 @@ void vterm_set_size(VTerm *vt, int rows, int cols)
     (*vt->parser.callbacks->resize)(rows, cols, vt->parser.cbdata);
 }
 
+void vterm_set_size(VTerm *vt, int rows, int cols)
+{
+  if(vt->defer_resize) {
+    vt->pending_rows = rows;
+    vt->pending_cols = cols;
+    return;
+  }
+
+  apply_size(vt, rows, cols);
+}
+
+void vterm_set_defer_resize(VTerm *vt, int defer)
+{
+  vt->defer_resize = defer;
+  if(!defer)
+    vterm_apply_pending_resize(vt);
+}
+
+INTERNAL void vterm_apply_pending_resize(VTerm *vt)
+{
+  if(!vt->pending_rows)
+    return;
+
+  int rows = vt->pending_rows;
+  int cols = vt->pending_cols;
+  vt->pending_rows = 0;
+  vt->pending_cols = 0;
+
+  /* A window dragged back to where it started needs nothing doing */
+  if(rows != vt->rows || cols != vt->cols)
+    apply_size(vt, rows, cols);
+}
+
+void vterm_get_memory_usage(const VTerm *vt, VTermMemoryUsage *usage)
+{
+  *usage = (VTermMemoryUsage){ 0 };
+
+  usage->core = sizeof(VTerm);
+
+  usage->input = vt->strbuffer_len +
+    vt->string_accums_len * sizeof(VTermStringAccumulator) +
+    (vt->inputv_buffer ? INPUTV_BUFFER_SIZE : 0);
+
+  usage->output = vt->outbuffer_len + vt->tmpbuffer_len;
+
+  if(vt->state)
+    vterm_state_add_memory_usage(vt->state, usage);
+  if(vt->screen)
+    vterm_screen_add_memory_usage(vt->screen, usage);
+
+  usage->total = usage->core + usage->input + usage->output +
+    usage->screen + usage->altscreen + usage->lineinfo + usage->tabstops +
+    usage->combine + usage->scrollback + usage->interned + usage->extras;
+}
+
+void vterm_hibernate(VTerm *vt)
+{
+  if(vt->screen)
+    vterm_screen_hibernate(vt->screen);
+  if(vt->state)
+    vterm_state_release_altscreen(vt->state);
+
+  /* Scratch space, allocated again when next needed */
+  if(vt->inputv_buffer) {
+    vterm_allocator_free(vt, vt->inputv_buffer);
+    vt->inputv_buffer = NULL;
+  }
+  if(vt->strbuffer && vt->parser.state < OSC) {
+    vterm_allocator_free(vt, vt->strbuffer);
+    vt->strbuffer = NULL;
+    vt->strbuffer_len = 0;
+    vt->strbuffer_cur = 0;
+  }
+}
+
+int vterm_is_hibernating(const VTerm *vt)
+{
+  return vt->screen && vterm_screen_is_hibernating(vt->screen);
+}
+
+int vterm_release_altscreen(VTerm *vt)
+{
+  int released = 0;
+
+  if(vt->screen)
+    released |= vterm_screen_release_altscreen(vt->screen);
+  if(vt->state)
+    released |= vterm_state_release_altscreen(vt->state);
+
+  return released;
+}
+
 int vterm_get_utf8(const VTerm *vt)
 {
   return vt->mode.utf8;
@@ -244,6 +344,7 @@ VTermValueType vterm_get_attr_type(VTermAttr attr)
     case VTERM_ATTR_FONT:       return VTERM_VALUETYPE_INT;
     case VTERM_ATTR_FOREGROUND: return VTERM_VALUETYPE_COLOR;
     case VTERM_ATTR_BACKGROUND: return VTERM_VALUETYPE_COLOR;
+    case VTERM_ATTR_HYPERLINK:  return VTERM_VALUETYPE_STRING;
 
     case VTERM_N_ATTRS: return 0;
   }
@@ -261,6 +362,7 @@ VTermValueType vterm_get_prop_type(VTermProp prop)
     case VTERM_PROP_REVERSE:       return VTERM_VALUETYPE_BOOL;
     case VTERM_PROP_CURSORSHAPE:   return VTERM_VALUETYPE_INT;
     case VTERM_PROP_MOUSE:         return VTERM_VALUETYPE_INT;
+    case VTERM_PROP_SYNCOUTPUT:    return VTERM_VALUETYPE_BOOL;
 
     case VTERM_N_PROPS: return 0;
   }
@@ -24,11 +24,37 @@
 #define CSI_ARGS_MAX 16
 #define CSI_LEADER_MAX 16
 
+#define INPUTV_BUFFER_SIZE 4096
+
+/* Longest OSC 8 payload accepted; longer ones are ignored */
+#define HYPERLINK_MAX 4096
+
 #define BUFIDX_PRIMARY   0
 #define BUFIDX_ALTSCREEN 1
 
+/* Dense index of a CSI by its (optional) leader, intermediate and final byte */
+#define CSI_DISPATCH_KEY(l,i,c) \
+  ((((l) ? (l) - 0x3b : 0) * 17 + ((i) ? (i) - 0x1f : 0)) * 64 + ((c) - 0x40))
+#define CSI_DISPATCH_SIZE (5 * 17 * 64)
+#define CSI_DISPATCH_VALID(l,i,c) \
+  ((!(l) || ((l) >= 0x3c && (l) <= 0x3f)) && \
+   (!(i) || ((i) >= 0x20 && (i) <= 0x2f)) && \
+   (c) >= 0x40 && (c) <= 0x7e)
+
 typedef struct VTermEncoding VTermEncoding;
 
+typedef struct {
+  bool dcs;
+  int command; // OSC number, or DCS final byte
+  size_t max_len;
+  VTermStringOverflow overflow;
+} VTermStringAccumulator;
+
+typedef struct {
+  VTermCSIHandler *handler;
+  void *user;
+} VTermCSIHandlerSlot;
+
 typedef struct {
   VTermEncoding *enc;
 
@@ -36,19 +62,6 @@ typedef struct {
   char           data[4*sizeof(uint32_t)];
 } VTermEncodingInstance;
 
-struct VTermPen
-{
-  VTermColor fg;
-  VTermColor bg;
-  unsigned int bold:1;
-  unsigned int underline:2;
-  unsigned int italic:1;
-  unsigned int blink:1;
-  unsigned int reverse:1;
-  unsigned int strike:1;
-  unsigned int font:4; /* To store 0-9 */
-};
-
 struct VTermState
 {
   VTerm *vt;
@@ -59,9 +72,21 @@ struct VTermState
   const VTermStateFallbacks *fallbacks;
   void *fbdata;
 
+  /* CSI handler ids by CSI_DISPATCH_KEY(); NULL means the built-in table,
+   * until vterm_state_set_csi_handler() makes a copy */
+  uint8_t *csi_dispatch;
+  VTermCSIHandlerSlot *csi_handlers;
+
   int rows;
   int cols;
 
+  /* What lineinfos and tabstops have room for; resizing within this doesn't
+   * reallocate them. Grows with some headroom, as resizes come in runs */
+  int rows_capacity;
+  int cols_capacity;
+#define GROW_CAPACITY(cap,want) \
+  ((want) <= (cap) ? (cap) : (want) > (cap) + (cap) / 4 ? (want) : (cap) + (cap) / 4)
+
   /* Current cursor position */
   VTermPos pos;
 
@@ -102,6 +127,10 @@ struct VTermState
   int combine_width; // The width of the glyph above
   VTermPos combine_pos;   // Position before movement
 
+  /* Scratch space on_text decodes into, one chunk at a time */
+#define TEXT_CHUNK_CODEPOINTS 1024
+  uint32_t text_codepoints[TEXT_CHUNK_CODEPOINTS];
+
   struct {
     unsigned int keypad:1;
     unsigned int cursor:1;
@@ -117,6 +146,7 @@ struct VTermState
     unsigned int leftrightmargin:1;
     unsigned int bracketpaste:1;
     unsigned int report_focus:1;
+    unsigned int syncoutput:1;
   } mode;
 
   VTermEncodingInstance encoding[4], encoding_utf8;
@@ -131,6 +161,7 @@ struct VTermState
   int bold_is_highbright;
 
   unsigned int protected_cell : 1;
+  unsigned int hyperlink      : 1; /* an OSC 8 link is open */
 
   /* Saved state under DEC mode 1048/1049 */
   struct {
@@ -158,6 +189,12 @@ struct VTerm
   int rows;
   int cols;
 
+  /* While resizes are deferred, the last size asked for; pending_rows is 0
+   * if there isn't one */
+  bool defer_resize;
+  int pending_rows;
+  int pending_cols;
+
   struct {
     unsigned int utf8:1;
     unsigned int ctrl8bit:1;
@@ -166,6 +203,8 @@ struct VTerm
   struct {
     enum VTermParserState {
       NORMAL,
+      ESCAPE,
+      ESCAPE_INTERMED,
       CSI_LEADER,
       CSI_ARGS,
       CSI_INTERMED,
@@ -174,9 +213,12 @@ struct VTerm
       /* below here are the "string states" */
       OSC,
       DCS,
-    } state;
+      /* string states having just seen an ESC */
+      OSC_ESC,
+      DCS_ESC,
 
-    bool in_esc : 1;
+      PARSER_STATES
+    } state;
 
     int intermedlen;
     char intermed[INTERMED_MAX];
@@ -202,8 +244,21 @@ struct VTerm
     void *cbdata;
 
     bool string_initial;
+
+    /* Set from string_accums at the start of each string; max_len 0 if this
+     * one is delivered in fragments */
+    VTermStringAccumulator accum;
+    bool string_overflowed;
   } parser;
 
+  VTermStringAccumulator *string_accums;
+  int string_accums_len;
+
+  /* Payload of an accumulated string that arrived in pieces */
+  char  *strbuffer;
+  size_t strbuffer_len;
+  size_t strbuffer_cur;
+
   /* len == malloc()ed size; cur == number of valid bytes */
 
   VTermOutputCallback *outfunc;
@@ -216,6 +271,9 @@ struct VTerm
   char  *tmpbuffer;
   size_t tmpbuffer_len;
 
+  /* Gathers short discontiguous segments for vterm_input_writev() */
+  char  *inputv_buffer;
+
   VTermState *state;
   VTermScreen *screen;
 };
@@ -235,6 +293,8 @@ typedef enum {
 void *vterm_allocator_malloc(VTerm *vt, size_t size);
 void  vterm_allocator_free(VTerm *vt, void *ptr);
 
+void vterm_apply_pending_resize(VTerm *vt);
+
 void vterm_push_output_bytes(VTerm *vt, const char *bytes, size_t len);
 void vterm_push_output_vsprintf(VTerm *vt, const char *format, va_list args);
 void vterm_push_output_sprintf(VTerm *vt, const char *format, ...);
@@ -242,12 +302,15 @@ void vterm_push_output_sprintf_ctrl(VTerm *vt, unsigned char ctrl, const char *f
 void vterm_push_output_sprintf_dcs(VTerm *vt, const char *fmt, ...);
 
 void vterm_state_free(VTermState *state);
+void vterm_state_add_memory_usage(const VTermState *state, VTermMemoryUsage *usage);
+int  vterm_state_release_altscreen(VTermState *state);
 
 void vterm_state_newpen(VTermState *state);
 void vterm_state_resetpen(VTermState *state);
 void vterm_state_setpen(VTermState *state, const long args[], int argcount);
 int  vterm_state_getpen(VTermState *state, long args[], int argcount);
 void vterm_state_savepen(VTermState *state, int save);
+void vterm_state_sethyperlink(VTermState *state, VTermStringFragment payload);
 
 enum {
   C1_SS3 = 0x8f,
@@ -259,6 +322,85 @@ enum {
 void vterm_state_push_output_sprintf_CSI(VTermState *vts, const char *format, ...);
 
 void vterm_screen_free(VTermScreen *screen);
+void vterm_screen_add_memory_usage(const VTermScreen *screen, VTermMemoryUsage *usage);
+void vterm_screen_hibernate(VTermScreen *screen);
+bool vterm_screen_is_hibernating(const VTermScreen *screen);
+int  vterm_screen_release_altscreen(VTermScreen *screen);
+
+#define LZ_HASH_BITS 12
+/* Most that vterm_lz_compress() can write for len bytes */
+#define LZ_COMPRESS_BOUND(len) ((len) + (len) / 255 + 16)
+
+size_t vterm_lz_compress(const unsigned char *src, size_t len, unsigned char *dst, uint32_t table[]);
+size_t vterm_lz_decompress(const unsigned char *src, size_t len, unsigned char *dst, size_t dstlen);
+
+typedef struct VTermSpillFile VTermSpillFile;
+
+VTermSpillFile *vterm_spill_open(VTerm *vt, const char *path);
+void     vterm_spill_close(VTermSpillFile *f);
+uint64_t vterm_spill_length(const VTermSpillFile *f);
+int      vterm_spill_append(VTermSpillFile *f, const unsigned char *data, size_t len);
+void     vterm_spill_truncate(VTermSpillFile *f, uint64_t len);
+int      vterm_spill_compact(VTermSpillFile *f, uint64_t offset);
+const unsigned char *vterm_spill_map(VTermSpillFile *f, uint64_t offset);
+
+typedef struct VTermScrollback VTermScrollback;
+
+VTermScrollback *vterm_scrollback_new(VTerm *vt, size_t max_lines);
+void   vterm_scrollback_free(VTermScrollback *sb);
+void   vterm_scrollback_set_max_lines(VTermScrollback *sb, size_t max_lines);
+void   vterm_scrollback_set_compression(VTermScrollback *sb, size_t hot_lines, size_t block_lines);
+int    vterm_scrollback_set_spill(VTermScrollback *sb, const char *path);
+void   vterm_scrollback_clear(VTermScrollback *sb);
+void   vterm_scrollback_trim(VTermScrollback *sb);
+size_t vterm_scrollback_count(const VTermScrollback *sb);
+void   vterm_scrollback_push(VTermScrollback *sb, int cols, const VTermScreenCell *cells, bool continuation);
+int    vterm_scrollback_pop(VTermScrollback *sb, int cols, VTermScreenCell *cells, bool *continuation);
+int    vterm_scrollback_get_line(VTermScrollback *sb, size_t index, int cols, VTermScreenCell *cells, VTermLineInfo *info);
+/* Lines are numbered from the oldest ever pushed; end is one past the newest */
+uint64_t vterm_scrollback_end(const VTermScrollback *sb);
+int      vterm_scrollback_width(const VTermScrollback *sb);
+size_t   vterm_scrollback_memory_usage(const VTermScrollback *sb);
+
+typedef struct VTermSearchIndex VTermSearchIndex;
+
+VTermSearchIndex *vterm_search_index_new(VTerm *vt, VTermScrollback *sb);
+void vterm_search_index_free(VTermSearchIndex *idx);
+size_t vterm_search_index_memory_usage(const VTermSearchIndex *idx);
+void vterm_search_index_push(VTermSearchIndex *idx, VTermScrollback *sb, int cols, const VTermScreenCell *cells, bool continuation);
+void vterm_search_index_pop(VTermSearchIndex *idx, VTermScrollback *sb);
+int  vterm_search(VTerm *vt, VTermSearchIndex *idx, VTermScrollback *sb, VTermScreen *screen,
+    const char *query, size_t len, VTermSearchFlags flags, VTermPos from, VTermSearchHit hits[], int max_hits);
+
+typedef struct VTermMatcher VTermMatcher;
+
+VTermMatcher *vterm_matcher_new(VTerm *vt, VTermMatchKind kinds, int rows);
+void vterm_matcher_free(VTermMatcher *m);
+size_t vterm_matcher_memory_usage(const VTermMatcher *m);
+void vterm_matcher_resize(VTermMatcher *m, int rows);
+void vterm_matcher_damage(VTermMatcher *m, int start_row, int end_row);
+void vterm_matcher_moverect(VTermMatcher *m, VTermRect dest, VTermRect src, bool whole_rows);
+int  vterm_matcher_get(VTermMatcher *m, VTermScreen *screen, int row, VTermMatch matches[], int max_matches);
+
+typedef struct VTermSnapshots VTermSnapshots;
+
+VTermSnapshots *vterm_snapshots_new(VTerm *vt, VTermScreen *screen, int rows, int cols);
+void vterm_snapshots_free(VTermSnapshots *s);
+size_t vterm_snapshots_memory_usage(const VTermSnapshots *s);
+void vterm_snapshots_resize(VTermSnapshots *s, int rows, int cols);
+void vterm_snapshots_damage(VTermSnapshots *s, int start_row, int end_row);
+void vterm_snapshots_moverect(VTermSnapshots *s, VTermRect dest, VTermRect src, bool whole_rows);
+void vterm_snapshots_publish(VTermSnapshots *s);
+const VTermScreenSnapshot *vterm_snapshots_acquire(VTermSnapshots *s);
+
+typedef struct VTermShmExport VTermShmExport;
+
+VTermShmExport *vterm_shm_export_new(VTerm *vt, VTermScreen *screen, const char *name, int rows, int cols);
+void vterm_shm_export_free(VTermShmExport *e);
+size_t vterm_shm_export_memory_usage(const VTermShmExport *e);
+void vterm_shm_export_resize(VTermShmExport *e, int rows, int cols);
+void vterm_shm_export_damage(VTermShmExport *e, int start_row, int end_row);
+void vterm_shm_export_update(VTermShmExport *e);
 
 VTermEncoding *vterm_lookup_encoding(VTermEncodingType type, char designation);
 
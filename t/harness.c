@@ -1,8 +1,12 @@
 #include "vterm.h"
 #include "../src/vterm_internal.h" // We pull in some internal bits too
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define streq(a,b) (!strcmp(a,b))
 #define strstartswith(a,b) (!strncmp(a,b,strlen(b)))
@@ -79,9 +83,86 @@ static void print_color(const VTermColor *col)
   printf(")");
 }
 
+/* Counts what the terminal has allocated, to check vterm_get_memory_usage(),
+ * and how many allocations it has made since last asked or reset */
+#define ALLOC_HEADER 16
+static size_t allocated;
+static int allocations;
+
+/* Row hashes seen since reset, so ?row_hashes can name each one by a letter */
+static uint64_t row_hashes_seen[26];
+static int row_hashes_seen_len;
+
+static void *counting_malloc(size_t size, void *allocdata)
+{
+  size_t *p = calloc(1, ALLOC_HEADER + size);
+  if(!p)
+    return NULL;
+  *p = size;
+  allocated += size;
+  allocations++;
+  return (char *)p + ALLOC_HEADER;
+}
+
+static void counting_free(void *ptr, void *allocdata)
+{
+  if(!ptr)
+    return;
+  size_t *p = (size_t *)((char *)ptr - ALLOC_HEADER);
+  allocated -= *p;
+  free(p);
+}
+
+static VTermAllocatorFunctions counting_allocator = {
+  .malloc = &counting_malloc,
+  .free   = &counting_free,
+};
+
 static VTerm *vt;
 static VTermState *state;
 static VTermScreen *screen;
+static const VTermScreenSnapshot *snapshot; /* as last acquired */
+static char shm_name[1024 + 16];
+
+static size_t consumed; /* by the last PUSHBUDGET */
+
+#define SHM_MAX_COLS 256
+
+/* Reads one row of the exported screen back as another process would */
+static int shm_read(int row, VTermShmHeader *hdr, uint8_t *lineinfo, uint64_t *version, VTermShmCell cells[])
+{
+  int fd = shm_open(shm_name, O_RDONLY, 0);
+  if(fd == -1)
+    return 0;
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(VTermShmHeader))
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+    return 0;
+
+  const VTermShmHeader *h = map;
+  int ok;
+  uint32_t seq;
+  do {
+    seq = vterm_shm_read_begin(h);
+    *hdr = *h;
+    ok = hdr->magic == VTERM_SHM_MAGIC && hdr->size <= (uint64_t)st.st_size &&
+      row >= 0 && row < hdr->rows && hdr->cols <= SHM_MAX_COLS;
+    if(ok) {
+      const unsigned char *base = map;
+      *lineinfo = base[hdr->lineinfo_offset + row];
+      *version = ((const uint64_t *)(base + hdr->row_version_offset))[row];
+      memcpy(cells, base + hdr->cells_offset + sizeof(VTermShmCell) * row * hdr->cols,
+          sizeof(VTermShmCell) * hdr->cols);
+    }
+  } while(vterm_shm_read_retry(h, seq));
+
+  munmap(map, st.st_size);
+  return ok;
+}
 
 static VTermEncodingInstance encoding;
 
@@ -373,6 +454,8 @@ static int state_setpenattr(VTermAttr attr, VTermValue *val, void *user)
   case VTERM_ATTR_BACKGROUND:
     state_pen.background = val->color;
     break;
+  case VTERM_ATTR_HYPERLINK:
+    break;
 
   case VTERM_N_ATTRS:
     return 0;
@@ -381,6 +464,13 @@ static int state_setpenattr(VTermAttr attr, VTermValue *val, void *user)
   return 1;
 }
 
+static VTermAttrMask state_pen_changed; /* as last passed to setpen */
+static int state_setpen(const VTermPen *pen, VTermAttrMask changed, void *user)
+{
+  state_pen_changed = changed;
+  return 0; // so the setpenattr calls still follow
+}
+
 static int state_setlineinfo(int row, const VTermLineInfo *newinfo, const VTermLineInfo *oldinfo, void *user)
 {
   return 1;
@@ -393,6 +483,7 @@ VTermStateCallbacks state_cbs = {
   .moverect    = moverect,
   .erase       = state_erase,
   .setpenattr  = state_setpenattr,
+  .setpen      = state_setpen,
   .settermprop = settermprop,
   .setlineinfo = state_setlineinfo,
 };
@@ -479,6 +570,31 @@ static int screen_sb_popline(int cols, VTermScreenCell *cells, void *user)
   return 1;
 }
 
+static void print_screen_cell(VTermScreenCell *cell)
+{
+  printf("{");
+  for(int i = 0; i < VTERM_MAX_CHARS_PER_CELL && cell->chars[i]; i++) {
+    printf("%s0x%x", i ? "," : "", cell->chars[i]);
+  }
+  printf("} width=%d attrs={", cell->width);
+  if(cell->attrs.bold)      printf("B");
+  if(cell->attrs.underline) printf("U%d", cell->attrs.underline);
+  if(cell->attrs.italic)    printf("I");
+  if(cell->attrs.blink)     printf("K");
+  if(cell->attrs.reverse)   printf("R");
+  if(cell->attrs.font)      printf("F%d", cell->attrs.font);
+  printf("} ");
+  if(cell->attrs.dwl)       printf("dwl ");
+  if(cell->attrs.dhl)       printf("dhl-%s ", cell->attrs.dhl == 2 ? "bottom" : "top");
+  printf("fg=");
+  vterm_screen_convert_color_to_rgb(screen, &cell->fg);
+  print_color(&cell->fg);
+  printf(" bg=");
+  vterm_screen_convert_color_to_rgb(screen, &cell->bg);
+  print_color(&cell->bg);
+  printf("\n");
+}
+
 VTermScreenCallbacks screen_cbs = {
   .damage      = screen_damage,
   .moverect    = moverect,
@@ -490,7 +606,7 @@ VTermScreenCallbacks screen_cbs = {
 
 int main(int argc, char **argv)
 {
-  char line[1024] = {0};
+  char line[16384] = {0};
   int flag;
 
   int err;
@@ -506,7 +622,7 @@ int main(int argc, char **argv)
 
     if(streq(line, "INIT")) {
       if(!vt)
-        vt = vterm_new(25, 80);
+        vt = vterm_new_with_allocator(25, 80, &counting_allocator, NULL);
 
       vterm_output_set_callback(vt, term_output, NULL);
     }
@@ -558,6 +674,34 @@ int main(int argc, char **argv)
         }
     }
 
+    else if(strstartswith(line, "ACCUMULATE ")) {
+      /* ACCUMULATE OSC|DCS command max_len DISCARD|TRUNCATE|EMPTY */
+      char kind[4], command[8], policy[9];
+      size_t max_len;
+      sscanf(line + 11, "%3s %7s %zu %8s", kind, command, &max_len, policy);
+      VTermStringOverflow overflow = streq(policy, "TRUNCATE") ? VTERM_STRING_TRUNCATE :
+                                     streq(policy, "EMPTY")    ? VTERM_STRING_EMPTY :
+                                                                 VTERM_STRING_DISCARD;
+      if(streq(kind, "DCS"))
+        vterm_parser_accumulate_dcs(vt, command[0], max_len, overflow);
+      else
+        vterm_parser_accumulate_osc(vt, atoi(command), max_len, overflow);
+    }
+
+    else if(strstartswith(line, "CSIHANDLER ")) {
+      /* CSIHANDLER [-]LIF, with . for no leader or intermediate */
+      char *linep = line + 11;
+      int set = 1;
+      if(linep[0] == '-') {
+        set = 0;
+        linep++;
+      }
+      char l = linep[0] == '.' ? 0 : linep[0];
+      char i = linep[1] == '.' ? 0 : linep[1];
+      if(!vterm_state_set_csi_handler(state, l, i, linep[2], set ? parser_csi : NULL, NULL))
+        fprintf(stderr, "! CSIHANDLER failed\n");
+    }
+
     else if(strstartswith(line, "WANTSCREEN") && (line[10] == '\0' || line[10] == ' ')) {
       if(!screen)
         screen = vterm_obtain_screen(vt);
@@ -599,11 +743,80 @@ int main(int argc, char **argv)
         }
     }
 
+    else if(strstartswith(line, "SCROLLBACK ")) {
+      size_t max_lines, hot_lines, block_lines;
+      int n = sscanf(line + 11, "%zu %zu %zu", &max_lines, &hot_lines, &block_lines);
+      if(n != 1 && n != 3) {
+        printf("! SCROLLBACK unrecognised input\n");
+        goto abort_line;
+      }
+      vterm_screen_set_scrollback(screen, max_lines);
+      if(n == 3)
+        vterm_screen_set_scrollback_compression(screen, hot_lines, block_lines);
+    }
+
+    else if(sscanf(line, "SEARCHINDEX %d", &flag)) {
+      vterm_screen_enable_search_index(screen, flag);
+    }
+
+    else if(sscanf(line, "SNAPSHOTS %d", &flag)) {
+      vterm_screen_enable_snapshots(screen, flag);
+    }
+
+    else if(streq(line, "PUBLISH")) {
+      vterm_screen_publish_snapshot(screen);
+    }
+
+    else if(streq(line, "ACQUIRE")) {
+      vterm_snapshot_release(snapshot);
+      snapshot = vterm_screen_acquire_snapshot(screen);
+      if(!snapshot)
+        printf("! ACQUIRE failed\n");
+    }
+
+    else if(sscanf(line, "MATCHER %d", &flag)) {
+      vterm_screen_enable_matcher(screen, flag);
+    }
+
+    else if(strstartswith(line, "SCROLLBACKFILE ")) {
+      char path[1024 + 16];
+      snprintf(path, sizeof path, "%.1000s.%d", line + 15, (int)getpid());
+      if(!vterm_screen_set_scrollback_file(screen, path))
+        printf("! SCROLLBACKFILE failed\n");
+    }
+
+    else if(streq(line, "SHMEXPORT")) {
+      vterm_screen_export_shm(screen, NULL);
+    }
+
+    else if(strstartswith(line, "SHMEXPORT ")) {
+      /* Made unique to this run; anything left by an earlier one whose pid
+       * this has been given again is cleared out first */
+      snprintf(shm_name, sizeof shm_name, "%.1000s.%d", line + 10, (int)getpid());
+      shm_unlink(shm_name);
+      if(!vterm_screen_export_shm(screen, shm_name))
+        printf("! SHMEXPORT failed\n");
+    }
+
+    else if(streq(line, "HIBERNATE")) {
+      vterm_hibernate(vt);
+    }
+
+    else if(streq(line, "RELEASEALT")) {
+      vterm_release_altscreen(vt);
+    }
+
+    else if(streq(line, "SHMUPDATE")) {
+      vterm_screen_update_shm(screen);
+    }
+
     else if(sscanf(line, "UTF8 %d", &flag)) {
       vterm_set_utf8(vt, flag);
     }
 
     else if(streq(line, "RESET")) {
+      allocations = 0;
+      row_hashes_seen_len = 0;
       if(state) {
         vterm_state_reset(state, 1);
         vterm_state_get_cursorpos(state, &state_pos);
@@ -622,6 +835,10 @@ int main(int argc, char **argv)
       vterm_set_size(vt, rows, cols);
     }
 
+    else if(strstartswith(line, "DEFERRESIZE ")) {
+      vterm_set_defer_resize(vt, atoi(line + 12));
+    }
+
     else if(strstartswith(line, "PUSH ")) {
       char *bytes = line + 5;
       size_t len = inplace_hex2bytes(bytes);
@@ -630,6 +847,48 @@ int main(int argc, char **argv)
         fprintf(stderr, "! short write\n");
     }
 
+    else if(strstartswith(line, "PUSHV ") || strstartswith(line, "PUSHVC ")) {
+      /* PUSHV gives each segment its own allocation; PUSHVC lays them out end
+       * to end in one */
+      bool contiguous = line[5] == 'C';
+      VTermInputSegment segs[16];
+      int nsegs = 0;
+
+      size_t total = 0;
+      for(char *hex = strtok(line + 6, " "); hex && nsegs < 16; hex = strtok(NULL, " ")) {
+        segs[nsegs].bytes = hex;
+        segs[nsegs].len = inplace_hex2bytes(hex);
+        total += segs[nsegs++].len;
+      }
+
+      char *whole = contiguous ? malloc(total) : NULL;
+      size_t offset = 0;
+      for(int i = 0; i < nsegs; i++) {
+        char *bytes = contiguous ? whole + offset : malloc(segs[i].len);
+        memcpy(bytes, segs[i].bytes, segs[i].len);
+        segs[i].bytes = bytes;
+        offset += segs[i].len;
+      }
+
+      size_t written = vterm_input_writev(vt, segs, nsegs);
+      if(written < total)
+        fprintf(stderr, "! short write\n");
+
+      if(contiguous)
+        free(whole);
+      else
+        for(int i = 0; i < nsegs; i++)
+          free((char *)segs[i].bytes);
+    }
+
+    else if(strstartswith(line, "PUSHBUDGET ")) {
+      char *bytes;
+      size_t max_bytes = strtoul(line + 11, &bytes, 10);
+      bytes++;
+      size_t len = inplace_hex2bytes(bytes);
+      consumed = vterm_input_write_budget(vt, bytes, len, max_bytes);
+    }
+
     else if(streq(line, "WANTENCODING")) {
       /* This isn't really external API but it's hard to get this out any
        * other way
@@ -744,7 +1003,10 @@ int main(int argc, char **argv)
     }
 
     else if(strstartswith(line, "DAMAGEFLUSH")) {
-      vterm_screen_flush_damage(screen);
+      if(streq(line + 11, " FORCE"))
+        vterm_screen_force_flush_damage(screen);
+      else
+        vterm_screen_flush_damage(screen);
     }
 
     else if(line[0] == '?') {
@@ -760,6 +1022,9 @@ int main(int argc, char **argv)
         else
           printf("%d,%d\n", state_pos.row, state_pos.col);
       }
+      else if(streq(line, "?pen_changed")) {
+        printf("0x%x\n", state_pen_changed);
+      }
       else if(strstartswith(line, "?pen ")) {
         char *linep = line + 5;
         while(linep[0] == ' ')
@@ -827,6 +1092,49 @@ int main(int argc, char **argv)
         else
           printf("?\n");
       }
+      else if(streq(line, "?consumed")) {
+        printf("%zu\n", consumed);
+      }
+      else if(streq(line, "?hibernating")) {
+        printf("%d\n", vterm_is_hibernating(vt));
+      }
+      else if(streq(line, "?size")) {
+        int rows, cols;
+        vterm_get_size(vt, &rows, &cols);
+        printf("%d,%d\n", rows, cols);
+      }
+      else if(streq(line, "?row_hashes")) {
+        int rows, cols;
+        vterm_get_size(vt, &rows, &cols);
+        for(int row = 0; row < rows; row++) {
+          uint64_t hash = vterm_screen_get_row_hash(screen, row);
+          int i;
+          for(i = 0; i < row_hashes_seen_len; i++)
+            if(row_hashes_seen[i] == hash)
+              break;
+          if(i == row_hashes_seen_len && i < 26)
+            row_hashes_seen[row_hashes_seen_len++] = hash;
+          printf("%c", i < 26 ? 'a' + i : '?');
+        }
+        printf("\n");
+      }
+      else if(streq(line, "?allocations")) {
+        printf("%d\n", allocations);
+        allocations = 0;
+      }
+      else if(streq(line, "?altscreen_allocated")) {
+        VTermMemoryUsage usage;
+        int rows, cols;
+        vterm_get_memory_usage(vt, &usage);
+        vterm_get_size(vt, &rows, &cols);
+        printf("buffer=%d lineinfo=%d\n", usage.altscreen > 0,
+            usage.lineinfo >= 2 * rows * sizeof(VTermLineInfo));
+      }
+      else if(streq(line, "?memory_unaccounted")) {
+        VTermMemoryUsage usage;
+        vterm_get_memory_usage(vt, &usage);
+        printf("%ld\n", (long)allocated - (long)usage.total);
+      }
       else if(strstartswith(line, "?lineinfo ")) {
         char *linep = line + 10;
         int row;
@@ -918,26 +1226,175 @@ int main(int argc, char **argv)
         VTermScreenCell cell;
         if(!vterm_screen_get_cell(screen, pos, &cell))
           goto abort_line;
-        printf("{");
-        for(int i = 0; i < VTERM_MAX_CHARS_PER_CELL && cell.chars[i]; i++) {
-          printf("%s0x%x", i ? "," : "", cell.chars[i]);
-        }
-        printf("} width=%d attrs={", cell.width);
-        if(cell.attrs.bold)      printf("B");
-        if(cell.attrs.underline) printf("U%d", cell.attrs.underline);
-        if(cell.attrs.italic)    printf("I");
-        if(cell.attrs.blink)     printf("K");
-        if(cell.attrs.reverse)   printf("R");
-        if(cell.attrs.font)      printf("F%d", cell.attrs.font);
-        printf("} ");
-        if(cell.attrs.dwl)       printf("dwl ");
-        if(cell.attrs.dhl)       printf("dhl-%s ", cell.attrs.dhl == 2 ? "bottom" : "top");
-        printf("fg=");
-        vterm_screen_convert_color_to_rgb(screen, &cell.fg);
-        print_color(&cell.fg);
-        printf(" bg=");
-        vterm_screen_convert_color_to_rgb(screen, &cell.bg);
-        print_color(&cell.bg);
+        print_screen_cell(&cell);
+      }
+      else if(streq(line, "?sb_count")) {
+        printf("%zu\n", vterm_screen_get_scrollback_count(screen));
+      }
+      else if(strstartswith(line, "?sb_line ")) {
+        size_t index;
+        if(sscanf(line + 9, "%zu", &index) < 1) {
+          printf("! sb_line unrecognised input\n");
+          goto abort_line;
+        }
+        int rows, cols;
+        vterm_get_size(vt, &rows, &cols);
+        VTermScreenCell *cells = malloc(sizeof(VTermScreenCell) * cols);
+        VTermLineInfo info;
+        if(!vterm_screen_get_scrollback_line(screen, index, cols, cells, &info)) {
+          free(cells);
+          printf("! sb_line failed\n");
+          goto abort_line;
+        }
+        int eol = cols;
+        while(eol && !cells[eol-1].chars[0])
+          eol--;
+        printf("%s", info.continuation ? "cont" : "");
+        for(int c = 0; c < eol; c++)
+          printf("%s%02X", c || info.continuation ? " " : "", cells[c].chars[0]);
+        printf("\n");
+        free(cells);
+      }
+      else if(strstartswith(line, "?sb_cell ")) {
+        size_t index;
+        int col;
+        if(sscanf(line + 9, "%zu,%d", &index, &col) < 2) {
+          printf("! sb_cell unrecognised input\n");
+          goto abort_line;
+        }
+        int rows, cols;
+        vterm_get_size(vt, &rows, &cols);
+        VTermScreenCell *cells = malloc(sizeof(VTermScreenCell) * cols);
+        if(col < 0 || col >= cols ||
+           !vterm_screen_get_scrollback_line(screen, index, cols, cells, NULL)) {
+          free(cells);
+          printf("! sb_cell failed\n");
+          goto abort_line;
+        }
+        print_screen_cell(&cells[col]);
+        free(cells);
+      }
+      else if(strstartswith(line, "?search ")) {
+        /* ?search FLAGS ROW,COL TEXT; FLAGS has i for caseless, b for backward, or is - */
+        char flagstr[8];
+        VTermPos from;
+        int n;
+        if(sscanf(line + 8, "%7s %d,%d %n", flagstr, &from.row, &from.col, &n) < 3) {
+          printf("! search unrecognised input\n");
+          goto abort_line;
+        }
+        VTermSearchFlags flags = 0;
+        if(strchr(flagstr, 'i'))
+          flags |= VTERM_SEARCH_CASELESS;
+        if(strchr(flagstr, 'b'))
+          flags |= VTERM_SEARCH_BACKWARD;
+        const char *text = line + 8 + n;
+        VTermSearchHit hits[64];
+        int nhits = vterm_screen_search(screen, text, strlen(text), flags, from, hits, 64);
+        if(!nhits)
+          printf("-");
+        for(int i = 0; i < nhits; i++)
+          printf("%s%d,%d-%d,%d", i ? " " : "",
+              hits[i].start.row, hits[i].start.col, hits[i].end.row, hits[i].end.col);
+        printf("\n");
+      }
+      else if(strstartswith(line, "?snapshot_line ")) {
+        int row;
+        if(sscanf(line + 15, "%d", &row) < 1) {
+          printf("! snapshot_line unrecognised input\n");
+          goto abort_line;
+        }
+        const VTermLineInfo *info = snapshot ? vterm_snapshot_get_lineinfo(snapshot, row) : NULL;
+        if(!info) {
+          printf("! snapshot_line failed\n");
+          goto abort_line;
+        }
+        int cols;
+        vterm_snapshot_get_size(snapshot, NULL, &cols);
+        VTermScreenCell cell;
+        int eol = cols;
+        while(eol && vterm_snapshot_get_cell(snapshot, (VTermPos){ .row = row, .col = eol-1 }, &cell) && !cell.chars[0])
+          eol--;
+        printf("%s", info->continuation ? "cont" : "");
+        for(int c = 0; c < eol; c++) {
+          vterm_snapshot_get_cell(snapshot, (VTermPos){ .row = row, .col = c }, &cell);
+          printf("%s%02X", c || info->continuation ? " " : "", cell.chars[0]);
+        }
+        printf("\n");
+      }
+      else if(streq(line, "?snapshot_cursor")) {
+        if(!snapshot) {
+          printf("! snapshot_cursor failed\n");
+          goto abort_line;
+        }
+        VTermPos pos;
+        vterm_snapshot_get_cursorpos(snapshot, &pos);
+        printf("%d,%d%s\n", pos.row, pos.col, vterm_snapshot_get_cursor_visible(snapshot) ? "" : " hidden");
+      }
+      else if(streq(line, "?snapshot_generation")) {
+        if(!snapshot) {
+          printf("! snapshot_generation failed\n");
+          goto abort_line;
+        }
+        printf("%llu\n", (unsigned long long)vterm_snapshot_get_generation(snapshot));
+      }
+      else if(strstartswith(line, "?shm_line ") || strstartswith(line, "?shm_rowversion ")) {
+        int row;
+        if(sscanf(strchr(line, ' ') + 1, "%d", &row) < 1) {
+          printf("! shm unrecognised input\n");
+          goto abort_line;
+        }
+        VTermShmHeader hdr;
+        uint8_t lineinfo;
+        uint64_t version;
+        VTermShmCell cells[SHM_MAX_COLS];
+        if(!shm_read(row, &hdr, &lineinfo, &version, cells)) {
+          printf("! shm read failed\n");
+          goto abort_line;
+        }
+        if(strstartswith(line, "?shm_rowversion ")) {
+          printf("%llu\n", (unsigned long long)version);
+        }
+        else {
+          int eol = hdr.cols;
+          while(eol && !cells[eol-1].chars[0])
+            eol--;
+          int cont = lineinfo & VTERM_SHM_LINE_CONTINUATION;
+          printf("%s", cont ? "cont" : "");
+          for(int c = 0; c < eol; c++)
+            printf("%s%02X", c || cont ? " " : "", cells[c].chars[0]);
+          printf("\n");
+        }
+      }
+      else if(streq(line, "?shm_cursor") || streq(line, "?shm_generation")) {
+        VTermShmHeader hdr;
+        uint8_t lineinfo;
+        uint64_t version;
+        VTermShmCell cells[SHM_MAX_COLS];
+        if(!shm_read(0, &hdr, &lineinfo, &version, cells)) {
+          printf("! shm read failed\n");
+          goto abort_line;
+        }
+        if(streq(line, "?shm_cursor"))
+          printf("%d,%d%s\n", hdr.cursor_row, hdr.cursor_col, hdr.cursor_visible ? "" : " hidden");
+        else
+          printf("%llu\n", (unsigned long long)hdr.generation);
+      }
+      else if(strstartswith(line, "?matches ")) {
+        int row;
+        if(sscanf(line + 9, "%d", &row) < 1) {
+          printf("! matches unrecognised input\n");
+          goto abort_line;
+        }
+        VTermMatch matches[16];
+        int nmatches = vterm_screen_get_matches(screen, row, matches, 16);
+        if(!nmatches)
+          printf("-");
+        for(int i = 0; i < nmatches; i++)
+          printf("%s%s %d,%d-%d,%d", i ? " " : "",
+              matches[i].kind == VTERM_MATCH_URL      ? "url" :
+              matches[i].kind == VTERM_MATCH_FILELINE ? "fileline" : "hash",
+              matches[i].start.row, matches[i].start.col, matches[i].end.row, matches[i].end.col);
         printf("\n");
       }
       else if(strstartswith(line, "?screen_eol ")) {
@@ -951,6 +1408,23 @@ int main(int argc, char **argv)
         }
         printf("%d\n", vterm_screen_is_eol(screen, pos));
       }
+      else if(strstartswith(line, "?screen_hyperlink ")) {
+        char *linep = line + 18;
+        while(linep[0] == ' ')
+          linep++;
+        VTermPos pos;
+        if(sscanf(linep, "%d,%d\n", &pos.row, &pos.col) < 2) {
+          printf("! screen_hyperlink unrecognised input\n");
+          goto abort_line;
+        }
+        const char *uri, *id;
+        if(!vterm_screen_get_hyperlink(screen, pos, &uri, &id))
+          printf("none\n");
+        else if(id)
+          printf("%s id=%s\n", uri, id);
+        else
+          printf("%s\n", uri);
+      }
       else if(strstartswith(line, "?screen_attrs_extent ")) {
         char *linep = line + 21;
         while(linep[0] == ' ')
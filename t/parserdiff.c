@@ -0,0 +1,600 @@
+/* Differential test of the table-driven parser in src/parser.c against the
+ * hand-written one it replaced, which is kept here as a reference. Both are
+ * fed the PUSH lines of the named .test files, whole and one byte at a time,
+ * and then random input split at random points; any difference in the
+ * callbacks they make is reported.
+ */
+
+#include "../src/vterm_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  char  *buf;
+  size_t len, size;
+} Log;
+
+static void logf_(Log *log, const char *fmt, ...)
+{
+  va_list args;
+
+  while(1) {
+    va_start(args, fmt);
+    int n = vsnprintf(log->buf + log->len, log->size - log->len, fmt, args);
+    va_end(args);
+
+    if(n < log->size - log->len) {
+      log->len += n;
+      return;
+    }
+
+    log->size = log->size ? log->size * 2 : 4096;
+    log->buf = realloc(log->buf, log->size);
+  }
+}
+
+static void loghex(Log *log, const char *s, size_t len)
+{
+  while(len--)
+    logf_(log, "%02x", (unsigned char)(s++)[0]);
+}
+
+/* Callbacks shared by both parsers; behave like the ones in t/harness.c */
+
+static int cb_text(const char bytes[], size_t len, void *user)
+{
+  int i;
+  /* Eat at most a few bytes, to exercise resuming text mid-buffer */
+  for(i = 0; i < len && i < 5; i++) {
+    unsigned char b = bytes[i];
+    if(b < 0x20 || b == 0x7f || (b >= 0x80 && b < 0xa0))
+      break;
+  }
+
+  logf_(user, "text ");
+  loghex(user, bytes, i);
+  logf_(user, "\n");
+
+  return i;
+}
+
+static int cb_control(unsigned char control, void *user)
+{
+  logf_(user, "control %02x\n", control);
+  return 1;
+}
+
+static int cb_escape(const char bytes[], size_t len, void *user)
+{
+  logf_(user, "escape ");
+  loghex(user, bytes, len);
+  logf_(user, "\n");
+  return len;
+}
+
+static int cb_csi(const char *leader, const long args[], int argcount, const char *intermed, char command, void *user)
+{
+  logf_(user, "csi %02x L=%s", command, leader ? leader : "-");
+  for(int i = 0; i < argcount; i++)
+    logf_(user, " %lx", args[i]);
+  logf_(user, " I=%s\n", intermed ? intermed : "-");
+  return 1;
+}
+
+static int cb_osc(int command, VTermStringFragment frag, void *user)
+{
+  logf_(user, "osc %d %d%d ", command, frag.initial, frag.final);
+  loghex(user, frag.str, frag.len);
+  logf_(user, "\n");
+  return 1;
+}
+
+static int cb_dcs(const char *command, size_t commandlen, VTermStringFragment frag, void *user)
+{
+  logf_(user, "dcs ");
+  loghex(user, command, commandlen);
+  logf_(user, " %d%d ", frag.initial, frag.final);
+  loghex(user, frag.str, frag.len);
+  logf_(user, "\n");
+  return 1;
+}
+
+static VTermParserCallbacks cbs = {
+  .text    = cb_text,
+  .control = cb_control,
+  .escape  = cb_escape,
+  .csi     = cb_csi,
+  .osc     = cb_osc,
+  .dcs     = cb_dcs,
+};
+
+/* The reference parser. This is vterm_input_write() as it was before the
+ * parser became table-driven, with three fixes that the new parser also has:
+ *  - an ESC inside a string is never delivered as part of the string
+ *  - OSC terminated by an 8-bit ST straight after its command delivers an
+ *    empty string
+ *  - CSI arguments beyond CSI_ARGS_MAX overwrite the last one
+ */
+
+typedef struct {
+  bool utf8;
+
+  enum { R_NORMAL, R_CSI_LEADER, R_CSI_ARGS, R_CSI_INTERMED, R_OSC_COMMAND, R_DCS_COMMAND, R_OSC, R_DCS } state;
+  bool in_esc;
+
+  int intermedlen;
+  char intermed[INTERMED_MAX];
+
+  int leaderlen;
+  char leader[CSI_LEADER_MAX];
+  int argi;
+  long args[CSI_ARGS_MAX];
+
+  int osc_command;
+
+  int dcs_commandlen;
+  char dcs_command[CSI_LEADER_MAX];
+
+  bool string_initial;
+
+  Log *log;
+} RefParser;
+
+static void ref_string_fragment(RefParser *p, const char *str, size_t len, bool final)
+{
+  VTermStringFragment frag = {
+    .str     = str,
+    .len     = len,
+    .initial = p->string_initial,
+    .final   = final,
+  };
+
+  if(p->state == R_OSC)
+    cb_osc(p->osc_command, frag, p->log);
+  else if(p->state == R_DCS && len)
+    cb_dcs(p->dcs_command, p->dcs_commandlen, frag, p->log);
+
+  p->string_initial = false;
+}
+
+static size_t ref_string_len(RefParser *p, const char *string_start, const char *end)
+{
+  size_t len = end - string_start;
+  if(len && p->in_esc)
+    len--;
+  return len;
+}
+
+static void ref_escape(RefParser *p, char command)
+{
+  char seq[INTERMED_MAX+1];
+
+  size_t len = p->intermedlen;
+  strncpy(seq, p->intermed, len);
+  seq[len++] = command;
+  seq[len]   = 0;
+
+  cb_escape(seq, len, p->log);
+}
+
+static void ref_input_write(RefParser *p, const char *bytes, size_t len)
+{
+  size_t pos = 0;
+  const char *string_start = p->state >= R_OSC ? bytes : NULL;
+
+#define ENTER_STATE(st)        do { p->state = st; string_start = NULL; } while(0)
+#define ENTER_NORMAL_STATE()   ENTER_STATE(R_NORMAL)
+
+  for( ; pos < len; pos++) {
+    unsigned char c = bytes[pos];
+    bool c1_allowed = !p->utf8;
+
+    if(c == 0x00 || c == 0x7f) { // NUL, DEL
+      if(p->state >= R_OSC) {
+        ref_string_fragment(p, string_start, ref_string_len(p, string_start, bytes + pos), false);
+        string_start = bytes + pos + 1;
+      }
+      continue;
+    }
+    if(c == 0x18 || c == 0x1a) { // CAN, SUB
+      p->in_esc = false;
+      ENTER_NORMAL_STATE();
+      continue;
+    }
+    else if(c == 0x1b) { // ESC
+      p->intermedlen = 0;
+      if(p->state < R_OSC)
+        p->state = R_NORMAL;
+      p->in_esc = true;
+      continue;
+    }
+    else if(c == 0x07 &&  // BEL, can stand for ST in OSC or DCS state
+            p->state >= R_OSC) {
+      // fallthrough
+    }
+    else if(c < 0x20) { // other C0
+      if(p->state >= R_OSC)
+        ref_string_fragment(p, string_start, ref_string_len(p, string_start, bytes + pos), false);
+      cb_control(c, p->log);
+      if(p->state >= R_OSC)
+        string_start = bytes + pos + 1;
+      continue;
+    }
+    // else fallthrough
+
+    size_t string_len = string_start ? ref_string_len(p, string_start, bytes + pos) : 0;
+
+    if(p->in_esc) {
+      // Hoist an ESC letter into a C1 if we're not in a string mode
+      // Always accept ESC \ == ST even in string mode
+      if(!p->intermedlen &&
+          c >= 0x40 && c < 0x60 &&
+          ((p->state < R_OSC || c == 0x5c))) {
+        c += 0x40;
+        c1_allowed = true;
+        p->in_esc = false;
+      }
+      else {
+        string_start = NULL;
+        p->state = R_NORMAL;
+      }
+    }
+
+    switch(p->state) {
+    case R_CSI_LEADER:
+      /* Extract leader bytes 0x3c to 0x3f */
+      if(c >= 0x3c && c <= 0x3f) {
+        if(p->leaderlen < CSI_LEADER_MAX-1)
+          p->leader[p->leaderlen++] = c;
+        break;
+      }
+
+      /* else fallthrough */
+      p->leader[p->leaderlen] = 0;
+
+      p->argi = 0;
+      p->args[0] = CSI_ARG_MISSING;
+      p->state = R_CSI_ARGS;
+
+      /* fallthrough */
+    case R_CSI_ARGS:
+      /* Numerical value of argument */
+      if(c >= '0' && c <= '9') {
+        if(p->args[p->argi] == CSI_ARG_MISSING)
+          p->args[p->argi] = 0;
+        p->args[p->argi] *= 10;
+        p->args[p->argi] += c - '0';
+        break;
+      }
+      if(c == ':') {
+        p->args[p->argi] |= CSI_ARG_FLAG_MORE;
+        c = ';';
+      }
+      if(c == ';') {
+        if(p->argi < CSI_ARGS_MAX-1)
+          p->argi++;
+        p->args[p->argi] = CSI_ARG_MISSING;
+        break;
+      }
+
+      /* else fallthrough */
+      p->argi++;
+      p->intermedlen = 0;
+      p->state = R_CSI_INTERMED;
+      /* fallthrough */
+    case R_CSI_INTERMED:
+      if(c >= 0x20 && c <= 0x2f) {
+        if(p->intermedlen < INTERMED_MAX-1)
+          p->intermed[p->intermedlen++] = c;
+        break;
+      }
+      else if(c >= 0x40 && c <= 0x7e) {
+        p->intermed[p->intermedlen] = 0;
+        cb_csi(p->leaderlen ? p->leader : NULL, p->args, p->argi,
+            p->intermedlen ? p->intermed : NULL, c, p->log);
+      }
+      /* else was invalid CSI */
+
+      ENTER_NORMAL_STATE();
+      break;
+
+    case R_OSC_COMMAND:
+      /* Numerical value of command */
+      if(c >= '0' && c <= '9') {
+        if(p->osc_command == -1)
+          p->osc_command = 0;
+        else
+          p->osc_command *= 10;
+        p->osc_command += c - '0';
+        break;
+      }
+      if(c == ';') {
+        p->state = R_OSC;
+        string_start = bytes + pos + 1;
+        break;
+      }
+
+      /* else fallthrough */
+      string_start = bytes + pos;
+      string_len = 0;
+      p->state = R_OSC;
+      goto string_state;
+
+    case R_DCS_COMMAND:
+      if(p->dcs_commandlen < CSI_LEADER_MAX)
+        p->dcs_command[p->dcs_commandlen++] = c;
+
+      if(c >= 0x40 && c<= 0x7e) {
+        string_start = bytes + pos + 1;
+        p->state = R_DCS;
+      }
+      break;
+
+string_state:
+    case R_OSC:
+    case R_DCS:
+      if(c == 0x07 || (c1_allowed && c == 0x9c)) {
+        ref_string_fragment(p, string_start, string_len, true);
+        ENTER_NORMAL_STATE();
+      }
+      break;
+
+    case R_NORMAL:
+      if(p->in_esc) {
+        if(c >= 0x20 && c <= 0x2f) {
+          if(p->intermedlen < INTERMED_MAX-1)
+            p->intermed[p->intermedlen++] = c;
+        }
+        else if(c >= 0x30 && c < 0x7f) {
+          ref_escape(p, c);
+          p->in_esc = 0;
+          ENTER_NORMAL_STATE();
+        }
+        break;
+      }
+      if(c1_allowed && c >= 0x80 && c < 0xa0) {
+        switch(c) {
+        case 0x90: // DCS
+          p->string_initial = true;
+          p->dcs_commandlen = 0;
+          ENTER_STATE(R_DCS_COMMAND);
+          break;
+        case 0x9b: // CSI
+          p->leaderlen = 0;
+          ENTER_STATE(R_CSI_LEADER);
+          break;
+        case 0x9d: // OSC
+          p->osc_command = -1;
+          p->string_initial = true;
+          ENTER_STATE(R_OSC_COMMAND);
+          break;
+        default:
+          cb_control(c, p->log);
+          break;
+        }
+      }
+      else {
+        size_t eaten = cb_text(bytes + pos, len - pos, p->log);
+        if(!eaten)
+          eaten = 1;
+
+        pos += (eaten - 1); // we'll ++ it again in a moment
+      }
+      break;
+    }
+  }
+
+  if(string_start)
+    ref_string_fragment(p, string_start, ref_string_len(p, string_start, bytes + pos), false);
+
+#undef ENTER_STATE
+#undef ENTER_NORMAL_STATE
+}
+
+/* A pair of parsers being compared */
+
+typedef struct {
+  VTerm *vt;
+  RefParser ref;
+  Log newlog, reflog;
+} Pair;
+
+static void pair_init(Pair *pair, bool utf8)
+{
+  pair->vt = vterm_new(25, 80);
+  vterm_set_utf8(pair->vt, utf8);
+  vterm_parser_set_callbacks(pair->vt, &cbs, &pair->newlog);
+
+  memset(&pair->ref, 0, sizeof(pair->ref));
+  pair->ref.utf8 = utf8;
+  pair->ref.log = &pair->reflog;
+
+  pair->newlog = (Log){ 0 };
+  pair->reflog = (Log){ 0 };
+}
+
+static void pair_write(Pair *pair, const char *bytes, size_t len)
+{
+  vterm_input_write(pair->vt, bytes, len);
+  ref_input_write(&pair->ref, bytes, len);
+}
+
+static int pair_check(Pair *pair, const char *what)
+{
+  int ok = pair->newlog.len == pair->reflog.len &&
+    (!pair->newlog.len || memcmp(pair->newlog.buf, pair->reflog.buf, pair->newlog.len) == 0);
+
+  if(!ok)
+    fprintf(stderr, "! %s: parsers differ\n--- reference:\n%.*s--- new:\n%.*s",
+        what, (int)pair->reflog.len, pair->reflog.buf, (int)pair->newlog.len, pair->newlog.buf);
+
+  vterm_free(pair->vt);
+  return ok;
+}
+
+/* Decodes the "..." or "..."xN Perl string of a PUSH line */
+static size_t unquote(const char *s, char *out)
+{
+  char *o = out;
+
+  if(*s++ != '"')
+    return 0;
+
+  while(*s && *s != '"') {
+    if(*s != '\\') {
+      *o++ = *s++;
+      continue;
+    }
+
+    s++;
+    switch(*s++) {
+      case 'e': *o++ = 0x1b; break;
+      case 'n': *o++ = '\n'; break;
+      case 'r': *o++ = '\r'; break;
+      case 't': *o++ = '\t'; break;
+      case 'a': *o++ = 0x07; break;
+      case 'b': *o++ = 0x08; break;
+      case '0': *o++ = 0x00; break;
+      case 'x':
+        if(*s == '{') {
+          *o++ = strtoul(s + 1, (char **)&s, 16);
+          s++;
+        }
+        else {
+          char hex[3] = { s[0], s[1], 0 };
+          *o++ = strtoul(hex, NULL, 16);
+          s += 2;
+        }
+        break;
+      default: *o++ = s[-1]; break;
+    }
+  }
+
+  size_t len = o - out;
+  if(*s == '"' && s[1] == 'x') {
+    int count = atoi(s + 2);
+    for(int i = 1; i < count; i++)
+      memcpy(out + i * len, out, len);
+    len *= count;
+  }
+
+  return len;
+}
+
+static int run_corpus(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if(!f) {
+    perror(path);
+    return 0;
+  }
+
+  char line[1024];
+  char *bytes[1024];
+  size_t lens[1024];
+  int npush = 0;
+
+  while(fgets(line, sizeof line, f) && npush < 1024) {
+    if(strncmp(line, "PUSH ", 5) != 0)
+      continue;
+    bytes[npush] = malloc(sizeof line * 100);
+    lens[npush] = unquote(line + 5, bytes[npush]);
+    npush++;
+  }
+  fclose(f);
+
+  int ok = 1;
+  for(int utf8 = 0; utf8 < 2; utf8++)
+    for(int bytewise = 0; bytewise < 2; bytewise++) {
+      Pair pair;
+      pair_init(&pair, utf8);
+
+      for(int i = 0; i < npush; i++)
+        if(bytewise)
+          for(size_t j = 0; j < lens[i]; j++)
+            pair_write(&pair, bytes[i] + j, 1);
+        else
+          pair_write(&pair, bytes[i], lens[i]);
+
+      ok &= pair_check(&pair, path);
+      free(pair.newlog.buf);
+      free(pair.reflog.buf);
+    }
+
+  for(int i = 0; i < npush; i++)
+    free(bytes[i]);
+
+  return ok;
+}
+
+static const char *fuzz_tokens[] = {
+  "\x1b", "[", "]", "P", "\\", "(", " ", "?", ">", ";", ":", "1", "23", "m", "q", "A", "z",
+  "\x07", "\x00", "\x7f", "\n", "\x18", "\x1a", "\x90", "\x9b", "\x9c", "\x9d", "\x85",
+  "\xc3\xa9", "\xe2\x82\xac",
+};
+#define N_FUZZ_TOKENS (sizeof(fuzz_tokens)/sizeof(fuzz_tokens[0]))
+
+static int run_fuzz(int iterations)
+{
+  char input[512];
+  int ok = 1;
+
+  srand(1);
+
+  for(int iter = 0; iter < iterations && ok; iter++) {
+    size_t len = 0;
+    int ntokens = 1 + rand() % 40;
+    for(int i = 0; i < ntokens; i++) {
+      if(rand() % 8 == 0)
+        input[len++] = rand() % 256;
+      else {
+        int t = rand() % N_FUZZ_TOKENS;
+        /* the NUL token is one byte long too */
+        size_t toklen = fuzz_tokens[t][0] ? strlen(fuzz_tokens[t]) : 1;
+        memcpy(input + len, fuzz_tokens[t], toklen);
+        len += toklen;
+      }
+    }
+
+    Pair pair;
+    pair_init(&pair, rand() % 2);
+
+    size_t pos = 0;
+    while(pos < len) {
+      size_t chunk = 1 + rand() % (len - pos);
+      pair_write(&pair, input + pos, chunk);
+      pos += chunk;
+    }
+
+    ok &= pair_check(&pair, "fuzz");
+    if(!ok) {
+      fprintf(stderr, "input: ");
+      for(size_t i = 0; i < len; i++)
+        fprintf(stderr, "%02x", (unsigned char)input[i]);
+      fprintf(stderr, "\n");
+    }
+
+    free(pair.newlog.buf);
+    free(pair.reflog.buf);
+  }
+
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  int ok = 1;
+
+  for(int i = 1; i < argc; i++)
+    ok &= run_corpus(argv[i]);
+
+  ok &= run_fuzz(200000);
+
+  if(!ok)
+    return 1;
+
+  printf("parserdiff: OK\n");
+  return 0;
+}
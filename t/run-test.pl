@@ -81,11 +81,15 @@ sub do_line
    # Commands have capitals
    elsif( $line =~ m/^([A-Z]+)/ ) {
       # Some convenience formatting
-      if( $line =~ m/^(PUSH|ENCIN) (.*)$/ ) {
+      if( $line =~ m/^(PUSH|PUSHBUDGET \d+|ENCIN) (.*)$/ ) {
          # we're evil
          my $string = eval($2);
          $line = "$1 " . unpack "H*", $string;
       }
+      elsif( $line =~ m/^(PUSHVC?) (.*)$/ ) {
+         # one hex string per segment
+         $line = "$1 " . join " ", map { unpack "H*", $_ } eval($2);
+      }
 
       do_onetest if defined $command;
 